@@ -0,0 +1,184 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+/*
+ * The blacklist/whitelist address matching microbenchmark.
+ *
+ * It compares the linear nxt_addr_pattern_match() scan with the
+ * nxt_addr_tree_match() trie lookup.  Build it against a configured
+ * nginx tree:
+ *
+ *   cc -O2 -I $NGINX/objs -I $NGINX/src/core -I $NGINX/src/event \
+ *      -I $NGINX/src/os/unix -I src \
+ *      bench/nxt_addr_bench.c src/nxt_addr.c src/nxt_conf.c \
+ *      src/nxt_mp.c src/nxt_malloc.c src/nxt_rbtree.c src/nxt_string.c \
+ *      src/nxt_lvlhsh.c src/nxt_array.c src/nxt_utf8.c src/nxt_parse.c \
+ *      src/nxt_sprintf.c src/nxt_sockaddr.c src/nxt_djb_hash.c \
+ *      src/nxt_file.c src/nxt_list.c -lm -o nxt_addr_bench
+ *
+ * The lists mix exact addresses, CIDR blocks and ranges.
+ */
+
+#include <nxt_main.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define NXT_BENCH_LOOKUPS  1000000
+
+
+static const nxt_uint_t  sizes[] = { 1, 10, 100, 1000, 10000 };
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static double
+nxt_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static nxt_int_t
+nxt_bench_pattern(nxt_mp_t *mp, nxt_addr_pattern_t *pattern, nxt_uint_t i)
+{
+    int               length;
+    uint32_t          addr;
+    nxt_conf_value_t  *cv;
+    u_char            buf[64];
+
+    addr = random();
+
+    switch (i % 3) {
+
+    case 0:
+        length = snprintf((char *) buf, sizeof(buf), "\"%u.%u.%u.%u\"",
+                          addr >> 24, (addr >> 16) & 0xFF,
+                          (addr >> 8) & 0xFF, addr & 0xFF);
+        break;
+
+    case 1:
+        length = snprintf((char *) buf, sizeof(buf), "\"%u.%u.%u.0/%u\"",
+                          addr >> 24, (addr >> 16) & 0xFF,
+                          (addr >> 8) & 0xFF, 16 + (addr & 7));
+        break;
+
+    default:
+        length = snprintf((char *) buf, sizeof(buf),
+                          "\"%u.%u.%u.10-%u.%u.%u.200\"",
+                          addr >> 24, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF,
+                          addr >> 24, (addr >> 16) & 0xFF, (addr >> 8) & 0xFF);
+        break;
+    }
+
+    cv = nxt_conf_json_parse(mp, buf, buf + length, NULL);
+    if (cv == NULL) {
+        return NXT_ERROR;
+    }
+
+    return nxt_addr_pattern_parse(mp, pattern, cv);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double              start, linear, tree;
+    nxt_mp_t            *mp;
+    uintptr_t           sum;
+    nxt_uint_t          i, j, k, n, lookups;
+    nxt_sockaddr_t      *remote;
+    nxt_addr_tree_t     *addr_tree;
+    nxt_addr_pattern_t  *patterns;
+
+    remote = calloc(NXT_BENCH_LOOKUPS, sizeof(nxt_sockaddr_t));
+    if (remote == NULL) {
+        return 1;
+    }
+
+    srandom(1);
+
+    for (i = 0; i < NXT_BENCH_LOOKUPS; i++) {
+        remote[i].u.sockaddr_in.sin_family = AF_INET;
+        remote[i].u.sockaddr_in.sin_addr.s_addr = random();
+    }
+
+    printf("%8s %8s %12s %12s %8s\n",
+           "patterns", "nodes", "linear ns", "tree ns", "speedup");
+
+    for (k = 0; k < nxt_nitems(sizes); k++) {
+        n = sizes[k];
+
+        mp = nxt_mp_create(1024, 128, 256, 32);
+        if (mp == NULL) {
+            return 1;
+        }
+
+        patterns = nxt_mp_alloc(mp, n * sizeof(nxt_addr_pattern_t));
+        if (patterns == NULL) {
+            return 1;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (nxt_bench_pattern(mp, &patterns[i], i) != NXT_OK) {
+                return 1;
+            }
+        }
+
+        addr_tree = nxt_addr_tree_create(mp, patterns, n);
+        if (addr_tree == NULL) {
+            return 1;
+        }
+
+        lookups = NXT_BENCH_LOOKUPS / (1 + n / 100);
+        sum = 0;
+
+        start = nxt_bench_now();
+
+        for (i = 0; i < lookups; i++) {
+            for (j = 0; j < n; j++) {
+                if (nxt_addr_pattern_match(&patterns[j], &remote[i])) {
+                    sum++;
+                    break;
+                }
+            }
+        }
+
+        linear = (nxt_bench_now() - start) / lookups;
+
+        start = nxt_bench_now();
+
+        for (i = 0; i < lookups; i++) {
+            sum += nxt_addr_tree_match(addr_tree, &remote[i].u.sockaddr);
+        }
+
+        tree = (nxt_bench_now() - start) / lookups;
+
+        __asm__ __volatile__ ("" : : "r" (sum) : "memory");
+
+        printf("%8zu %8u %12.1f %12.1f %7.2fx\n",
+               (size_t) n, addr_tree->items, linear, tree, linear / tree);
+
+        nxt_mp_destroy(mp);
+    }
+
+    free(remote);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+/*
+ * The hash functions microbenchmark.
+ *
+ * It compares nxt_djb_hash() and nxt_wy_hash() by the time per key and
+ * shows how the request field hash, which the argument, cookie and header
+ * indexes used before nxt_wy_hash(), is flooded by crafted names.  Build
+ * it against a configured nginx tree:
+ *
+ *   cc -O2 -I $NGINX/objs -I $NGINX/src/core -I $NGINX/src/event \
+ *      -I $NGINX/src/os/unix -I src \
+ *      bench/nxt_hash_bench.c src/nxt_wy_hash.c src/nxt_djb_hash.c \
+ *      -o nxt_hash_bench
+ *
+ * The lengths correspond to argument names, Host headers and route keys.
+ */
+
+#include <nxt_main.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define NXT_BENCH_ITERATIONS  4000000
+
+/* 2^12 names of 24 bytes. */
+#define NXT_BENCH_BLOCKS      12
+#define NXT_BENCH_NAMES       (1 << NXT_BENCH_BLOCKS)
+
+
+#define NXT_BENCH_FIELD_HASH_INIT        159406U
+#define nxt_bench_field_hash_char(h, c)  (((h) << 4) + (h) + (c))
+#define nxt_bench_field_hash_end(h)      (((h) >> 16) ^ (h))
+
+
+static const size_t  lengths[] = { 4, 8, 16, 32, 64, 256 };
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+volatile ngx_time_t   *ngx_cached_time;
+ngx_pid_t             ngx_pid;
+
+
+void
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static double
+nxt_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static uint32_t
+nxt_bench_field_hash(const u_char *p, size_t len)
+{
+    size_t    i;
+    uint32_t  hash;
+
+    hash = NXT_BENCH_FIELD_HASH_INIT;
+
+    for (i = 0; i < len; i++) {
+        hash = nxt_bench_field_hash_char(hash, p[i]);
+    }
+
+    return nxt_bench_field_hash_end(hash) & 0xFFFF;
+}
+
+
+static double
+nxt_bench_run(nxt_uint_t func, u_char *text, size_t length)
+{
+    u_char      *p;
+    double      start;
+    uint64_t    sum;
+    nxt_uint_t  n;
+
+    sum = 0;
+
+    start = nxt_bench_now();
+
+    for (n = 0; n < NXT_BENCH_ITERATIONS; n++) {
+        p = text + (n & 63);
+
+        sum += (func == 0) ? nxt_djb_hash(p, length) : nxt_wy_hash(p, length);
+
+        __asm__ __volatile__ ("" : : "r" (sum) : "memory");
+    }
+
+    return (nxt_bench_now() - start) / NXT_BENCH_ITERATIONS;
+}
+
+
+/*
+ * Every name is a sequence of the "as" and "bb" blocks, which add the same
+ * to the field hash state: 'a' * 17 + 's' == 'b' * 17 + 'b'.
+ */
+
+static void
+nxt_bench_collisions(void)
+{
+    u_char      *name;
+    uint32_t    *field, *wy, hash;
+    nxt_uint_t  i, k, max_field, max_wy;
+
+    static const size_t  size = 2 * NXT_BENCH_BLOCKS;
+
+    field = calloc(NXT_BENCH_NAMES, sizeof(uint32_t));
+    wy = calloc(NXT_BENCH_NAMES, sizeof(uint32_t));
+    name = malloc(size);
+
+    if (field == NULL || wy == NULL || name == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < NXT_BENCH_NAMES; i++) {
+
+        for (k = 0; k < NXT_BENCH_BLOCKS; k++) {
+            if (i & (1 << k)) {
+                name[2 * k] = 'b';
+                name[2 * k + 1] = 'b';
+
+            } else {
+                name[2 * k] = 'a';
+                name[2 * k + 1] = 's';
+            }
+        }
+
+        hash = nxt_bench_field_hash(name, size);
+        field[hash & (NXT_BENCH_NAMES - 1)]++;
+
+        hash = (uint16_t) nxt_wy_hash(name, size);
+        wy[hash & (NXT_BENCH_NAMES - 1)]++;
+    }
+
+    max_field = 0;
+    max_wy = 0;
+
+    for (i = 0; i < NXT_BENCH_NAMES; i++) {
+        max_field = nxt_max(max_field, field[i]);
+        max_wy = nxt_max(max_wy, wy[i]);
+    }
+
+    printf("\n%d crafted names in %d buckets, the longest chain:\n",
+           NXT_BENCH_NAMES, NXT_BENCH_NAMES);
+    printf("%-16s %8u\n", "field hash", (unsigned) max_field);
+    printf("%-16s %8u\n", "wy hash", (unsigned) max_wy);
+
+    free(field);
+    free(wy);
+    free(name);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    u_char      *text;
+    double      djb, wy;
+    size_t      length;
+    nxt_uint_t  i, k;
+
+    static const char  alphabet[] =
+        "session_id=A1b2C3d4E5f6; theme=dark; www.example.com/api/v1/";
+
+    text = malloc(256 + 64);
+    if (text == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < 256 + 64; i++) {
+        text[i] = alphabet[i % nxt_length(alphabet)];
+    }
+
+    nxt_wy_hash_init();
+
+    printf("%8s %12s %12s %8s\n", "length", "djb ns", "wy ns", "speedup");
+
+    for (k = 0; k < nxt_nitems(lengths); k++) {
+        length = lengths[k];
+
+        djb = nxt_bench_run(0, text, length);
+        wy = nxt_bench_run(1, text, length);
+
+        printf("%8zu %12.1f %12.1f %7.2fx\n", length, djb, wy, djb / wy);
+    }
+
+    nxt_bench_collisions();
+
+    free(text);
+
+    return 0;
+}
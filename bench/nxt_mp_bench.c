@@ -0,0 +1,213 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+/*
+ * The request memory pool microbenchmark.
+ *
+ * It compares a pool created and destroyed per request with a pool
+ * recycled by nxt_mp_reset(), as ngx_http_ctrl_get_ctx() does.  The
+ * allocator is replaced with counting wrappers instead of nxt_malloc.c.
+ * Build it against a configured nginx tree:
+ *
+ *   cc -O2 -I $NGINX/objs -I $NGINX/src/core -I $NGINX/src/event \
+ *      -I $NGINX/src/os/unix -I src \
+ *      bench/nxt_mp_bench.c src/nxt_mp.c src/nxt_rbtree.c \
+ *      -o nxt_mp_bench
+ *
+ * The allocations correspond to the ctrl context, the cookie index and
+ * a few variable values of a routed request.
+ */
+
+#include <nxt_main.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define NXT_BENCH_REQUESTS  1000000
+
+
+static const size_t  sizes[] = { 128, 64, 256, 32, 512, 96, 64, 1024 };
+
+
+static nxt_uint_t  nxt_bench_mallocs;
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+void *
+nxt_malloc(size_t size)
+{
+    nxt_bench_mallocs++;
+
+    return malloc(size);
+}
+
+
+void *
+nxt_zalloc(size_t size)
+{
+    nxt_bench_mallocs++;
+
+    return calloc(1, size);
+}
+
+
+void *
+nxt_realloc(void *p, size_t size)
+{
+    nxt_bench_mallocs++;
+
+    return realloc(p, size);
+}
+
+
+void *
+nxt_memalign(size_t alignment, size_t size)
+{
+    void  *p;
+
+    nxt_bench_mallocs++;
+
+    if (posix_memalign(&p, alignment, size) != 0) {
+        return NULL;
+    }
+
+    return p;
+}
+
+
+static double
+nxt_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void
+nxt_bench_cleanup(void *data)
+{
+    uintptr_t  *sum;
+
+    sum = data;
+    (*sum)++;
+}
+
+
+static nxt_int_t
+nxt_bench_request(nxt_mp_t *mp, uintptr_t *sum)
+{
+    u_char      *p;
+    nxt_uint_t  i;
+
+    for (i = 0; i < nxt_nitems(sizes); i++) {
+        p = nxt_mp_alloc(mp, sizes[i]);
+        if (p == NULL) {
+            return NXT_ERROR;
+        }
+
+        p[0] = (u_char) i;
+        *sum += (uintptr_t) p[0];
+    }
+
+    return nxt_mp_cleanup(mp, nxt_bench_cleanup, sum);
+}
+
+
+static double
+nxt_bench_run(nxt_bool_t reuse, nxt_uint_t *mallocs)
+{
+    double      start;
+    nxt_mp_t    *mp;
+    uintptr_t   sum;
+    nxt_uint_t  n;
+
+    sum = 0;
+    mp = NULL;
+
+    if (reuse) {
+        mp = nxt_mp_create(4096, 128, 1024, 64);
+        if (mp == NULL) {
+            return -1;
+        }
+
+        (void) nxt_bench_request(mp, &sum);
+        nxt_mp_reset(mp);
+    }
+
+    nxt_bench_mallocs = 0;
+
+    start = nxt_bench_now();
+
+    for (n = 0; n < NXT_BENCH_REQUESTS; n++) {
+
+        if (!reuse) {
+            mp = nxt_mp_create(4096, 128, 1024, 64);
+            if (mp == NULL) {
+                return -1;
+            }
+        }
+
+        if (nxt_bench_request(mp, &sum) != NXT_OK) {
+            return -1;
+        }
+
+        if (reuse) {
+            nxt_mp_reset(mp);
+
+        } else {
+            nxt_mp_destroy(mp);
+        }
+
+        __asm__ __volatile__ ("" : : "r" (sum) : "memory");
+    }
+
+    start = (nxt_bench_now() - start) / NXT_BENCH_REQUESTS;
+
+    *mallocs = nxt_bench_mallocs;
+
+    if (reuse) {
+        nxt_mp_destroy(mp);
+    }
+
+    return start;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    double      ns;
+    nxt_uint_t  k, mallocs;
+
+    static const char  *names[] = { "create/destroy", "reset/reuse" };
+
+    printf("%-16s %12s %16s\n", "pool", "ns/request", "mallocs/request");
+
+    for (k = 0; k < nxt_nitems(names); k++) {
+        ns = nxt_bench_run(k, &mallocs);
+        if (ns < 0) {
+            return 1;
+        }
+
+        printf("%-16s %12.1f %16.2f\n", names[k], ns,
+               (double) mallocs / NXT_BENCH_REQUESTS);
+    }
+
+    return 0;
+}
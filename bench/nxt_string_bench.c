@@ -0,0 +1,161 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+/*
+ * The string kernels microbenchmark.
+ *
+ * It includes nxt_string.c to reach the generic, SSE2 and AVX2 kernels
+ * directly.  Build it against a configured nginx tree:
+ *
+ *   cc -O2 -DNGX_HAVE_X86_SIMD=1 \
+ *      -I $NGINX/objs -I $NGINX/src/core -I $NGINX/src/event \
+ *      -I $NGINX/src/os/unix -I src \
+ *      bench/nxt_string_bench.c src/nxt_mp.c src/nxt_malloc.c \
+ *      src/nxt_rbtree.c -o nxt_string_bench
+ *
+ * The lengths correspond to typical Host, User-Agent and Cookie headers.
+ */
+
+#include "../src/nxt_string.c"
+
+#include <stdio.h>
+#include <time.h>
+
+
+#define NXT_BENCH_ITERATIONS  2000000
+
+
+static const size_t  lengths[] = { 16, 64, 128, 256, 1024, 4096 };
+
+
+volatile ngx_cycle_t  *ngx_cycle;
+
+
+void
+ngx_log_error(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+
+static double
+nxt_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static double
+nxt_bench_run(const nxt_string_handlers_t *handlers, nxt_uint_t kernel,
+    u_char *text, u_char *copy, size_t length)
+{
+    double      start;
+    uintptr_t   sum;
+    nxt_uint_t  n, iterations;
+
+    static const char  needle[] = "Chrome/120.0";
+
+    iterations = NXT_BENCH_ITERATIONS * 64 / (length + 64);
+    sum = 0;
+
+    start = nxt_bench_now();
+
+    for (n = 0; n < iterations; n++) {
+
+        switch (kernel) {
+
+        case 0:
+            sum += (uintptr_t) handlers->memstrn(text, text + length, needle,
+                                                 nxt_length(needle));
+            break;
+
+        case 1:
+            sum += (uintptr_t) handlers->memcasestrn(text, text + length,
+                                                     needle,
+                                                     nxt_length(needle));
+            break;
+
+        case 2:
+            sum += handlers->memcasecmp(text, copy, length);
+            break;
+
+        default:
+            handlers->memcpy_lowcase(copy, text, length);
+            sum += copy[n % length];
+            break;
+        }
+
+        __asm__ __volatile__ ("" : : "r" (sum) : "memory");
+    }
+
+    return (nxt_bench_now() - start) / iterations;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    u_char      *text, *copy;
+    double      generic, simd;
+    size_t      length;
+    nxt_uint_t  i, k, kernel;
+
+    static const char  *names[] = {
+        "memstrn", "memcasestrn", "memcasecmp", "memcpy_lowcase"
+    };
+
+    static const char  alphabet[] =
+        "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) session=A1b2C3d4E5f6; theme=dark; ";
+
+    text = malloc(4096);
+    copy = malloc(4096);
+
+    if (text == NULL || copy == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < 4096; i++) {
+        text[i] = alphabet[i % nxt_length(alphabet)];
+    }
+
+    nxt_memcpy_upcase(copy, text, 4096);
+
+    nxt_string_init();
+
+    printf("kernels: %s\n\n",
+           (nxt_string_handlers == &nxt_string_generic) ? "generic"
+#if (NXT_HAVE_X86_SIMD)
+           : (nxt_string_handlers == &nxt_string_avx2) ? "avx2"
+#endif
+           : "sse2");
+
+    printf("%-16s %8s %12s %12s %8s\n",
+           "kernel", "length", "generic ns", "simd ns", "speedup");
+
+    for (kernel = 0; kernel < nxt_nitems(names); kernel++) {
+
+        for (k = 0; k < nxt_nitems(lengths); k++) {
+            length = lengths[k];
+
+            generic = nxt_bench_run(&nxt_string_generic, kernel, text, copy,
+                                    length);
+            simd = nxt_bench_run(nxt_string_handlers, kernel, text, copy,
+                                 length);
+
+            printf("%-16s %8zu %12.1f %12.1f %7.2fx\n",
+                   names[kernel], length, generic, simd, generic / simd);
+        }
+    }
+
+    free(text);
+    free(copy);
+
+    return 0;
+}
@@ -7,15 +7,20 @@
 #include <ngx_http_ctrl.h>
 
 
-static nxt_conf_value_t *ngx_http_conf_get(nxt_mp_t *mp, nxt_file_t *file,
-    nxt_str_t *error);
+static nxt_conf_value_t *ngx_http_conf_get(ngx_cycle_t *cycle, nxt_mp_t *mp,
+    nxt_file_t *file, nxt_str_t *error);
 static ngx_int_t ngx_http_conf_response(nxt_http_request_t *req);
 static ngx_int_t ngx_http_conf_stringify(nxt_mp_t *mp, nxt_conf_value_t *value,
     nxt_str_t *str);
 static ngx_int_t ngx_http_conf_store(nxt_http_request_t *req);
 
 
-static ngx_http_conf_t  *ngx_http_conf;
+static ngx_http_conf_t         *ngx_http_conf;
+static uint64_t                ngx_http_conf_generation;
+static ngx_http_route_cache_t  *ngx_http_conf_cache;
+
+static const nxt_str_t  ngx_http_conf_empty =
+    nxt_string("{ \"routes\": [] }");
 
 
 ngx_int_t
@@ -29,16 +34,38 @@ ngx_http_conf_start(ngx_cycle_t *cycle, nxt_file_t *file, nxt_str_t *error)
         return NGX_ERROR;
     }
 
-    conf = ngx_http_conf_get(mp, file, error);
+    conf = ngx_http_conf_get(cycle, mp, file, error);
     if (nxt_slow_path(conf == NULL)) {
         goto fail;
     }
 
-    if (ngx_http_conf_apply(cycle, mp, conf) != NXT_OK) {
+    if (ngx_http_conf_apply(cycle, mp, conf) == NXT_OK) {
+        return NGX_OK;
+    }
+
+    /*
+     * The stored configuration may no longer apply to nginx.conf, e.g. it
+     * references a removed upstream zone.  The file is kept as is and the
+     * empty configuration is used.
+     */
+
+    nxt_mp_destroy(mp);
+
+    mp = nxt_mp_create(1024, 128, 256, 32);
+    if (nxt_slow_path(mp == NULL)) {
+        return NGX_ERROR;
+    }
+
+    conf = nxt_conf_json_parse_str(mp, &ngx_http_conf_empty);
+    if (nxt_slow_path(conf == NULL)) {
         goto fail;
     }
 
-    return NGX_OK;
+    nxt_str_set(error, "the stored configuration cannot be applied");
+
+    if (ngx_http_conf_apply(cycle, mp, conf) == NXT_OK) {
+        return NGX_OK;
+    }
 
 fail:
 
@@ -49,7 +76,8 @@ fail:
 
 
 static nxt_conf_value_t *
-ngx_http_conf_get(nxt_mp_t *mp, nxt_file_t *file, nxt_str_t *error)
+ngx_http_conf_get(ngx_cycle_t *cycle, nxt_mp_t *mp, nxt_file_t *file,
+    nxt_str_t *error)
 {
     size_t                 size;
     u_char                 *start;
@@ -60,8 +88,6 @@ ngx_http_conf_get(nxt_mp_t *mp, nxt_file_t *file, nxt_str_t *error)
     nxt_conf_validation_t  vldt;
     nxt_conf_json_error_t  err;
 
-    static const nxt_str_t json = nxt_string("{ \"routes\": [] }");
-
     ret = nxt_file_open(file, NXT_FILE_RDWR, NXT_FILE_CREATE_OR_OPEN,
                         NXT_FILE_DEFAULT_ACCESS);
 
@@ -99,6 +125,8 @@ ngx_http_conf_get(nxt_mp_t *mp, nxt_file_t *file, nxt_str_t *error)
                     }
 
                     vldt.conf = value;
+                    vldt.ctx = cycle;
+                    vldt.variable = ngx_http_route_variable_check;
 
                     ret = nxt_conf_validate(&vldt);
 
@@ -145,7 +173,7 @@ ngx_http_conf_get(nxt_mp_t *mp, nxt_file_t *file, nxt_str_t *error)
 
 invalid:
 
-    return nxt_conf_json_parse(mp, json.start, json.start + json.length, NULL);
+    return nxt_conf_json_parse_str(mp, &ngx_http_conf_empty);
 }
 
 
@@ -352,7 +380,9 @@ ngx_http_conf_apply(ngx_cycle_t *cycle, nxt_mp_t *mp, nxt_conf_value_t *conf)
     }
 
     http_conf->count = 1;
+    http_conf->generation = ++ngx_http_conf_generation;
     http_conf->pool = mp;
+    http_conf->cycle = cycle;
     http_conf->root = conf;
 
     upstreams_conf = nxt_conf_get_path(conf, &upstreams_path);
@@ -390,6 +420,28 @@ ngx_http_conf_apply(ngx_cycle_t *cycle, nxt_mp_t *mp, nxt_conf_value_t *conf)
 }
 
 
+void
+ngx_http_conf_exit(void)
+{
+    if (ngx_http_conf != NULL) {
+        ngx_http_conf_release(ngx_http_conf);
+        ngx_http_conf = NULL;
+    }
+}
+
+
+ngx_int_t
+ngx_http_conf_cache_init(nxt_uint_t size, ngx_http_route_cache_stats_t *stats)
+{
+    ngx_http_conf_cache = ngx_http_route_cache_create(size, stats);
+    if (nxt_slow_path(ngx_http_conf_cache == NULL)) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 ngx_http_action_t *
 ngx_http_conf_action(ngx_http_request_t *r, ngx_http_conf_t **http_conf)
 {
@@ -402,6 +454,13 @@ ngx_http_conf_action(ngx_http_request_t *r, ngx_http_conf_t **http_conf)
     ngx_http_conf->count++;
 
     if (ngx_http_conf->routes != NULL) {
+
+        if (ngx_http_conf_cache != NULL) {
+            return ngx_http_route_cache_action(r, ngx_http_conf_cache,
+                                               ngx_http_conf->routes,
+                                               ngx_http_conf->generation);
+        }
+
         return ngx_http_route_action(r, ngx_http_conf->routes);
     }
 
@@ -536,6 +595,8 @@ ngx_http_conf_handle(ngx_http_request_t *r, nxt_http_request_t *req)
 
         vldt.conf = value;
         vldt.pool = req->mem_pool;
+        vldt.ctx = (void *) ngx_cycle;
+        vldt.variable = ngx_http_route_variable_check;
 
         ret = nxt_conf_validate(&vldt);
 
@@ -10,7 +10,9 @@
 
 struct ngx_http_conf_s {
     uint32_t                        count;
+    uint64_t                        generation;
     nxt_mp_t                        *pool;
+    ngx_cycle_t                     *cycle;
     nxt_conf_value_t                *root;
     ngx_http_routes_t               *routes;
 };
@@ -40,6 +42,9 @@ ngx_int_t ngx_http_conf_start(ngx_cycle_t *cycle, nxt_file_t *file,
     nxt_str_t *error);
 ngx_int_t ngx_http_conf_apply(ngx_cycle_t *cycle, nxt_mp_t *mp,
     nxt_conf_value_t *conf);
+void ngx_http_conf_exit(void);
+ngx_int_t ngx_http_conf_cache_init(nxt_uint_t size,
+    ngx_http_route_cache_stats_t *stats);
 ngx_http_action_t *ngx_http_conf_action(ngx_http_request_t *r,
     ngx_http_conf_t **http_conf);
 void ngx_http_conf_release(ngx_http_conf_t *http_conf);
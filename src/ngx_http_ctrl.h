@@ -25,6 +25,10 @@ typedef struct {
 
     ngx_str_t                   state;
     nxt_file_t                  file;
+    ngx_path_t                 *addr_path;
+
+    ngx_int_t                   route_cache;
+    ngx_flag_t                  shared_addr;
 
     ngx_shm_zone_t             *shm_zone;
 } ngx_http_ctrl_main_conf_t;
@@ -36,14 +40,28 @@ typedef struct {
 } ngx_http_ctrl_loc_conf_t;
 
 
+/*
+ * A limit_conn or limit_req entry of the shard tables, four to a cache
+ * line.  The key is identified by its 64-bit keyed hash, the high half
+ * selects the shard.  The value is the connections or the excess.
+ */
+
+typedef struct {
+    uint64_t                    fp;
+    uint32_t                    last;
+    uint32_t                    value;
+} ngx_http_ctrl_limit_entry_t;
+
+
 typedef struct {
-    nxt_mp_t                   *mem_pool;
+    nxt_mp_t                     *mem_pool;
 
-    ngx_http_request_t         *request;
-    ngx_http_action_t          *action;
-    ngx_http_conf_t            *http_conf;
+    ngx_http_request_t           *request;
+    ngx_http_action_t            *action;
+    ngx_http_conf_t              *http_conf;
+    ngx_http_route_ctx_t          route;
 
-    ngx_rbtree_node_t          *node;
+    ngx_http_ctrl_limit_entry_t  *limit_conn;
 } ngx_http_ctrl_ctx_t;
 
 
@@ -53,48 +71,160 @@ typedef struct {
 } ngx_http_ctrl_conf_t;
 
 
+/*
+ * The status and route cache counters are kept in a cache line for each
+ * process slot and are summed on read.  A slot is never shared by live
+ * processes, the exiting workers after a reload included, so the lines
+ * are written without atomic operations.
+ */
+
+#define NGX_HTTP_CTRL_STATS_SLOTS  NGX_MAX_PROCESSES
+
+
 typedef struct {
-    ngx_atomic_t                n1xx;
-    ngx_atomic_t                n2xx;
-    ngx_atomic_t                n3xx;
-    ngx_atomic_t                n4xx;
-    ngx_atomic_t                n5xx;
-    ngx_atomic_t                total;
+    ngx_atomic_t                  n1xx;
+    ngx_atomic_t                  n2xx;
+    ngx_atomic_t                  n3xx;
+    ngx_atomic_t                  n4xx;
+    ngx_atomic_t                  n5xx;
+    ngx_atomic_t                  total;
+    ngx_http_route_cache_stats_t  route_cache;
 } ngx_http_ctrl_stats_t;
 
 
+typedef union {
+    ngx_http_ctrl_stats_t       stats;
+    u_char                      pad[NGX_CPU_CACHE_LINE];
+} ngx_http_ctrl_stats_slot_t;
+
+
+/* An immutable address set, keyed by the hash of its patterns. */
+
 typedef struct {
-    ngx_rbtree_t               limit_conn_rbtree;
-    ngx_rbtree_t               limit_req_rbtree;
-    ngx_queue_t                limit_req_queue;
-    ngx_http_ctrl_conf_t       conf;
-    ngx_http_ctrl_stats_t      stats;
-} ngx_http_ctrl_shdata_t;
+    ngx_rbtree_node_t           node;
+    ngx_uint_t                  count;
+    ngx_uint_t                  items;
+    nxt_addr_tree_t             tree;
+    nxt_addr_pattern_t          patterns[1];
+} ngx_http_ctrl_addr_set_t;
+
+
+/*
+ * The limit_conn and limit_req entries are spread over shards by the key
+ * hash.  A shard is placed in its own slab pool, whose mutex protects
+ * the shard, so the keys of different shards never contend.
+ *
+ * The tables of a shard are carved out of its pool at once.  A key looks
+ * in two adjacent buckets, so new keys never allocate: a limit_req key
+ * replaces an empty or the least recently used entry, a limit_conn key
+ * takes an empty one.
+ */
+
+#define NGX_HTTP_CTRL_LIMIT_SHARDS      16
+#define NGX_HTTP_CTRL_LIMIT_SHARD_SIZE  (128 * 1024)
+#define NGX_HTTP_CTRL_LIMIT_BUCKET      4
 
 
 typedef struct {
-    ngx_http_ctrl_shdata_t     *sh;
-    ngx_slab_pool_t            *shpool;
-} ngx_http_ctrl_shctx_t;
+    ngx_http_ctrl_limit_entry_t  *entries;
+    ngx_uint_t                    nbuckets;
+} ngx_http_ctrl_limit_table_t;
+
+
+typedef struct {
+    ngx_slab_pool_t              *shpool;
+    ngx_http_ctrl_limit_table_t   conn;
+    ngx_http_ctrl_limit_table_t   req;
+} ngx_http_ctrl_limit_shard_t;
+
+
+#define ngx_http_ctrl_limit_hash(fp)  ((uint32_t) ((fp) >> 32))
+
+#define ngx_http_ctrl_limit_shard(sh, hash)                                   \
+    (sh)->limit[(hash) & (sh)->limit_mask]
+
+
+/*
+ * The gcra limit_req keeps a key fingerprint and its theoretical arrival
+ * time in an open addressed table updated with compare-and-swap.  A key
+ * probes the slots of one cache line, the idle slots are swept by the
+ * workers on a timer.
+ */
+
+#define NGX_HTTP_CTRL_GCRA_BUCKET       4
+#define NGX_HTTP_CTRL_GCRA_SWEEP        1000
+#define NGX_HTTP_CTRL_GCRA_SWEEP_SLOTS  4096
+#define NGX_HTTP_CTRL_GCRA_IDLE         60000
+
+
+typedef struct {
+    ngx_atomic_t                  key;
+    ngx_atomic_t                  tat;
+} ngx_http_ctrl_gcra_slot_t;
+
+
+typedef struct {
+    ngx_http_ctrl_gcra_slot_t    *slots;
+    ngx_uint_t                    mask;
+    ngx_atomic_t                  sweep;
+} ngx_http_ctrl_gcra_t;
+
+
+/*
+ * The limit_conn and limit_req keys with the most events are tracked by
+ * a count-min sketch of the fingerprints and a small table of the heavy
+ * hitters with their keys.  The workers add their counts in batches with
+ * atomic operations.  A key replaces the least counted one if its estimate
+ * is greater, under a try lock of the entry, so the limiter never waits.
+ * The counters are halved every NGX_HTTP_CTRL_TOP_DECAY milliseconds.
+ */
+
+#define NGX_HTTP_CTRL_TOP_ROWS        4
+#define NGX_HTTP_CTRL_TOP_WIDTH       1024
+#define NGX_HTTP_CTRL_TOP_KEYS        32
+#define NGX_HTTP_CTRL_TOP_KEY_LEN     64
+#define NGX_HTTP_CTRL_TOP_DECAY       60000
+
+
+typedef struct {
+    ngx_atomic_t                  events;
+    ngx_atomic_t                  rejected;
+} ngx_http_ctrl_top_counter_t;
 
 
 typedef struct {
-    u_char                     color;
-    u_char                     len;
-    u_short                    conn;
-    u_char                     data[1];
-} ngx_http_ctrl_limit_conn_node_t;
+    ngx_atomic_t                  fp;
+    ngx_atomic_t                  lock;
+    size_t                        len;
+    u_char                        key[NGX_HTTP_CTRL_TOP_KEY_LEN];
+} ngx_http_ctrl_top_key_t;
 
 
 typedef struct {
-    u_char                     color;
-    u_char                     len;
-    ngx_queue_t                queue;
-    ngx_msec_t                 last;
-    /* integer value, 1 corresponds to 0.001 r/s */
-    ngx_uint_t                 excess;
-    u_char                     data[1];
-} ngx_http_ctrl_limit_req_node_t;
+    ngx_http_ctrl_top_counter_t  *counters;
+    ngx_uint_t                    mask;
+    ngx_atomic_t                  min;
+    ngx_atomic_t                  decay;
+    ngx_http_ctrl_top_key_t       keys[NGX_HTTP_CTRL_TOP_KEYS];
+} ngx_http_ctrl_top_t;
+
+
+typedef struct {
+    ngx_uint_t                    limit_mask;
+    ngx_http_ctrl_limit_shard_t  *limit[NGX_HTTP_CTRL_LIMIT_SHARDS];
+    ngx_http_ctrl_gcra_t          gcra;
+    ngx_http_ctrl_top_t           top;
+    ngx_rbtree_t                  addr_sets;
+    ngx_rbtree_node_t             addr_sentinel;
+    ngx_http_ctrl_conf_t          conf;
+    ngx_http_ctrl_stats_slot_t   *stats;
+} ngx_http_ctrl_shdata_t;
+
+
+typedef struct {
+    ngx_http_ctrl_shdata_t     *sh;
+    ngx_slab_pool_t            *shpool;
+} ngx_http_ctrl_shctx_t;
 
 
 typedef enum {
@@ -114,12 +244,22 @@ ngx_int_t ngx_http_ctrl_limit_conn(ngx_http_request_t *r,
     ngx_http_action_limit_conn_t *lc);
 ngx_int_t ngx_http_ctrl_limit_req(ngx_http_request_t *r,
     ngx_http_action_limit_req_t *lr);
-ngx_int_t ngx_http_ctrl_set_variables(ngx_http_request_t *r,
+void ngx_http_ctrl_limit_gcra_sweep(ngx_event_t *ev);
+ngx_uint_t ngx_http_ctrl_limit_top_count(ngx_http_ctrl_top_t *top,
+    ngx_atomic_uint_t fp, ngx_uint_t *rejected);
+void ngx_http_ctrl_limit_init_process(ngx_cycle_t *cycle);
+void ngx_http_ctrl_set_variables(ngx_http_request_t *r,
     ngx_http_action_variables_t *variables);
+ngx_int_t ngx_http_ctrl_add_headers(ngx_http_request_t *r,
+    ngx_http_action_headers_t *headers);
 ngx_int_t ngx_http_ctrl_blacklist(ngx_http_request_t *r,
     ngx_http_action_addr_t *blacklist);
 ngx_int_t ngx_http_ctrl_whitelist(ngx_http_request_t *r,
     ngx_http_action_addr_t *whitelist);
+void ngx_http_ctrl_addr_share(ngx_http_ctrl_shctx_t *shctx);
+void ngx_http_ctrl_addr_inherit(void);
+nxt_addr_tree_t *ngx_http_ctrl_addr_tree(nxt_mp_t *mp,
+    nxt_addr_pattern_t *patterns, nxt_uint_t n);
 void ngx_http_ctrl_stats_code(ngx_http_request_t *r);
 ngx_int_t ngx_http_ctrl_stats_handler(ngx_http_request_t *r);
 ngx_int_t ngx_http_ctrl_response(ngx_http_request_t *r,
@@ -129,11 +269,6 @@ ngx_int_t ngx_http_ctrl_config_handler(ngx_http_request_t *r);
 void ngx_http_ctrl_notify_write_handler(ngx_event_t *rev);
 void ngx_http_ctrl_notify_read_handler(ngx_event_t *rev);
 
-void ngx_http_ctrl_limit_conn_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
-void ngx_http_ctrl_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
-
 
 extern ngx_module_t  ngx_http_ctrl_module;
 
@@ -6,14 +6,37 @@
 #include <ngx_http_ctrl.h>
 
 
-static ngx_int_t ngx_http_ctrl_set_variable(ngx_http_request_t *r,
-    u_char *name, uint16_t name_length, u_char *value, uint16_t value_length);
 static void ngx_http_ctrl_read_handler(ngx_http_request_t *r);
 static ngx_int_t ngx_http_ctrl_notify(ngx_http_request_t *r, nxt_str_t *notify);
 static void ngx_http_ctrl_conf_release(ngx_slab_pool_t *shpool,
     ngx_http_ctrl_conf_t *conf);
 static void ngx_http_ctrl_conf_locked_release(ngx_slab_pool_t *shpool,
     ngx_http_ctrl_conf_t *conf);
+static ngx_http_ctrl_addr_set_t *ngx_http_ctrl_addr_set_find(
+    ngx_http_ctrl_shdata_t *sh, ngx_rbtree_key_t key);
+static ngx_http_ctrl_addr_set_t *ngx_http_ctrl_addr_set_add(
+    ngx_http_ctrl_shctx_t *shctx, ngx_rbtree_key_t key,
+    nxt_addr_pattern_t *patterns, nxt_uint_t n);
+static void ngx_http_ctrl_addr_set_unref(ngx_slab_pool_t *shpool,
+    ngx_http_ctrl_addr_set_t *set);
+static void ngx_http_ctrl_addr_release(void *data);
+
+
+/*
+ * The address sets of the current configuration referenced by this
+ * process.  The list is inherited by the worker processes together with
+ * the configuration, so they take their own references on start.
+ */
+
+typedef struct {
+    ngx_queue_t                 queue;
+    ngx_slab_pool_t            *shpool;
+    ngx_http_ctrl_addr_set_t   *set;
+} ngx_http_ctrl_addr_ref_t;
+
+
+static ngx_http_ctrl_shctx_t  *ngx_http_ctrl_addr_shctx;
+static ngx_queue_t             ngx_http_ctrl_addr_refs;
 
 
 ngx_int_t
@@ -35,162 +58,362 @@ ngx_http_ctrl_request_init(ngx_http_request_t *r)
 }
 
 
-ngx_int_t
-ngx_http_ctrl_set_variables(ngx_http_request_t *r, ngx_http_action_variables_t *variables)
+void
+ngx_http_ctrl_set_variables(ngx_http_request_t *r,
+    ngx_http_action_variables_t *variables)
 {
-    ngx_int_t                  rc;
-    ngx_http_name_value_t     *nv, **variable, **end;
+    ngx_http_variable_t          *v;
+    ngx_http_action_variable_t   *var, *end;
 
     if (variables == NULL) {
-        return NGX_OK;
+        return;
     }
 
-    variable = &variables->variable[0];
-    end = variable + variables->items;
+    var = &variables->variable[0];
+    end = var + variables->items;
 
-    while (variable < end) {
-        nv = *variable;
+    while (var < end) {
+        v = var->variable;
 
-        rc = ngx_http_ctrl_set_variable(r, nv->name, nv->name_length,
-                                        nv->value, nv->value_length);
-        if (rc == NGX_ERROR) {
-            return rc;
+        if (v->set_handler != NULL) {
+            v->set_handler(r, &var->value, v->data);
+
+        } else {
+            r->variables[v->index] = var->value;
         }
 
-        variable++;
+        var++;
     }
-
-    return NGX_OK;
 }
 
 
-static ngx_int_t
-ngx_http_ctrl_set_variable(ngx_http_request_t *r, u_char *name,
-    uint16_t name_length, u_char *value, uint16_t value_length)
+ngx_int_t
+ngx_http_ctrl_add_headers(ngx_http_request_t *r,
+    ngx_http_action_headers_t *headers)
 {
-    ngx_uint_t                  key;
-    ngx_http_variable_t        *v;
-    ngx_http_variable_value_t  *vv;
-    ngx_http_core_main_conf_t  *cmcf;
+    ngx_table_elt_t  *h, *header, *end;
+
+    switch (r->headers_out.status) {
+
+    case NGX_HTTP_OK:
+    case NGX_HTTP_CREATED:
+    case NGX_HTTP_NO_CONTENT:
+    case NGX_HTTP_PARTIAL_CONTENT:
+    case NGX_HTTP_MOVED_PERMANENTLY:
+    case NGX_HTTP_MOVED_TEMPORARILY:
+    case NGX_HTTP_SEE_OTHER:
+    case NGX_HTTP_NOT_MODIFIED:
+    case NGX_HTTP_TEMPORARY_REDIRECT:
+    case NGX_HTTP_PERMANENT_REDIRECT:
+        break;
 
-    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+    default:
+        if (!headers->always) {
+            return NGX_OK;
+        }
+    }
 
-    key = ngx_hash_strlow(name, name, name_length);
+    header = &headers->header[0];
+    end = header + headers->items;
 
-    v = ngx_hash_find(&cmcf->variables_hash, key, name, name_length);
+    while (header < end) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
 
-    if (v == NULL) {
-        return NGX_DECLINED;
+        *h = *header++;
     }
 
-    if (v->set_handler != NULL) {
-        vv = ngx_pcalloc(r->pool, sizeof(ngx_http_variable_value_t));
-        if (vv == NULL) {
-            return NGX_ERROR;
-        }
+    return NGX_OK;
+}
 
-        vv->valid = 1;
-        vv->not_found = 0;
-        vv->data = value;
-        vv->len = value_length;
 
-        v->set_handler(r, vv, v->data);
+ngx_int_t
+ngx_http_ctrl_blacklist(ngx_http_request_t *r, ngx_http_action_addr_t *blacklist)
+{
+    if (blacklist == NULL) {
+        return NGX_DECLINED;
+    }
 
+    if (nxt_addr_tree_match(blacklist->tree, r->connection->sockaddr)) {
         return NGX_OK;
     }
 
-    if (!(v->flags & NGX_HTTP_VAR_INDEXED)) {
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_ctrl_whitelist(ngx_http_request_t *r, ngx_http_action_addr_t *whitelist)
+{
+    if (whitelist == NULL) {
         return NGX_DECLINED;
     }
 
-    vv = &r->variables[v->index];
+    if (nxt_addr_tree_match(whitelist->tree, r->connection->sockaddr)) {
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
 
-    vv->valid = 1;
-    vv->not_found = 0;
 
-    vv->data = ngx_pnalloc(r->pool, value_length);
-    if (vv->data == NULL) {
-        return NGX_ERROR;
+void
+ngx_http_ctrl_addr_share(ngx_http_ctrl_shctx_t *shctx)
+{
+    if (ngx_http_ctrl_addr_refs.next == NULL) {
+        ngx_queue_init(&ngx_http_ctrl_addr_refs);
     }
 
-    vv->len = value_length;
-    ngx_memcpy(vv->data, value, value_length);
+    ngx_http_ctrl_addr_shctx = shctx;
+}
 
-    return NGX_OK;
+
+void
+ngx_http_ctrl_addr_inherit(void)
+{
+    ngx_queue_t               *q;
+    ngx_http_ctrl_addr_ref_t  *ref;
+
+    if (ngx_http_ctrl_addr_refs.next == NULL) {
+        return;
+    }
+
+    for (q = ngx_queue_head(&ngx_http_ctrl_addr_refs);
+         q != ngx_queue_sentinel(&ngx_http_ctrl_addr_refs);
+         q = ngx_queue_next(q))
+    {
+        ref = ngx_queue_data(q, ngx_http_ctrl_addr_ref_t, queue);
+
+        ngx_shmtx_lock(&ref->shpool->mutex);
+        ref->set->count++;
+        ngx_shmtx_unlock(&ref->shpool->mutex);
+    }
 }
 
 
-ngx_int_t
-ngx_http_ctrl_blacklist(ngx_http_request_t *r, ngx_http_action_addr_t *blacklist)
+/*
+ * Returns the tree of the address patterns.  With "ctrl_shared_addr" the
+ * tree is built once in the shared zone and every process configuration
+ * with the same patterns references it.  A set is freed when the last
+ * configuration pool that references it is destroyed.
+ */
+
+nxt_addr_tree_t *
+ngx_http_ctrl_addr_tree(nxt_mp_t *mp, nxt_addr_pattern_t *patterns,
+    nxt_uint_t n)
 {
-    nxt_sockaddr_t             *remote;
-    nxt_addr_pattern_t         *p, *header, *end;
-    ngx_http_ctrl_ctx_t        *ctx;
+    size_t                     size;
+    nxt_int_t                  ret;
+    ngx_rbtree_key_t           key;
+    ngx_http_ctrl_shctx_t     *shctx;
+    ngx_http_ctrl_addr_ref_t  *ref;
+    ngx_http_ctrl_addr_set_t  *set;
 
-    if (blacklist == NULL) {
-        return NGX_DECLINED;
+    shctx = ngx_http_ctrl_addr_shctx;
+
+    if (shctx == NULL) {
+        return nxt_addr_tree_create(mp, patterns, n);
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+    ref = nxt_mp_alloc(mp, sizeof(ngx_http_ctrl_addr_ref_t));
+    if (nxt_slow_path(ref == NULL)) {
+        return NULL;
+    }
 
-    remote = nxt_mp_alloc(ctx->mem_pool, sizeof(nxt_sockaddr_t));
-    if (remote == NULL) {
-        return NGX_ERROR;
+    size = n * sizeof(nxt_addr_pattern_t);
+    key = (ngx_rbtree_key_t) nxt_wy_hash(patterns, size);
+
+    ngx_shmtx_lock(&shctx->shpool->mutex);
+
+    set = ngx_http_ctrl_addr_set_find(shctx->sh, key);
+
+    if (set != NULL) {
+        set->count++;
     }
 
-    nxt_memcpy(&remote->u.sockaddr, r->connection->sockaddr, sizeof(ngx_sockaddr_t));
+    ngx_shmtx_unlock(&shctx->shpool->mutex);
 
-    header = &blacklist->addr_pattern[0];
-    end = header + blacklist->items;
+    if (set == NULL) {
+        set = ngx_http_ctrl_addr_set_add(shctx, key, patterns, n);
 
-    while (header < end) {
-        p = header;
+        if (set == NULL) {
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "ctrl_zone is full, the address set of %ui "
+                          "patterns is not shared", n);
 
-        if (nxt_addr_pattern_match(p, remote)) {
-            return NGX_OK;
+            return nxt_addr_tree_create(mp, patterns, n);
         }
+    }
+
+    /*
+     * The key is a seeded hash, so a set of other patterns is unlikely.
+     * A set is immutable while it is referenced, so the patterns are
+     * compared outside the lock.
+     */
 
-        header++;
+    if (set->items != n || ngx_memcmp(set->patterns, patterns, size) != 0) {
+        ngx_http_ctrl_addr_set_unref(shctx->shpool, set);
+
+        return nxt_addr_tree_create(mp, patterns, n);
     }
 
-    return NGX_DECLINED;
+    ref->shpool = shctx->shpool;
+    ref->set = set;
+
+    ngx_queue_insert_tail(&ngx_http_ctrl_addr_refs, &ref->queue);
+
+    ret = nxt_mp_cleanup(mp, ngx_http_ctrl_addr_release, ref);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        ngx_http_ctrl_addr_release(ref);
+        return NULL;
+    }
+
+    return &set->tree;
 }
 
 
-ngx_int_t
-ngx_http_ctrl_whitelist(ngx_http_request_t *r, ngx_http_action_addr_t *whitelist)
+static ngx_http_ctrl_addr_set_t *
+ngx_http_ctrl_addr_set_find(ngx_http_ctrl_shdata_t *sh, ngx_rbtree_key_t key)
 {
-    nxt_sockaddr_t             *remote;
-    nxt_addr_pattern_t         *p, *header, *end;
-    ngx_http_ctrl_ctx_t        *ctx;
+    ngx_rbtree_node_t  *node, *sentinel;
 
-    if (whitelist == NULL) {
-        return NGX_DECLINED;
+    node = sh->addr_sets.root;
+    sentinel = sh->addr_sets.sentinel;
+
+    while (node != sentinel) {
+
+        if (key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_http_ctrl_addr_set_t *) node;
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+    return NULL;
+}
 
-    remote = nxt_mp_alloc(ctx->mem_pool, sizeof(nxt_sockaddr_t));
-    if (remote == NULL) {
-        return NGX_ERROR;
+
+/*
+ * The tree is built and copied to the zone without the zone mutex, which
+ * is taken only to insert the set.  If another process has inserted a set
+ * with the same key meanwhile, its set is referenced and the copy is
+ * freed.
+ */
+
+static ngx_http_ctrl_addr_set_t *
+ngx_http_ctrl_addr_set_add(ngx_http_ctrl_shctx_t *shctx, ngx_rbtree_key_t key,
+    nxt_addr_pattern_t *patterns, nxt_uint_t n)
+{
+    size_t                     size;
+    nxt_mp_t                  *mp;
+    nxt_addr_tree_t           *tree;
+    nxt_addr_node_t           *nodes;
+    ngx_http_ctrl_addr_set_t  *set, *found;
+
+    mp = nxt_mp_create(1024, 128, 256, 32);
+    if (nxt_slow_path(mp == NULL)) {
+        return NULL;
     }
 
-    nxt_memcpy(&remote->u.sockaddr, r->connection->sockaddr, sizeof(ngx_sockaddr_t));
+    tree = nxt_addr_tree_create(mp, patterns, n);
+    if (nxt_slow_path(tree == NULL)) {
+        goto fail;
+    }
 
-    header = &whitelist->addr_pattern[0];
-    end = header + whitelist->items;
+    size = offsetof(ngx_http_ctrl_addr_set_t, patterns)
+           + n * sizeof(nxt_addr_pattern_t);
 
-    while (header < end) {
-        p = header;
+    set = ngx_slab_alloc(shctx->shpool, size);
+    if (set == NULL) {
+        goto fail;
+    }
 
-        if (nxt_addr_pattern_match(p, remote)) {
-            return NGX_OK;
-        }
+    size = tree->items * sizeof(nxt_addr_node_t);
 
-        header++;
+    nodes = ngx_slab_alloc(shctx->shpool, size);
+    if (nodes == NULL) {
+        ngx_slab_free(shctx->shpool, set);
+        goto fail;
     }
 
-    return NGX_DECLINED;
+    ngx_memcpy(nodes, tree->nodes, size);
+    ngx_memcpy(set->patterns, patterns, n * sizeof(nxt_addr_pattern_t));
+
+    set->node.key = key;
+    set->count = 1;
+    set->items = n;
+    set->tree.items = tree->items;
+    set->tree.nodes = nodes;
+
+    nxt_mp_destroy(mp);
+
+    ngx_shmtx_lock(&shctx->shpool->mutex);
+
+    found = ngx_http_ctrl_addr_set_find(shctx->sh, key);
+
+    if (found == NULL) {
+        ngx_rbtree_insert(&shctx->sh->addr_sets, &set->node);
+
+    } else {
+        found->count++;
+    }
+
+    ngx_shmtx_unlock(&shctx->shpool->mutex);
+
+    if (found != NULL) {
+        ngx_slab_free(shctx->shpool, nodes);
+        ngx_slab_free(shctx->shpool, set);
+
+        return found;
+    }
+
+    return set;
+
+fail:
+
+    nxt_mp_destroy(mp);
+
+    return NULL;
+}
+
+
+static void
+ngx_http_ctrl_addr_set_unref(ngx_slab_pool_t *shpool,
+    ngx_http_ctrl_addr_set_t *set)
+{
+    ngx_http_ctrl_shdata_t  *sh;
+
+    sh = shpool->data;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (--set->count == 0) {
+        ngx_rbtree_delete(&sh->addr_sets, &set->node);
+
+        ngx_slab_free_locked(shpool, set->tree.nodes);
+        ngx_slab_free_locked(shpool, set);
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+}
+
+
+static void
+ngx_http_ctrl_addr_release(void *data)
+{
+    ngx_http_ctrl_addr_ref_t  *ref = data;
+
+    ngx_queue_remove(&ref->queue);
+
+    ngx_http_ctrl_addr_set_unref(ref->shpool, ref->set);
 }
 
 
@@ -206,7 +429,7 @@ ngx_http_ctrl_config_handler(ngx_http_request_t *r)
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
     shctx = cmcf->shm_zone->data;
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+    ctx = ngx_http_ctrl_get_ctx(r);
     if (ctx == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
@@ -7,116 +7,310 @@
 #include <ngx_http_ctrl.h>
 
 
-static ngx_rbtree_node_t *ngx_http_ctrl_limit_conn_lookup(ngx_rbtree_t *rbtree,
-    ngx_str_t *key, uint32_t hash);
-static ngx_int_t ngx_http_ctrl_limit_req_lookup(ngx_http_ctrl_shctx_t *shctx,
-    ngx_http_action_limit_req_t *lr, ngx_str_t *key, ngx_uint_t hash,
+/* The keys are evaluated into a stack buffer. */
+
+#define NGX_HTTP_CTRL_LIMIT_KEY_LEN      256
+
+#define NGX_HTTP_CTRL_LIMIT_LOCALS       256
+#define NGX_HTTP_CTRL_LIMIT_LOCAL_BATCH  10
+
+/* The delay wheel has a slot for each millisecond. */
+
+#define NGX_HTTP_CTRL_LIMIT_WHEEL        1024
+
+/*
+ * The heavy hitter events are counted in a worker table first, which is
+ * merged into the shared sketch on the sweep timer only.  An entry with
+ * NGX_HTTP_CTRL_LIMIT_TOP_KEEP events at least is kept until then, and
+ * the keys that collide with it are not counted.
+ */
+
+#define NGX_HTTP_CTRL_LIMIT_TOP_LOCALS   256
+#define NGX_HTTP_CTRL_LIMIT_TOP_KEEP     8
+
+/* A row of the heavy hitters sketch takes 16 bits of the fingerprint. */
+
+#define ngx_http_ctrl_limit_top_counter(top, fp, i)                           \
+    (&(top)->counters[(i) * ((top)->mask + 1)                                \
+                      + (((uint64_t) (fp) >> ((i) * 16)) & (top)->mask)])
+
+
+typedef struct {
+    ngx_atomic_uint_t               fp;
+    ngx_http_ctrl_gcra_slot_t      *slot;
+    uint64_t                        t;
+    ngx_uint_t                      budget;
+} ngx_http_ctrl_limit_local_t;
+
+
+typedef struct {
+    ngx_queue_t                     queue;
+    ngx_http_request_t             *request;
+    ngx_msec_t                      expire;
+} ngx_http_ctrl_limit_delay_t;
+
+
+typedef struct {
+    ngx_atomic_uint_t               fp;
+    ngx_uint_t                      events;
+    ngx_uint_t                      rejected;
+    size_t                          len;
+    u_char                          key[NGX_HTTP_CTRL_TOP_KEY_LEN];
+} ngx_http_ctrl_limit_top_local_t;
+
+
+static ngx_int_t ngx_http_ctrl_limit_key(ngx_http_request_t *r,
+    ngx_http_action_key_t *ck, ngx_str_t *key, u_char *buf);
+static uint64_t ngx_http_ctrl_limit_fp(ngx_str_t *key);
+static ngx_http_ctrl_limit_entry_t *ngx_http_ctrl_limit_lookup(
+    ngx_http_ctrl_limit_table_t *table, uint64_t fp,
+    ngx_http_ctrl_limit_entry_t **vp);
+static ngx_int_t ngx_http_ctrl_limit_req_lookup(
+    ngx_http_ctrl_limit_shard_t *shard, ngx_http_action_limit_req_t *lr,
+    uint64_t fp, ngx_uint_t *ep);
+static ngx_int_t ngx_http_ctrl_limit_gcra(ngx_http_ctrl_gcra_t *gcra,
+    ngx_http_action_limit_req_t *lr, uint64_t fp, uint32_t hash,
     ngx_uint_t *ep);
-static void ngx_http_ctrl_limit_req_expire(ngx_http_ctrl_shctx_t *shctx,
-    ngx_http_action_limit_req_t *lr, ngx_uint_t n);
+static ngx_http_ctrl_gcra_slot_t *ngx_http_ctrl_limit_gcra_slot(
+    ngx_http_ctrl_gcra_t *gcra, ngx_atomic_uint_t fp, uint32_t hash,
+    ngx_atomic_uint_t now);
+static ngx_int_t ngx_http_ctrl_limit_gcra_take(
+    ngx_http_ctrl_gcra_slot_t *slot, ngx_atomic_uint_t fp, uint64_t t,
+    uint64_t tau, ngx_uint_t *np, ngx_atomic_uint_t now, uint64_t *ap);
+static void ngx_http_ctrl_limit_gcra_give(ngx_http_ctrl_gcra_slot_t *slot,
+    ngx_atomic_uint_t fp, uint64_t t, ngx_uint_t n, ngx_atomic_uint_t now);
+static ngx_int_t ngx_http_ctrl_limit_local(ngx_http_ctrl_gcra_t *gcra,
+    ngx_http_action_limit_req_t *lr, uint64_t fp, uint32_t hash);
+static void ngx_http_ctrl_limit_local_flush(ngx_http_ctrl_limit_local_t *local);
+static void ngx_http_ctrl_limit_top(ngx_str_t *key, ngx_atomic_uint_t fp,
+    uint32_t hash, ngx_uint_t rejected);
+static void ngx_http_ctrl_limit_top_merge(ngx_http_ctrl_top_t *top,
+    ngx_http_ctrl_limit_top_local_t *local);
+static void ngx_http_ctrl_limit_top_add(ngx_http_ctrl_top_t *top,
+    ngx_http_ctrl_limit_top_local_t *local, ngx_uint_t events);
+static void ngx_http_ctrl_limit_top_refresh(ngx_http_ctrl_top_t *top);
+static void ngx_http_ctrl_limit_top_decay(ngx_http_ctrl_top_t *top);
+static ngx_int_t ngx_http_ctrl_limit_delay(ngx_http_request_t *r,
+    ngx_msec_t delay);
+static void ngx_http_ctrl_limit_delay_cleanup(void *data);
+static void ngx_http_ctrl_limit_wheel_handler(ngx_event_t *ev);
 static void ngx_http_ctrl_limit_req_delay(ngx_http_request_t *r);
 
 
+static ngx_http_ctrl_limit_local_t
+    ngx_http_ctrl_limit_locals[NGX_HTTP_CTRL_LIMIT_LOCALS];
+
+static ngx_http_ctrl_limit_top_local_t
+    ngx_http_ctrl_limit_top_locals[NGX_HTTP_CTRL_LIMIT_TOP_LOCALS];
+
+static ngx_queue_t  ngx_http_ctrl_limit_wheel[NGX_HTTP_CTRL_LIMIT_WHEEL];
+static ngx_event_t  ngx_http_ctrl_limit_wheel_event;
+static ngx_msec_t   ngx_http_ctrl_limit_wheel_tick;
+static ngx_uint_t   ngx_http_ctrl_limit_wheel_delays;
+
+
+void
+ngx_http_ctrl_limit_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_HTTP_CTRL_LIMIT_WHEEL; i++) {
+        ngx_queue_init(&ngx_http_ctrl_limit_wheel[i]);
+    }
+
+    ngx_http_ctrl_limit_wheel_event.handler = ngx_http_ctrl_limit_wheel_handler;
+    ngx_http_ctrl_limit_wheel_event.log = cycle->log;
+}
+
+
 ngx_int_t
 ngx_http_ctrl_limit_conn(ngx_http_request_t *r, ngx_http_action_limit_conn_t *lc)
 {
-    size_t                               size;
-    uint32_t                             hash;
-    ngx_str_t                            key;
-    ngx_rbtree_node_t                   *node;
-    ngx_http_ctrl_ctx_t                 *ctx;
-    ngx_http_ctrl_shctx_t               *shctx;
-    ngx_http_ctrl_main_conf_t           *cmcf;
-    ngx_http_ctrl_limit_conn_node_t     *cn;
+    u_char                        buf[NGX_HTTP_CTRL_LIMIT_KEY_LEN];
+    uint32_t                      hash;
+    uint64_t                      fp;
+    ngx_int_t                     rc;
+    ngx_str_t                     key;
+    ngx_http_ctrl_ctx_t          *ctx;
+    ngx_http_ctrl_shctx_t        *shctx;
+    ngx_http_ctrl_main_conf_t    *cmcf;
+    ngx_http_ctrl_limit_shard_t  *shard;
+    ngx_http_ctrl_limit_entry_t  *entry, *victim;
+
+    rc = ngx_http_ctrl_limit_key(r, &lc->complex_key, &key, buf);
+    if (rc != NGX_OK) {
+        return (rc == NGX_DECLINED) ? rc : NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
     shctx = cmcf->shm_zone->data;
 
-    key.len = lc->key.length;
-    key.data = lc->key.start;
+    fp = ngx_http_ctrl_limit_fp(&key);
+    hash = ngx_http_ctrl_limit_hash(fp);
+
+    shard = ngx_http_ctrl_limit_shard(shctx->sh, hash);
 
-    hash = ngx_crc32_short(key.data, key.len);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
-    ngx_shmtx_lock(&shctx->shpool->mutex);
+    entry = ngx_http_ctrl_limit_lookup(&shard->conn, fp, &victim);
 
-    node = ngx_http_ctrl_limit_conn_lookup(&shctx->sh->limit_conn_rbtree, &key, hash);
+    if (entry == NULL) {
 
-    if (node == NULL) {
-        size = offsetof(ngx_rbtree_node_t, color)
-               + offsetof(ngx_http_ctrl_limit_conn_node_t, data)
-               + key.len;
+        if (victim->fp != 0) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        node = ngx_slab_alloc_locked(shctx->shpool, size);
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "limit_conn table is full%s",
+                          shard->shpool->log_ctx);
 
-        if (node == NULL) {
-            ngx_shmtx_unlock(&shctx->shpool->mutex);
             return NGX_HTTP_INTERNAL_SERVER_ERROR;
         }
 
-        cn = (ngx_http_ctrl_limit_conn_node_t *) &node->color;
+        entry = victim;
 
-        node->key = hash;
-        cn->len = (u_char) key.len;
-        cn->conn = 1;
-        ngx_memcpy(cn->data, key.data, key.len);
-
-        ngx_rbtree_insert(&shctx->sh->limit_conn_rbtree, node);
+        entry->fp = fp;
+        entry->value = 1;
 
     } else {
-        cn = (ngx_http_ctrl_limit_conn_node_t *) &node->color;
 
-        if ((ngx_uint_t) cn->conn >= lc->conn) {
-            ngx_shmtx_unlock(&shctx->shpool->mutex);
+        if ((ngx_uint_t) entry->value >= lc->conn) {
+            ngx_shmtx_unlock(&shard->shpool->mutex);
+
+            ngx_http_ctrl_limit_top(&key, (ngx_atomic_uint_t) fp, hash, 1);
+
             return NGX_HTTP_FORBIDDEN;
         }
 
-        cn->conn++;
+        entry->value++;
     }
 
-    ngx_shmtx_unlock(&shctx->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
-    ctx->node = node;
+    ngx_http_ctrl_limit_top(&key, (ngx_atomic_uint_t) fp, hash, 0);
+
+    ctx->limit_conn = entry;
 
     return NGX_DECLINED;
 }
 
 
-static ngx_rbtree_node_t *
-ngx_http_ctrl_limit_conn_lookup(ngx_rbtree_t *rbtree, ngx_str_t *key, uint32_t hash)
+/*
+ * The key of a single part is not copied.  An empty key value is not
+ * accounted, unless the key is empty in the configuration.
+ */
+
+static ngx_int_t
+ngx_http_ctrl_limit_key(ngx_http_request_t *r, ngx_http_action_key_t *ck,
+    ngx_str_t *key, u_char *buf)
 {
-    ngx_int_t                         rc;
-    ngx_rbtree_node_t                *node, *sentinel;
-    ngx_http_ctrl_limit_conn_node_t  *cn;
+    u_char                      *p, *last;
+    ngx_str_t                    value;
+    ngx_uint_t                   i;
+    ngx_http_variable_value_t   *vv, var;
+    ngx_http_action_key_part_t  *part;
 
-    node = rbtree->root;
-    sentinel = rbtree->sentinel;
+    p = buf;
+    last = buf + NGX_HTTP_CTRL_LIMIT_KEY_LEN;
 
-    while (node != sentinel) {
+    for (i = 0; i < ck->nparts; i++) {
+        part = &ck->parts[i];
 
-        if (hash < node->key) {
-            node = node->left;
-            continue;
+        if (part->variable == NULL) {
+            value = part->text;
+
+        } else {
+
+            if (part->index != NGX_ERROR) {
+                vv = ngx_http_get_indexed_variable(r, part->index);
+                if (vv == NULL) {
+                    return NGX_ERROR;
+                }
+
+            } else {
+                ngx_memzero(&var, sizeof(ngx_http_variable_value_t));
+
+                vv = &var;
+
+                if (part->variable->get_handler(r, vv, part->data) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+
+            value.len = vv->not_found ? 0 : vv->len;
+            value.data = vv->data;
         }
 
-        if (hash > node->key) {
-            node = node->right;
-            continue;
+        if (ck->nparts == 1) {
+            *key = value;
+            goto done;
         }
 
-        /* hash == node->key */
+        if (value.len > (size_t) (last - p)) {
+            ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                          "the limit key is more than %d bytes",
+                          NGX_HTTP_CTRL_LIMIT_KEY_LEN);
+            return NGX_DECLINED;
+        }
+
+        p = ngx_cpymem(p, value.data, value.len);
+    }
+
+    key->len = p - buf;
+    key->data = buf;
+
+done:
 
-        cn = (ngx_http_ctrl_limit_conn_node_t *) &node->color;
+    if (key->len == 0 && ck->nparts != 0) {
+        return NGX_DECLINED;
+    }
 
-        rc = ngx_memn2cmp(key->data, cn->data, key->len, (size_t) cn->len);
+    return NGX_OK;
+}
 
-        if (rc == 0) {
-            return node;
+
+static uint64_t
+ngx_http_ctrl_limit_fp(ngx_str_t *key)
+{
+    uint64_t  fp;
+
+    fp = nxt_wy_hash(key->data, key->len);
+
+    return (fp != 0) ? fp : 1;
+}
+
+
+/*
+ * Looks for the fingerprint in two adjacent buckets.  If it is not found,
+ * *vp is set to the first empty entry, or to the least recently used one.
+ */
+
+static ngx_http_ctrl_limit_entry_t *
+ngx_http_ctrl_limit_lookup(ngx_http_ctrl_limit_table_t *table, uint64_t fp,
+    ngx_http_ctrl_limit_entry_t **vp)
+{
+    ngx_uint_t                    i;
+    ngx_http_ctrl_limit_entry_t  *entry, *victim;
+
+    entry = &table->entries[((uint32_t) fp % table->nbuckets)
+                            * NGX_HTTP_CTRL_LIMIT_BUCKET];
+    victim = entry;
+
+    for (i = 0; i < 2 * NGX_HTTP_CTRL_LIMIT_BUCKET; i++, entry++) {
+
+        if (entry->fp == fp) {
+            return entry;
         }
 
-        node = (rc < 0) ? node->left : node->right;
+        if (victim->fp != 0
+            && (entry->fp == 0 || (int32_t) (entry->last - victim->last) < 0))
+        {
+            victim = entry;
+        }
     }
 
+    *vp = victim;
+
     return NULL;
 }
 
@@ -124,27 +318,52 @@ ngx_http_ctrl_limit_conn_lookup(ngx_rbtree_t *rbtree, ngx_str_t *key, uint32_t h
 ngx_int_t
 ngx_http_ctrl_limit_req(ngx_http_request_t *r, ngx_http_action_limit_req_t *lr)
 {
+    u_char                      buf[NGX_HTTP_CTRL_LIMIT_KEY_LEN];
     uint32_t                    hash;
+    uint64_t                    fp;
     ngx_int_t                   rc;
     ngx_str_t                   key;
-    nxt_uint_t                  delay;
+    ngx_msec_t                  delay;
     ngx_uint_t                  excess;
-    ngx_http_ctrl_shctx_t      *shctx;
-    ngx_http_ctrl_main_conf_t  *cmcf;
+    ngx_http_ctrl_shctx_t        *shctx;
+    ngx_http_ctrl_main_conf_t    *cmcf;
+    ngx_http_ctrl_limit_shard_t  *shard;
+
+    rc = ngx_http_ctrl_limit_key(r, &lr->complex_key, &key, buf);
+    if (rc != NGX_OK) {
+        return (rc == NGX_DECLINED) ? rc : NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
     shctx = cmcf->shm_zone->data;
 
-    key.len = lr->key.length;
-    key.data = lr->key.start;
+    fp = ngx_http_ctrl_limit_fp(&key);
+    hash = ngx_http_ctrl_limit_hash(fp);
+
+    switch (lr->mode) {
+
+    case NGX_HTTP_LIMIT_REQ_GCRA:
+        rc = ngx_http_ctrl_limit_gcra(&shctx->sh->gcra, lr, fp, hash,
+                                      &excess);
+        break;
+
+    case NGX_HTTP_LIMIT_REQ_LOCAL:
+        rc = ngx_http_ctrl_limit_local(&shctx->sh->gcra, lr, fp, hash);
+        excess = 0;
+        break;
+
+    default: /* NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET */
+        shard = ngx_http_ctrl_limit_shard(shctx->sh, hash);
 
-    hash = ngx_crc32_short(key.data, key.len);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-    ngx_shmtx_lock(&shctx->shpool->mutex);
+        rc = ngx_http_ctrl_limit_req_lookup(shard, lr, fp, &excess);
 
-    rc = ngx_http_ctrl_limit_req_lookup(shctx, lr, &key, hash, &excess);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
 
-    ngx_shmtx_unlock(&shctx->shpool->mutex);
+    ngx_http_ctrl_limit_top(&key, (ngx_atomic_uint_t) fp, hash,
+                            rc != NGX_OK);
 
     if (rc == NGX_BUSY || rc == NGX_ERROR) {
         return NGX_HTTP_SERVICE_UNAVAILABLE;
@@ -152,7 +371,11 @@ ngx_http_ctrl_limit_req(ngx_http_request_t *r, ngx_http_action_limit_req_t *lr)
 
     /* rc == NGX_OK */
 
-    delay = excess * 1000 / lr->rate;
+    if (excess <= lr->delay) {
+        return NGX_DECLINED;
+    }
+
+    delay = (excess - lr->delay) * 1000 / lr->rate;
 
     if (!delay) {
         return NGX_DECLINED;
@@ -165,289 +388,741 @@ ngx_http_ctrl_limit_req(ngx_http_request_t *r, ngx_http_action_limit_req_t *lr)
     r->read_event_handler = ngx_http_test_reading;
     r->write_event_handler = ngx_http_ctrl_limit_req_delay;
 
-    r->connection->write->delayed = 1;
-    ngx_add_timer(r->connection->write, delay);
+    return ngx_http_ctrl_limit_delay(r, delay);
+}
 
-    return NGX_AGAIN;
+
+static ngx_int_t
+ngx_http_ctrl_limit_req_lookup(ngx_http_ctrl_limit_shard_t *shard,
+    ngx_http_action_limit_req_t *lr, uint64_t fp, ngx_uint_t *ep)
+{
+    uint32_t                      now;
+    ngx_int_t                     excess;
+    ngx_msec_int_t                ms;
+    ngx_http_ctrl_limit_entry_t  *entry, *victim;
+
+    now = (uint32_t) ngx_current_msec;
+
+    entry = ngx_http_ctrl_limit_lookup(&shard->req, fp, &victim);
+
+    if (entry == NULL) {
+        entry = victim;
+
+        entry->fp = fp;
+        entry->last = now;
+        entry->value = 0;
+
+        *ep = 0;
+
+        return NGX_OK;
+    }
+
+    ms = (int32_t) (now - entry->last);
+
+    if (ms < -60000) {
+        ms = 1;
+
+    } else if (ms < 0) {
+        ms = 0;
+    }
+
+    /* integer value, 1 corresponds to 0.001 r/s */
+
+    excess = entry->value - lr->rate * ms / 1000 + 1000;
+
+    if (excess < 0) {
+        excess = 0;
+    }
+
+    *ep = excess;
+
+    if ((ngx_uint_t) excess > lr->burst) {
+        return NGX_BUSY;
+    }
+
+    entry->value = excess;
+
+    if (ms) {
+        entry->last = now;
+    }
+
+    return NGX_OK;
 }
 
 
+/*
+ * The theoretical arrival time is kept in microseconds of the millisecond
+ * clock and compared by signed differences, so it may wrap around.  The
+ * request is rejected if the time is ahead of now by more than the burst.
+ * A new key takes an empty or a drained slot of its cache line, or the
+ * least loaded one by force, like the oldest node of the leaky bucket.
+ */
+
 static ngx_int_t
-ngx_http_ctrl_limit_req_lookup(ngx_http_ctrl_shctx_t *shctx,
-    ngx_http_action_limit_req_t *lr, ngx_str_t *key, ngx_uint_t hash, ngx_uint_t *ep)
+ngx_http_ctrl_limit_gcra(ngx_http_ctrl_gcra_t *gcra,
+    ngx_http_action_limit_req_t *lr, uint64_t fp, uint32_t hash,
+    ngx_uint_t *ep)
 {
-    size_t                             size;
-    ngx_int_t                          rc, excess;
-    ngx_msec_t                         now;
-    ngx_msec_int_t                     ms;
-    ngx_rbtree_node_t                 *node, *sentinel;
-    ngx_http_ctrl_limit_req_node_t    *rn;
+    uint64_t                    t, tau, ahead;
+    ngx_int_t                   rc;
+    ngx_uint_t                  n;
+    ngx_atomic_uint_t           now;
+    ngx_http_ctrl_gcra_slot_t  *slot;
 
-    now = ngx_current_msec;
+    if (lr->rate == 0) {
+        return NGX_BUSY;
+    }
 
-    node = shctx->sh->limit_req_rbtree.root;
-    sentinel = shctx->sh->limit_req_rbtree.sentinel;
+    /* lr->rate and lr->burst are in 0.001 r/s and 0.001 requests */
 
-    while (node != sentinel) {
+    t = 1000000000 / lr->rate;
+    tau = t * lr->burst / 1000;
 
-        if (hash < node->key) {
-            node = node->left;
-            continue;
+    now = (ngx_atomic_uint_t) ngx_current_msec * 1000;
+
+    do {
+        slot = ngx_http_ctrl_limit_gcra_slot(gcra, (ngx_atomic_uint_t) fp,
+                                             hash, now);
+        n = 1;
+
+        rc = ngx_http_ctrl_limit_gcra_take(slot, (ngx_atomic_uint_t) fp, t,
+                                           tau, &n, now, &ahead);
+    } while (rc == NGX_DECLINED);
+
+    if (rc == NGX_BUSY) {
+        return NGX_BUSY;
+    }
+
+    *ep = ahead * lr->rate / 1000000;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_ctrl_gcra_slot_t *
+ngx_http_ctrl_limit_gcra_slot(ngx_http_ctrl_gcra_t *gcra, ngx_atomic_uint_t fp,
+    uint32_t hash, ngx_atomic_uint_t now)
+{
+    ngx_uint_t                  i;
+    ngx_atomic_int_t            ahead, least;
+    ngx_atomic_uint_t           old, tat;
+    ngx_http_ctrl_gcra_slot_t  *bucket, *victim;
+
+    bucket = &gcra->slots[hash & gcra->mask & ~(NGX_HTTP_CTRL_GCRA_BUCKET - 1)];
+
+    for ( ;; ) {
+        victim = NULL;
+        least = 0;
+
+        for (i = 0; i < NGX_HTTP_CTRL_GCRA_BUCKET; i++) {
+
+            if (bucket[i].key == fp) {
+                return &bucket[i];
+            }
+
+            ahead = (bucket[i].key == 0)
+                    ? -NGX_MAX_INT_T_VALUE
+                    : (ngx_atomic_int_t) (bucket[i].tat - now);
+
+            if (victim == NULL || ahead < least) {
+                victim = &bucket[i];
+                least = ahead;
+            }
         }
 
-        if (hash > node->key) {
-            node = node->right;
+        old = victim->key;
+
+        if (!ngx_atomic_cmp_set(&victim->key, old, fp)) {
             continue;
         }
 
-        /* hash == node->key */
+        /* a take of the displaced key may still move the tat */
 
-        rn = (ngx_http_ctrl_limit_req_node_t *) &node->color;
+        do {
+            tat = victim->tat;
+        } while (victim->key == fp
+                 && !ngx_atomic_cmp_set(&victim->tat, tat, now));
 
-        rc = ngx_memn2cmp(key->data, rn->data, key->len, (size_t) rn->len);
+        if (victim->key == fp) {
+            return victim;
+        }
+    }
+}
 
-        if (rc == 0) {
-            ngx_queue_remove(&rn->queue);
-            ngx_queue_insert_head(&shctx->sh->limit_req_queue, &rn->queue);
 
-            ms = (ngx_msec_int_t) (now - rn->last);
+/*
+ * Takes up to *np cells of the emission interval t at once, as many as
+ * the tolerance tau allows, and sets *np to their number.  NGX_DECLINED
+ * means the slot has been given to another key and has to be looked up
+ * again, the cells taken from the new key are returned if possible.
+ */
 
-            if (ms < -60000) {
-                ms = 1;
+static ngx_int_t
+ngx_http_ctrl_limit_gcra_take(ngx_http_ctrl_gcra_slot_t *slot,
+    ngx_atomic_uint_t fp, uint64_t t, uint64_t tau, ngx_uint_t *np,
+    ngx_atomic_uint_t now, uint64_t *ap)
+{
+    ngx_uint_t         k;
+    ngx_atomic_int_t   ahead;
+    ngx_atomic_uint_t  old, tat;
 
-            } else if (ms < 0) {
-                ms = 0;
-            }
+    for ( ;; ) {
+        old = slot->tat;
 
-            excess = rn->excess - lr->rate * ms / 1000 + 1000;
+        if (slot->key != fp) {
+            return NGX_DECLINED;
+        }
 
-            if (excess < 0) {
-                excess = 0;
-            }
+        ahead = (ngx_atomic_int_t) (old - now);
+        tat = (ahead > 0) ? old : now;
+        ahead = (ahead > 0) ? ahead : 0;
 
-            *ep = excess;
+        *ap = ahead;
 
-            if ((ngx_uint_t) excess > lr->burst) {
-                return NGX_BUSY;
-            }
+        if ((uint64_t) ahead > tau) {
+            return NGX_BUSY;
+        }
 
-            rn->excess = excess;
+        k = ngx_min(*np, (tau - ahead) / t + 1);
+        tat += (ngx_atomic_uint_t) (k * t);
 
-            if (ms) {
-                rn->last = now;
-            }
+        if (!ngx_atomic_cmp_set(&slot->tat, old, tat)) {
+            continue;
+        }
 
-            return NGX_OK;
+        if (slot->key != fp) {
+            (void) ngx_atomic_cmp_set(&slot->tat, tat, old);
+            return NGX_DECLINED;
         }
 
-        node = (rc < 0) ? node->left : node->right;
+        *np = k;
+
+        return NGX_OK;
     }
+}
+
+
+static void
+ngx_http_ctrl_limit_gcra_give(ngx_http_ctrl_gcra_slot_t *slot,
+    ngx_atomic_uint_t fp, uint64_t t, ngx_uint_t n, ngx_atomic_uint_t now)
+{
+    ngx_atomic_uint_t  old, tat;
+
+    for ( ;; ) {
+        old = slot->tat;
+
+        if (slot->key != fp || (ngx_atomic_int_t) (old - now) <= 0) {
+            return;
+        }
+
+        tat = old - (ngx_atomic_uint_t) (n * t);
 
-    *ep = 0;
+        if ((ngx_atomic_int_t) (tat - now) < 0) {
+            tat = now;
+        }
+
+        if (ngx_atomic_cmp_set(&slot->tat, old, tat)) {
+            return;
+        }
+    }
+}
 
-    size = offsetof(ngx_rbtree_node_t, color)
-           + offsetof(ngx_http_ctrl_limit_req_node_t, data)
-           + key->len;
 
-    ngx_http_ctrl_limit_req_expire(shctx, lr, 1);
+/*
+ * The local limit_req serves a key from a worker budget, which is taken
+ * from the gcra slot in batches of up to NGX_HTTP_CTRL_LIMIT_LOCAL_BATCH
+ * milliseconds of the rate.  The unused budget is given back on the sweep
+ * timer, so a worker may run ahead of the shared state by one batch.
+ */
+
+static ngx_int_t
+ngx_http_ctrl_limit_local(ngx_http_ctrl_gcra_t *gcra,
+    ngx_http_action_limit_req_t *lr, uint64_t fp, uint32_t hash)
+{
+    uint64_t                      t, tau, ahead;
+    ngx_int_t                     rc;
+    ngx_uint_t                    n, batch;
+    ngx_atomic_uint_t             now;
+    ngx_http_ctrl_limit_local_t  *local;
+
+    if (lr->rate == 0) {
+        return NGX_BUSY;
+    }
+
+    t = 1000000000 / lr->rate;
 
-    node = ngx_slab_alloc_locked(shctx->shpool, size);
+    local = &ngx_http_ctrl_limit_locals[hash % NGX_HTTP_CTRL_LIMIT_LOCALS];
 
-    if (node == NULL) {
-        ngx_http_ctrl_limit_req_expire(shctx, lr, 0);
+    if (local->fp == (ngx_atomic_uint_t) fp && local->t == t) {
 
-        node = ngx_slab_alloc_locked(shctx->shpool, size);
-        if (node == NULL) {
-            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", shctx->shpool->log_ctx);
-            return NGX_ERROR;
+        if (local->budget != 0) {
+            local->budget--;
+            return NGX_OK;
         }
+
+    } else {
+        ngx_http_ctrl_limit_local_flush(local);
+
+        local->fp = (ngx_atomic_uint_t) fp;
+        local->t = t;
     }
 
-    node->key = hash;
+    tau = t * lr->burst / 1000;
 
-    rn = (ngx_http_ctrl_limit_req_node_t *) &node->color;
+    batch = lr->rate * NGX_HTTP_CTRL_LIMIT_LOCAL_BATCH / 1000000;
+    batch = ngx_max(batch, 1);
 
-    rn->len = (u_short) key->len;
-    rn->excess = 0;
+    now = (ngx_atomic_uint_t) ngx_current_msec * 1000;
 
-    ngx_memcpy(rn->data, key->data, key->len);
+    for ( ;; ) {
+
+        if (local->slot == NULL || local->slot->key != local->fp) {
+            local->slot = ngx_http_ctrl_limit_gcra_slot(gcra, local->fp,
+                                                        hash, now);
+        }
 
-    ngx_rbtree_insert(&shctx->sh->limit_req_rbtree, node);
+        n = batch;
 
-    ngx_queue_insert_head(&shctx->sh->limit_req_queue, &rn->queue);
+        rc = ngx_http_ctrl_limit_gcra_take(local->slot, local->fp, t, tau,
+                                           &n, now, &ahead);
+        if (rc != NGX_DECLINED) {
+            break;
+        }
 
-    rn->last = now;
+        local->slot = NULL;
+    }
+
+    if (rc == NGX_BUSY) {
+        return NGX_BUSY;
+    }
+
+    local->budget = n - 1;
 
     return NGX_OK;
 }
 
 
 static void
-ngx_http_ctrl_limit_req_expire(ngx_http_ctrl_shctx_t *shctx,
-    ngx_http_action_limit_req_t *lr, ngx_uint_t n)
+ngx_http_ctrl_limit_local_flush(ngx_http_ctrl_limit_local_t *local)
 {
-    ngx_int_t                        excess;
-    ngx_msec_t                       now;
-    ngx_queue_t                     *q;
-    ngx_msec_int_t                   ms;
-    ngx_rbtree_node_t               *node;
-    ngx_http_ctrl_limit_req_node_t  *rn;
+    ngx_atomic_uint_t  now;
+
+    if (local->budget == 0) {
+        return;
+    }
+
+    now = (ngx_atomic_uint_t) ngx_current_msec * 1000;
+
+    ngx_http_ctrl_limit_gcra_give(local->slot, local->fp, local->t,
+                                  local->budget, now);
+
+    local->budget = 0;
+}
 
-    now = ngx_current_msec;
 
-    /*
-     * n == 1 deletes one or two zero rate entries
-     * n == 0 deletes oldest entry by force
-     *        and one or two zero rate entries
-     */
+static void
+ngx_http_ctrl_limit_top(ngx_str_t *key, ngx_atomic_uint_t fp, uint32_t hash,
+    ngx_uint_t rejected)
+{
+    ngx_http_ctrl_limit_top_local_t  *local;
+
+    local = &ngx_http_ctrl_limit_top_locals[hash
+                                            % NGX_HTTP_CTRL_LIMIT_TOP_LOCALS];
 
-    while (n < 3) {
+    if (local->fp != fp) {
 
-        if (ngx_queue_empty(&shctx->sh->limit_req_queue)) {
+        if (local->events >= NGX_HTTP_CTRL_LIMIT_TOP_KEEP) {
             return;
         }
 
-        q = ngx_queue_last(&shctx->sh->limit_req_queue);
+        /* the few events of a displaced key are dropped */
 
-        rn = ngx_queue_data(q, ngx_http_ctrl_limit_req_node_t, queue);
+        local->fp = fp;
+        local->events = 0;
+        local->rejected = 0;
+        local->len = ngx_min(key->len, NGX_HTTP_CTRL_TOP_KEY_LEN);
+        ngx_memcpy(local->key, key->data, local->len);
+    }
 
-        if (n++ != 0) {
+    local->events++;
+    local->rejected += rejected;
+}
 
-            ms = (ngx_msec_int_t) (now - rn->last);
-            ms = ngx_abs(ms);
 
-            if (ms < 60000) {
-                return;
-            }
+/* The key table is only looked at if the estimate exceeds its least count. */
 
-            excess = rn->excess - lr->rate * ms / 1000;
+static void
+ngx_http_ctrl_limit_top_merge(ngx_http_ctrl_top_t *top,
+    ngx_http_ctrl_limit_top_local_t *local)
+{
+    ngx_uint_t                    i, n, events;
+    ngx_http_ctrl_top_counter_t  *counter;
 
-            if (excess > 0) {
-                return;
-            }
-        }
+    events = (ngx_uint_t) -1;
 
-        ngx_queue_remove(q);
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_ROWS; i++) {
+        counter = ngx_http_ctrl_limit_top_counter(top, local->fp, i);
 
-        node = (ngx_rbtree_node_t *)
-                   ((u_char *) rn - offsetof(ngx_rbtree_node_t, color));
+        n = ngx_atomic_fetch_add(&counter->events, local->events)
+            + local->events;
 
-        ngx_rbtree_delete(&shctx->sh->limit_req_rbtree, node);
+        if (local->rejected) {
+            (void) ngx_atomic_fetch_add(&counter->rejected, local->rejected);
+        }
 
-        ngx_slab_free_locked(shctx->shpool, node);
+        events = ngx_min(events, n);
+    }
+
+    local->events = 0;
+    local->rejected = 0;
+
+    if (events > top->min) {
+        ngx_http_ctrl_limit_top_add(top, local, events);
     }
 }
 
 
+/*
+ * The tracked keys are recognized by the fingerprints alone, the counts
+ * are only read to choose the entry to replace.
+ */
+
 static void
-ngx_http_ctrl_limit_req_delay(ngx_http_request_t *r)
+ngx_http_ctrl_limit_top_add(ngx_http_ctrl_top_t *top,
+    ngx_http_ctrl_limit_top_local_t *local, ngx_uint_t events)
 {
-    ngx_event_t  *wev;
+    ngx_uint_t                i, n, least, next;
+    ngx_http_ctrl_top_key_t  *entry, *victim;
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "limit_req delay");
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_KEYS; i++) {
+        if (top->keys[i].fp == local->fp) {
+            return;
+        }
+    }
 
-    wev = r->connection->write;
+    victim = NULL;
+    least = (ngx_uint_t) -1;
+    next = (ngx_uint_t) -1;
 
-    if (wev->delayed) {
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_KEYS; i++) {
+        entry = &top->keys[i];
 
-        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
-            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        n = (entry->fp == 0) ? 0
+                             : ngx_http_ctrl_limit_top_count(top, entry->fp,
+                                                             NULL);
+
+        if (n < least) {
+            next = least;
+            least = n;
+            victim = entry;
+
+        } else if (n < next) {
+            next = n;
         }
+    }
 
+    if (events <= least) {
+        top->min = least;
         return;
     }
 
-    if (ngx_handle_read_event(r->connection->read, 0) != NGX_OK) {
-        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+    if (!ngx_atomic_cmp_set(&victim->lock, 0, 1)) {
         return;
     }
 
-    r->read_event_handler = ngx_http_block_reading;
-    r->write_event_handler = ngx_http_core_run_phases;
+    victim->fp = 0;
+    victim->len = local->len;
+    ngx_memcpy(victim->key, local->key, local->len);
+    victim->fp = local->fp;
 
-    ngx_http_core_run_phases(r);
+    ngx_memory_barrier();
+
+    victim->lock = 0;
+
+    top->min = ngx_min(events, next);
 }
 
 
-void
-ngx_http_ctrl_limit_conn_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+/* The least count grows with the tracked keys, it is refreshed on sweep. */
+
+static void
+ngx_http_ctrl_limit_top_refresh(ngx_http_ctrl_top_t *top)
 {
-    ngx_rbtree_node_t                **p;
-    ngx_http_ctrl_limit_conn_node_t   *cn, *cnt;
+    ngx_uint_t          i, n, least;
+    ngx_atomic_uint_t   fp;
 
-    for ( ;; ) {
+    least = (ngx_uint_t) -1;
 
-        if (node->key < temp->key) {
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_KEYS; i++) {
+        fp = top->keys[i].fp;
 
-            p = &temp->left;
+        n = (fp == 0) ? 0 : ngx_http_ctrl_limit_top_count(top, fp, NULL);
 
-        } else if (node->key > temp->key) {
+        least = ngx_min(least, n);
+    }
 
-            p = &temp->right;
+    top->min = least;
+}
 
-        } else { /* node->key == temp->key */
 
-            cn = (ngx_http_ctrl_limit_conn_node_t *) &node->color;
-            cnt = (ngx_http_ctrl_limit_conn_node_t *) &temp->color;
+ngx_uint_t
+ngx_http_ctrl_limit_top_count(ngx_http_ctrl_top_t *top, ngx_atomic_uint_t fp,
+    ngx_uint_t *rejected)
+{
+    ngx_uint_t                    i, events;
+    ngx_http_ctrl_top_counter_t  *counter;
 
-            p = (ngx_memn2cmp(cn->data, cnt->data, cn->len, cnt->len) < 0)
-                ? &temp->left : &temp->right;
-        }
+    events = (ngx_uint_t) -1;
 
-        if (*p == sentinel) {
-            break;
+    if (rejected != NULL) {
+        *rejected = (ngx_uint_t) -1;
+    }
+
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_ROWS; i++) {
+        counter = ngx_http_ctrl_limit_top_counter(top, fp, i);
+
+        events = ngx_min(events, counter->events);
+
+        if (rejected != NULL) {
+            *rejected = ngx_min(*rejected, counter->rejected);
         }
+    }
+
+    return events;
+}
+
+
+static void
+ngx_http_ctrl_limit_top_decay(ngx_http_ctrl_top_t *top)
+{
+    ngx_uint_t                    i, n;
+    ngx_atomic_uint_t             old, now;
+    ngx_http_ctrl_top_counter_t  *counter;
+
+    now = ngx_current_msec;
+    old = top->decay;
 
-        temp = *p;
+    if ((ngx_msec_int_t) (now - old) < NGX_HTTP_CTRL_TOP_DECAY
+        || !ngx_atomic_cmp_set(&top->decay, old, now))
+    {
+        return;
     }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
+    n = (top->mask + 1) * NGX_HTTP_CTRL_TOP_ROWS;
+
+    for (counter = top->counters, i = 0; i < n; counter++, i++) {
+        old = counter->events;
+        (void) ngx_atomic_cmp_set(&counter->events, old, old / 2);
+
+        old = counter->rejected;
+        (void) ngx_atomic_cmp_set(&counter->rejected, old, old / 2);
+    }
+
+    top->min /= 2;
 }
 
 
 void
-ngx_http_ctrl_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
-    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+ngx_http_ctrl_limit_gcra_sweep(ngx_event_t *ev)
 {
-    ngx_rbtree_node_t               **p;
-    ngx_http_ctrl_limit_req_node_t   *rn, *rnt;
+    ngx_uint_t                  i, n;
+    ngx_atomic_uint_t           key, now;
+    ngx_http_ctrl_gcra_t       *gcra;
+    ngx_http_ctrl_shdata_t     *sh;
+    ngx_http_ctrl_gcra_slot_t  *slot;
+
+    sh = ev->data;
+    gcra = &sh->gcra;
+
+    for (i = 0; i < NGX_HTTP_CTRL_LIMIT_TOP_LOCALS; i++) {
+        if (ngx_http_ctrl_limit_top_locals[i].events != 0) {
+            ngx_http_ctrl_limit_top_merge(&sh->top,
+                                          &ngx_http_ctrl_limit_top_locals[i]);
+        }
+    }
 
-    for ( ;; ) {
+    ngx_http_ctrl_limit_top_decay(&sh->top);
+    ngx_http_ctrl_limit_top_refresh(&sh->top);
 
-        if (node->key < temp->key) {
+    for (i = 0; i < NGX_HTTP_CTRL_LIMIT_LOCALS; i++) {
+        ngx_http_ctrl_limit_local_flush(&ngx_http_ctrl_limit_locals[i]);
+    }
+
+    now = (ngx_atomic_uint_t) ngx_current_msec * 1000;
+
+    i = ngx_atomic_fetch_add(&gcra->sweep, NGX_HTTP_CTRL_GCRA_SWEEP_SLOTS)
+        & gcra->mask;
+
+    n = ngx_min(gcra->mask + 1 - i, NGX_HTTP_CTRL_GCRA_SWEEP_SLOTS);
+
+    for (slot = &gcra->slots[i]; n != 0; slot++, n--) {
+        key = slot->key;
+
+        if (key != 0
+            && (ngx_atomic_int_t) (now - slot->tat)
+               > (ngx_atomic_int_t) NGX_HTTP_CTRL_GCRA_IDLE * 1000)
+        {
+            (void) ngx_atomic_cmp_set(&slot->key, key, 0);
+        }
+    }
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, NGX_HTTP_CTRL_GCRA_SWEEP);
+    }
+}
+
+
+/*
+ * The delayed requests of a worker are parked in a wheel of millisecond
+ * slots instead of the event timer tree, a slot keeps the requests of
+ * the later rounds as well.  A single timer is set to the nearest slot
+ * which is not empty.  It is not cancelable, so a graceful shutdown waits
+ * for the delayed requests like for their own timers.
+ */
+
+static ngx_int_t
+ngx_http_ctrl_limit_delay(ngx_http_request_t *r, ngx_msec_t delay)
+{
+    ngx_event_t                  *ev;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_ctrl_limit_delay_t  *d;
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_http_ctrl_limit_delay_t));
+    if (cln == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_ctrl_limit_wheel_delays++ == 0) {
+        ngx_http_ctrl_limit_wheel_tick = ngx_current_msec;
+    }
+
+    d = cln->data;
+
+    d->request = r;
+    d->expire = ngx_current_msec + delay;
+
+    ngx_queue_insert_tail(
+        &ngx_http_ctrl_limit_wheel[d->expire % NGX_HTTP_CTRL_LIMIT_WHEEL],
+        &d->queue);
+
+    cln->handler = ngx_http_ctrl_limit_delay_cleanup;
+
+    r->connection->write->delayed = 1;
+
+    ev = &ngx_http_ctrl_limit_wheel_event;
+
+    if (!ev->timer_set) {
+        ngx_add_timer(ev, delay);
+
+    } else if ((ngx_msec_int_t) (ev->timer.key - d->expire) > 0) {
+
+        /* ngx_add_timer() keeps a timer which differs by less than 300ms */
+
+        ngx_del_timer(ev);
+        ngx_add_timer(ev, delay);
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_http_ctrl_limit_delay_cleanup(void *data)
+{
+    ngx_http_ctrl_limit_delay_t  *d = data;
+
+    if (d->request != NULL) {
+        ngx_queue_remove(&d->queue);
+        ngx_http_ctrl_limit_wheel_delays--;
+    }
+}
 
-            p = &temp->left;
 
-        } else if (node->key > temp->key) {
+static void
+ngx_http_ctrl_limit_wheel_handler(ngx_event_t *ev)
+{
+    ngx_msec_t                    now;
+    ngx_uint_t                    n;
+    ngx_queue_t                  *q, *next, *slot;
+    ngx_event_t                  *wev;
+    ngx_http_ctrl_limit_delay_t  *d;
+
+    now = ngx_current_msec;
+
+    n = ngx_min(now - ngx_http_ctrl_limit_wheel_tick + 1,
+                NGX_HTTP_CTRL_LIMIT_WHEEL);
+
+    for ( /* void */ ; n != 0; n--, ngx_http_ctrl_limit_wheel_tick++) {
+        slot = &ngx_http_ctrl_limit_wheel[ngx_http_ctrl_limit_wheel_tick
+                                          % NGX_HTTP_CTRL_LIMIT_WHEEL];
 
-            p = &temp->right;
+        for (q = ngx_queue_head(slot); q != ngx_queue_sentinel(slot); q = next)
+        {
+            next = ngx_queue_next(q);
+            d = ngx_queue_data(q, ngx_http_ctrl_limit_delay_t, queue);
 
-        } else { /* node->key == temp->key */
+            if ((ngx_msec_int_t) (d->expire - now) > 0) {
+                continue;
+            }
+
+            ngx_queue_remove(q);
+            ngx_http_ctrl_limit_wheel_delays--;
+
+            /* the request handler resets the delayed flag */
 
-            rn = (ngx_http_ctrl_limit_req_node_t *) &node->color;
-            rnt = (ngx_http_ctrl_limit_req_node_t *) &temp->color;
+            wev = d->request->connection->write;
+            wev->timedout = 1;
+            ngx_post_event(wev, &ngx_posted_events);
 
-            p = (ngx_memn2cmp(rn->data, rnt->data, rn->len, rnt->len) < 0)
-                ? &temp->left : &temp->right;
+            d->request = NULL;
         }
+    }
+
+    ngx_http_ctrl_limit_wheel_tick = now + 1;
 
-        if (*p == sentinel) {
+    if (ngx_http_ctrl_limit_wheel_delays == 0) {
+        return;
+    }
+
+    for (n = 1; n < NGX_HTTP_CTRL_LIMIT_WHEEL; n++) {
+        slot = &ngx_http_ctrl_limit_wheel[(now + n)
+                                          % NGX_HTTP_CTRL_LIMIT_WHEEL];
+
+        if (!ngx_queue_empty(slot)) {
             break;
         }
+    }
+
+    ngx_add_timer(ev, n);
+}
 
-        temp = *p;
+
+static void
+ngx_http_ctrl_limit_req_delay(ngx_http_request_t *r)
+{
+    ngx_event_t  *wev;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "limit_req delay");
+
+    wev = r->connection->write;
+
+    if (wev->delayed) {
+
+        if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        }
+
+        return;
     }
 
-    *p = node;
-    node->parent = temp;
-    node->left = sentinel;
-    node->right = sentinel;
-    ngx_rbt_red(node);
+    if (ngx_handle_read_event(r->connection->read, 0) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    r->read_event_handler = ngx_http_block_reading;
+    r->write_event_handler = ngx_http_core_run_phases;
+
+    ngx_http_core_run_phases(r);
 }
@@ -7,16 +7,29 @@
 #include <ngx_http_ctrl.h>
 
 
+static nxt_mp_t *ngx_http_ctrl_pool_get(void);
+static void ngx_http_ctrl_pool_put(nxt_mp_t *mp);
 static void ngx_http_ctrl_cleanup(void *data);
+static ngx_int_t ngx_http_ctrl_return(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_http_action_response_t *response);
 static ngx_int_t ngx_http_ctrl_init_module(ngx_cycle_t *cycle);
 static void ngx_http_ctrl_notify_cleanup(void *data);
 static ngx_int_t ngx_http_ctrl_init_process(ngx_cycle_t *cycle);
+static void ngx_http_ctrl_exit_process(ngx_cycle_t *cycle);
 static ngx_int_t ngx_http_ctrl_init(ngx_conf_t *cf);
 static void *ngx_http_ctrl_create_main_conf(ngx_conf_t *cf);
 static char *ngx_http_ctrl_init_main_conf(ngx_conf_t *cf, void *conf);
 static void *ngx_http_ctrl_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_ctrl_merge_loc_conf(ngx_conf_t *cf, void *parent,
     void *child);
+static ngx_int_t ngx_http_ctrl_init_limit(ngx_http_ctrl_shctx_t *ctx,
+    size_t size);
+static ngx_int_t ngx_http_ctrl_init_limit_table(ngx_slab_pool_t *sp,
+    ngx_http_ctrl_limit_table_t *table, size_t size);
+static ngx_int_t ngx_http_ctrl_init_gcra(ngx_http_ctrl_shctx_t *ctx,
+    size_t size);
+static ngx_int_t ngx_http_ctrl_init_top(ngx_http_ctrl_shctx_t *ctx,
+    size_t size);
 static char *ngx_http_ctrl_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_ctrl_set(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_ctrl_config(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
@@ -46,6 +59,20 @@ static ngx_command_t  ngx_http_ctrl_commands[] = {
       0,
       NULL },
 
+    { ngx_string("ctrl_route_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_ctrl_main_conf_t, route_cache),
+      NULL },
+
+    { ngx_string("ctrl_shared_addr"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_ctrl_main_conf_t, shared_addr),
+      NULL },
+
     { ngx_string("ctrl"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -103,7 +130,7 @@ ngx_module_t  ngx_http_ctrl_module = {
     ngx_http_ctrl_init_process,     /* init process */
     NULL,                           /* init thread */
     NULL,                           /* exit thread */
-    NULL,                           /* exit process */
+    ngx_http_ctrl_exit_process,     /* exit process */
     NULL,                           /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -111,6 +138,8 @@ ngx_module_t  ngx_http_ctrl_module = {
 
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
+static ngx_event_t  ngx_http_ctrl_gcra_sweep_event;
+
 
 static ngx_int_t
 ngx_http_ctrl_rewrite_handler(ngx_http_request_t *r)
@@ -121,7 +150,7 @@ ngx_http_ctrl_rewrite_handler(ngx_http_request_t *r)
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_ctrl_module);
 
-    if (!(clcf->conf_enable || clcf->stats_enable)) {
+    if (!clcf->conf_enable) {
         return NGX_DECLINED;
     }
 
@@ -131,18 +160,13 @@ ngx_http_ctrl_rewrite_handler(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (clcf->conf_enable) {
-        rc = ngx_http_ctrl_request_init(r);
-        if (rc == NGX_ERROR) {
-            return rc;
-        }
+    rc = ngx_http_ctrl_request_init(r);
+    if (rc == NGX_ERROR) {
+        return rc;
+    }
 
-        if (ctx->action != NULL) {
-            rc = ngx_http_ctrl_set_variables(r, ctx->action->variables);
-            if (rc == NGX_ERROR) {
-                return rc;
-            }
-        }
+    if (ctx->action != NULL) {
+        ngx_http_ctrl_set_variables(r, ctx->action->variables);
     }
 
     return NGX_DECLINED;
@@ -166,7 +190,7 @@ ngx_http_ctrl_get_ctx(ngx_http_request_t *r)
         return ctx;
     }
 
-    mp = nxt_mp_create(4096, 128, 1024, 64);
+    mp = ngx_http_ctrl_pool_get();
     if (mp == NULL) {
         return NULL;
     }
@@ -176,63 +200,98 @@ ngx_http_ctrl_get_ctx(ngx_http_request_t *r)
         goto fail;
     }
 
-    ngx_http_set_ctx(r, ctx, ngx_http_ctrl_module);
-
-    ctx->mem_pool = mp;
-    ctx->request = r;
-
     cln = ngx_pool_cleanup_add(r->pool, 0);
     if (cln == NULL) {
         goto fail;
     }
 
+    ctx->mem_pool = mp;
+    ctx->request = r;
+
     cln->handler = ngx_http_ctrl_cleanup;
     cln->data = ctx;
 
+    ngx_http_set_ctx(r, ctx, ngx_http_ctrl_module);
+
     return ctx;
 
 fail:
 
-    nxt_mp_destroy(mp);
+    ngx_http_ctrl_pool_put(mp);
 
     return NULL;
 }
 
 
+/*
+ * The request pools are recycled by the worker process.  A reset pool
+ * keeps its first cluster, so the requests in steady state allocate
+ * their bookkeeping without malloc().
+ */
+
+#define NGX_HTTP_CTRL_POOLS  64
+
+static nxt_mp_t    *ngx_http_ctrl_pools[NGX_HTTP_CTRL_POOLS];
+static ngx_uint_t   ngx_http_ctrl_npools;
+
+
+static nxt_mp_t *
+ngx_http_ctrl_pool_get(void)
+{
+    if (ngx_http_ctrl_npools != 0) {
+        return ngx_http_ctrl_pools[--ngx_http_ctrl_npools];
+    }
+
+    return nxt_mp_create(4096, 128, 1024, 64);
+}
+
+
+static void
+ngx_http_ctrl_pool_put(nxt_mp_t *mp)
+{
+    if (ngx_http_ctrl_npools == NGX_HTTP_CTRL_POOLS) {
+        nxt_mp_destroy(mp);
+        return;
+    }
+
+    nxt_mp_reset(mp);
+
+    ngx_http_ctrl_pools[ngx_http_ctrl_npools++] = mp;
+}
+
+
 static void
 ngx_http_ctrl_cleanup(void *data)
 {
     ngx_http_ctrl_ctx_t *ctx = data;
 
-    ngx_rbtree_node_t                *node;
-    ngx_http_ctrl_shctx_t            *shctx;
-    ngx_http_ctrl_main_conf_t        *cmcf;
-    ngx_http_ctrl_limit_conn_node_t  *cn;
+    ngx_http_ctrl_shctx_t        *shctx;
+    ngx_http_ctrl_main_conf_t    *cmcf;
+    ngx_http_ctrl_limit_shard_t  *shard;
+    ngx_http_ctrl_limit_entry_t  *entry;
 
     if (ctx->http_conf) {
         ngx_http_conf_release(ctx->http_conf);
     }
 
-    if (ctx->node) {
-        node = ctx->node;
-        cn = (ngx_http_ctrl_limit_conn_node_t *) &node->color;
+    if (ctx->limit_conn) {
+        entry = ctx->limit_conn;
 
         cmcf = ngx_http_get_module_main_conf(ctx->request, ngx_http_ctrl_module);
         shctx = cmcf->shm_zone->data;
+        shard = ngx_http_ctrl_limit_shard(shctx->sh,
+                                          ngx_http_ctrl_limit_hash(entry->fp));
 
-        ngx_shmtx_lock(&shctx->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-        cn->conn--;
-
-        if (cn->conn == 0) {
-            ngx_rbtree_delete(&shctx->sh->limit_conn_rbtree, node);
-            ngx_slab_free_locked(shctx->shpool, node);
+        if (--entry->value == 0) {
+            entry->fp = 0;
         }
 
-        ngx_shmtx_unlock(&shctx->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
     }
 
-    nxt_mp_destroy(ctx->mem_pool);
+    ngx_http_ctrl_pool_put(ctx->mem_pool);
 }
 
 
@@ -243,32 +302,34 @@ ngx_http_ctrl_preaccess_handler(ngx_http_request_t *r)
     ngx_http_ctrl_ctx_t        *ctx;
     ngx_http_ctrl_loc_conf_t   *clcf;
 
-    ctx = ngx_http_ctrl_get_ctx(r);
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_ctrl_module);
 
-    if (ctx == NULL || ctx->action == NULL) {
+    if (!clcf->conf_enable) {
         return NGX_DECLINED;
     }
 
-    if (clcf->conf_enable) {
+    ctx = ngx_http_ctrl_get_ctx(r);
 
-        if (ctx->action->limit_rate > 0) {
-            r->limit_rate = ctx->action->limit_rate;
-            r->limit_rate_set = 1;
-        }
+    if (ctx == NULL || ctx->action == NULL) {
+        return NGX_DECLINED;
+    }
 
-        if (ctx->action->limit_conn) {
-            rc = ngx_http_ctrl_limit_conn(r, ctx->action->limit_conn);
-            if (rc != NGX_DECLINED) {
-                return rc;
-            }
+    if (ctx->action->limit_rate > 0) {
+        r->limit_rate = ctx->action->limit_rate;
+        r->limit_rate_set = 1;
+    }
+
+    if (ctx->action->limit_conn) {
+        rc = ngx_http_ctrl_limit_conn(r, ctx->action->limit_conn);
+        if (rc != NGX_DECLINED) {
+            return rc;
         }
+    }
 
-        if (ctx->action->limit_req) {
-            rc = ngx_http_ctrl_limit_req(r, ctx->action->limit_req);
-            if (rc != NGX_DECLINED) {
-                return rc;
-            }
+    if (ctx->action->limit_req) {
+        rc = ngx_http_ctrl_limit_req(r, ctx->action->limit_req);
+        if (rc != NGX_DECLINED) {
+            return rc;
         }
     }
 
@@ -283,27 +344,29 @@ ngx_http_ctrl_access_handler(ngx_http_request_t *r)
     ngx_http_ctrl_ctx_t       *ctx;
     ngx_http_ctrl_loc_conf_t  *clcf;
 
-    ctx = ngx_http_ctrl_get_ctx(r);
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_ctrl_module);
 
-    if (ctx == NULL || ctx->action == NULL) {
+    if (!clcf->conf_enable) {
         return NGX_DECLINED;
     }
 
-    if (clcf->conf_enable) {
+    ctx = ngx_http_ctrl_get_ctx(r);
 
-        if (ctx->action->blacklist) {
-            rc = ngx_http_ctrl_blacklist(r, ctx->action->blacklist);
-            if (rc == NGX_OK) {
-                return NGX_HTTP_FORBIDDEN;
-            }
+    if (ctx == NULL || ctx->action == NULL) {
+        return NGX_DECLINED;
+    }
+
+    if (ctx->action->blacklist) {
+        rc = ngx_http_ctrl_blacklist(r, ctx->action->blacklist);
+        if (rc == NGX_OK) {
+            return NGX_HTTP_FORBIDDEN;
         }
+    }
 
-        if (ctx->action->whitelist) {
-            rc = ngx_http_ctrl_whitelist(r, ctx->action->whitelist);
-            if (rc != NGX_OK) {
-                return NGX_HTTP_FORBIDDEN;
-            }
+    if (ctx->action->whitelist) {
+        rc = ngx_http_ctrl_whitelist(r, ctx->action->whitelist);
+        if (rc != NGX_OK) {
+            return NGX_HTTP_FORBIDDEN;
         }
     }
 
@@ -315,61 +378,124 @@ static ngx_int_t
 ngx_http_ctrl_precontent_handler(ngx_http_request_t *r)
 {
     ngx_int_t                   rc;
-    ngx_str_t                  *text;
-    ngx_uint_t                 status;
     ngx_http_action_t         *action;
     ngx_http_ctrl_ctx_t       *ctx;
-    ngx_http_complex_value_t   cv;
     ngx_http_ctrl_loc_conf_t  *clcf;
 
-    ctx = ngx_http_ctrl_get_ctx(r);
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_ctrl_module);
 
+    if (!clcf->conf_enable) {
+        return NGX_DECLINED;
+    }
+
+    ctx = ngx_http_ctrl_get_ctx(r);
+
     if (ctx == NULL || ctx->action == NULL) {
         return NGX_DECLINED;
     }
 
-    if (clcf->conf_enable) {
-        action = ctx->action;
+    action = ctx->action;
 
-        status = action->return_status;
+    if (action->response != NULL) {
+        rc = ngx_http_ctrl_return(r, action->return_status, action->response);
 
-        if (status) {
-            if (status < NGX_HTTP_BAD_REQUEST
-                || action->return_text.length)
-            {
-                ngx_memzero(&cv, sizeof(ngx_http_complex_value_t));
+        ngx_http_finalize_request(r, rc);
 
-                text = &cv.value;
+        return NGX_DONE;
+    }
 
-                if (status == NGX_HTTP_MOVED_PERMANENTLY
-                    || status == NGX_HTTP_MOVED_TEMPORARILY
-                    || status == NGX_HTTP_SEE_OTHER
-                    || status == NGX_HTTP_TEMPORARY_REDIRECT
-                    || status == NGX_HTTP_PERMANENT_REDIRECT)
-                {
-                    text->len = action->return_location.length;
-                    text->data = action->return_location.start;
+    if (action->return_status) {
+        return action->return_status;
+    }
 
-                } else {
-                    text->len = action->return_text.length;
-                    text->data = action->return_text.start;
-                }
+    return NGX_DECLINED;
+}
 
-                rc = ngx_http_send_response(r, action->return_status,
-                                            NULL, &cv);
 
-                ngx_http_finalize_request(r, rc);
+static ngx_int_t
+ngx_http_ctrl_return(ngx_http_request_t *r, ngx_uint_t status,
+    ngx_http_action_response_t *response)
+{
+    ngx_int_t         rc;
+    ngx_buf_t        *b, *body;
+    ngx_chain_t       out;
+    ngx_table_elt_t  *h;
+
+    if (response->location.hash) {
+        ngx_http_clear_location(r);
+
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        *h = response->location;
 
-                return NGX_DONE;
+        r->headers_out.location = h;
 
-            } else {
-                return action->return_status;
+        return status;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.status = status;
+
+    body = &response->body;
+
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+
+    if (response->gzip.start != NULL) {
+        r->gzip_vary = 1;
+
+        if (ngx_http_gzip_ok(r) == NGX_OK) {
+            h = ngx_list_push(&r->headers_out.headers);
+            if (h == NULL) {
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
             }
+
+            *h = response->content_encoding;
+
+            r->headers_out.content_encoding = h;
+
+            body = &response->gzip;
         }
     }
 
-    return NGX_DECLINED;
+#endif
+
+    r->headers_out.content_length_n = body->last - body->pos;
+
+    if (response->type.len) {
+        r->headers_out.content_type_len = response->type.len;
+        r->headers_out.content_type = response->type;
+        r->headers_out.content_type_lowcase = NULL;
+
+    } else if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* The writer advances the buffer, so the request gets its own copy. */
+
+    b = ngx_alloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    *b = *body;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
 }
 
 
@@ -379,18 +505,30 @@ ngx_http_ctrl_header_filter(ngx_http_request_t *r)
     ngx_http_ctrl_ctx_t           *ctx;
     ngx_http_ctrl_loc_conf_t      *clcf;
 
-    ctx = ngx_http_ctrl_get_ctx(r);
-
-    if (ctx == NULL) {
+    if (r != r->main) {
         return ngx_http_next_header_filter(r);
     }
 
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_ctrl_module);
 
+    /* The counters live in the zone, no request context is needed. */
+
     if (clcf->stats_enable) {
         ngx_http_ctrl_stats_code(r);
     }
 
+    if (clcf->conf_enable) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+
+        if (ctx != NULL && ctx->action != NULL
+            && ctx->action->add_headers != NULL
+            && ngx_http_ctrl_add_headers(r, ctx->action->add_headers)
+               != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
     return ngx_http_next_header_filter(r);
 }
 
@@ -454,6 +592,10 @@ ngx_http_ctrl_init_module(ngx_cycle_t *cycle)
 
     cmcf->file.name = cmcf->state.data;
 
+    nxt_wy_hash_init();
+
+    ngx_http_ctrl_addr_share(cmcf->shared_addr ? cmcf->shm_zone->data : NULL);
+
     nxt_memzero(&error, sizeof(nxt_str_t));
 
     if (ngx_http_conf_start(cycle, &cmcf->file, &error) != NGX_OK) {
@@ -597,6 +739,8 @@ ngx_http_ctrl_init_process(ngx_cycle_t *cycle)
     ngx_event_t                *rev, *wev;
     ngx_socket_t                fd;
     ngx_connection_t           *c;
+    ngx_http_ctrl_stats_t      *stats;
+    ngx_http_ctrl_shctx_t      *shctx;
     ngx_http_ctrl_main_conf_t  *cmcf;
 
     if (ngx_process != NGX_PROCESS_WORKER) {
@@ -605,7 +749,38 @@ ngx_http_ctrl_init_process(ngx_cycle_t *cycle)
 
     cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_ctrl_module);
 
-    if (cmcf == NULL || cmcf->nfd == 0) {
+    if (cmcf == NULL) {
+        return NGX_OK;
+    }
+
+    ngx_http_ctrl_addr_inherit();
+
+    ngx_http_ctrl_limit_init_process(cycle);
+
+    if (cmcf->shm_zone != NULL) {
+        shctx = cmcf->shm_zone->data;
+
+        ngx_http_ctrl_gcra_sweep_event.handler = ngx_http_ctrl_limit_gcra_sweep;
+        ngx_http_ctrl_gcra_sweep_event.data = shctx->sh;
+        ngx_http_ctrl_gcra_sweep_event.log = cycle->log;
+        ngx_http_ctrl_gcra_sweep_event.cancelable = 1;
+
+        ngx_add_timer(&ngx_http_ctrl_gcra_sweep_event,
+                      NGX_HTTP_CTRL_GCRA_SWEEP);
+    }
+
+    if (cmcf->route_cache > 0) {
+        shctx = cmcf->shm_zone->data;
+        stats = &shctx->sh->stats[ngx_process_slot].stats;
+
+        if (ngx_http_conf_cache_init(cmcf->route_cache, &stats->route_cache)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (cmcf->nfd == 0) {
         return NGX_OK;
     }
 
@@ -690,6 +865,19 @@ ngx_http_ctrl_init_process(ngx_cycle_t *cycle)
 }
 
 
+static void
+ngx_http_ctrl_exit_process(ngx_cycle_t *cycle)
+{
+    if (ngx_process != NGX_PROCESS_WORKER) {
+        return;
+    }
+
+    /* Drops the references to the shared address sets. */
+
+    ngx_http_conf_exit();
+}
+
+
 static void *
 ngx_http_ctrl_create_main_conf(ngx_conf_t *cf)
 {
@@ -710,6 +898,9 @@ ngx_http_ctrl_create_main_conf(ngx_conf_t *cf)
      *     cmcf->shm_zone = NULL;
      */
 
+    cmcf->route_cache = NGX_CONF_UNSET;
+    cmcf->shared_addr = NGX_CONF_UNSET;
+
     return cmcf;
 }
 
@@ -719,12 +910,66 @@ ngx_http_ctrl_init_main_conf(ngx_conf_t *cf, void *conf)
 {
     ngx_http_ctrl_main_conf_t *cmcf = conf;
 
+    size_t       len;
+    ngx_path_t  *path;
+
     if (cmcf->state.data == NULL) {
         ngx_str_set(&cmcf->state, "conf.json");
     }
 
     ngx_conf_full_name(cf->cycle, &cmcf->state, 1);
 
+    /*
+     * The address list images are compiled into the "ctrl_addr" directory
+     * next to the state file, which is created for the worker processes.
+     */
+
+    path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
+    if (path == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (len = cmcf->state.len; len != 0; len--) {
+        if (cmcf->state.data[len - 1] == '/') {
+            break;
+        }
+    }
+
+    path->name.len = len + sizeof("ctrl_addr") - 1;
+
+    path->name.data = ngx_pnalloc(cf->pool, path->name.len + 1);
+    if (path->name.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memcpy(ngx_cpymem(path->name.data, cmcf->state.data, len),
+               "ctrl_addr", sizeof("ctrl_addr"));
+
+    if (ngx_add_path(cf, &path) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    cmcf->addr_path = path;
+
+    ngx_conf_init_value(cmcf->route_cache, 0);
+
+    if (cmcf->route_cache > 0 && cmcf->shm_zone == NULL) {
+        return "\"ctrl_route_cache\" requires \"ctrl_zone\"";
+    }
+
+    if (cmcf->route_cache > NGX_HTTP_ROUTE_CACHE_MAX) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"ctrl_route_cache\" must not exceed %d",
+                           NGX_HTTP_ROUTE_CACHE_MAX);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_init_value(cmcf->shared_addr, 0);
+
+    if (cmcf->shared_addr && cmcf->shm_zone == NULL) {
+        return "\"ctrl_shared_addr\" requires \"ctrl_zone\"";
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -775,7 +1020,6 @@ ngx_http_ctrl_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_http_ctrl_shctx_t  *octx = data;
 
     size_t                  len;
-    ngx_rbtree_node_t      *sentinel;
     ngx_http_ctrl_shctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -802,24 +1046,16 @@ ngx_http_ctrl_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ctx->shpool->data = ctx->sh;
 
-    sentinel = ngx_slab_alloc(ctx->shpool, sizeof(ngx_rbtree_node_t));
-    if (sentinel == NULL) {
-        return NGX_ERROR;
-    }
-
-    ngx_rbtree_init(&ctx->sh->limit_conn_rbtree, sentinel,
-                    ngx_http_ctrl_limit_conn_rbtree_insert_value);
+    ngx_rbtree_init(&ctx->sh->addr_sets, &ctx->sh->addr_sentinel,
+                    ngx_rbtree_insert_value);
 
-    sentinel = ngx_slab_alloc(ctx->shpool, sizeof(ngx_rbtree_node_t));
-    if (sentinel == NULL) {
+    ctx->sh->stats = ngx_slab_calloc(ctx->shpool,
+                                     NGX_HTTP_CTRL_STATS_SLOTS
+                                     * sizeof(ngx_http_ctrl_stats_slot_t));
+    if (ctx->sh->stats == NULL) {
         return NGX_ERROR;
     }
 
-    ngx_rbtree_init(&ctx->sh->limit_req_rbtree, sentinel,
-                    ngx_http_ctrl_limit_req_rbtree_insert_value);
-
-    ngx_queue_init(&ctx->sh->limit_req_queue);
-
     len = sizeof(" in ctrl_zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
@@ -830,6 +1066,172 @@ ngx_http_ctrl_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ngx_sprintf(ctx->shpool->log_ctx, " in ctrl_zone \"%V\"%Z",
                 &shm_zone->shm.name);
 
+    if (ngx_http_ctrl_init_limit(ctx, shm_zone->shm.size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_ctrl_init_gcra(ctx, shm_zone->shm.size) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_ctrl_init_top(ctx, shm_zone->shm.size);
+}
+
+
+/*
+ * Half of the zone is divided between the limiter shards, each shard
+ * is a separate slab pool with its own mutex.  A small zone gets fewer
+ * shards, down to a single one that stays in the zone pool.
+ */
+
+static ngx_int_t
+ngx_http_ctrl_init_limit(ngx_http_ctrl_shctx_t *ctx, size_t size)
+{
+    u_char                       *addr;
+    ngx_uint_t                    i, n;
+    ngx_slab_pool_t              *sp;
+    ngx_http_ctrl_limit_shard_t  *shard;
+
+    n = NGX_HTTP_CTRL_LIMIT_SHARDS;
+
+    while (n > 1 && size / 2 / n < NGX_HTTP_CTRL_LIMIT_SHARD_SIZE) {
+        n /= 2;
+    }
+
+    size = (size / 2 / n) & ~(ngx_pagesize - 1);
+
+    ctx->sh->limit_mask = n - 1;
+
+    for (i = 0; i < n; i++) {
+
+        if (n == 1) {
+            sp = ctx->shpool;
+
+        } else {
+            addr = ngx_slab_alloc(ctx->shpool, size);
+            if (addr == NULL) {
+                return NGX_ERROR;
+            }
+
+            sp = (ngx_slab_pool_t *) addr;
+
+            sp->end = addr + size;
+            sp->min_shift = 3;
+            sp->addr = addr;
+
+            if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_slab_init(sp);
+
+            sp->log_ctx = ctx->shpool->log_ctx;
+        }
+
+        shard = ngx_slab_alloc(sp, sizeof(ngx_http_ctrl_limit_shard_t));
+        if (shard == NULL) {
+            return NGX_ERROR;
+        }
+
+        shard->shpool = sp;
+
+        if (ngx_http_ctrl_init_limit_table(sp, &shard->conn, size / 4)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_ctrl_init_limit_table(sp, &shard->req, size / 2)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ctx->sh->limit[i] = shard;
+    }
+
+    return NGX_OK;
+}
+
+
+/* The last bucket is probed only as the second one of the previous. */
+
+static ngx_int_t
+ngx_http_ctrl_init_limit_table(ngx_slab_pool_t *sp,
+    ngx_http_ctrl_limit_table_t *table, size_t size)
+{
+    size_t  bucket;
+
+    bucket = NGX_HTTP_CTRL_LIMIT_BUCKET * sizeof(ngx_http_ctrl_limit_entry_t);
+
+    table->nbuckets = size / bucket - 1;
+
+    table->entries = ngx_slab_calloc(sp, (table->nbuckets + 1) * bucket);
+    if (table->entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/* An eighth of the zone goes to the gcra slots, a power of two of them. */
+
+static ngx_int_t
+ngx_http_ctrl_init_gcra(ngx_http_ctrl_shctx_t *ctx, size_t size)
+{
+    ngx_uint_t             n;
+    ngx_http_ctrl_gcra_t  *gcra;
+
+    n = NGX_HTTP_CTRL_GCRA_BUCKET;
+
+    while (n * 2 * sizeof(ngx_http_ctrl_gcra_slot_t) <= size / 8) {
+        n *= 2;
+    }
+
+    gcra = &ctx->sh->gcra;
+
+    gcra->slots = ngx_slab_calloc(ctx->shpool,
+                                  n * sizeof(ngx_http_ctrl_gcra_slot_t));
+    if (gcra->slots == NULL) {
+        return NGX_ERROR;
+    }
+
+    gcra->mask = n - 1;
+
+    return NGX_OK;
+}
+
+
+/* The sketch takes up to a 64th of the zone. */
+
+static ngx_int_t
+ngx_http_ctrl_init_top(ngx_http_ctrl_shctx_t *ctx, size_t size)
+{
+    ngx_uint_t            n;
+    ngx_http_ctrl_top_t  *top;
+
+    n = NGX_HTTP_CTRL_TOP_WIDTH;
+
+    while (n > 16
+           && n * NGX_HTTP_CTRL_TOP_ROWS * sizeof(ngx_http_ctrl_top_counter_t)
+              > size / 64)
+    {
+        n /= 2;
+    }
+
+    top = &ctx->sh->top;
+
+    top->counters = ngx_slab_calloc(ctx->shpool,
+                                    n * NGX_HTTP_CTRL_TOP_ROWS
+                                    * sizeof(ngx_http_ctrl_top_counter_t));
+    if (top->counters == NULL) {
+        return NGX_ERROR;
+    }
+
+    top->mask = n - 1;
+    top->decay = ngx_current_msec;
+
     return NGX_OK;
 }
 
@@ -1020,6 +1422,8 @@ ngx_http_ctrl_init(ngx_conf_t *cf)
     ngx_http_handler_pt        *h;
     ngx_http_core_main_conf_t  *cmcf;
 
+    nxt_string_init();
+
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
 
     h = ngx_array_push(&cmcf->phases[NGX_HTTP_REWRITE_PHASE].handlers);
@@ -7,47 +7,60 @@
 #include <ngx_http_ctrl.h>
 
 
+typedef struct {
+    ngx_uint_t                  events;
+    ngx_uint_t                  rejected;
+    size_t                      len;
+    u_char                      key[NGX_HTTP_CTRL_TOP_KEY_LEN];
+} ngx_http_ctrl_stats_top_t;
+
+
 static nxt_conf_value_t *ngx_http_ctrl_stats_stub(ngx_http_request_t *r,
     nxt_mp_t *mp);
 static nxt_conf_value_t *ngx_http_ctrl_stats_status(ngx_http_request_t *r,
     nxt_mp_t *mp);
+static nxt_conf_value_t *ngx_http_ctrl_stats_route_cache(ngx_http_request_t *r,
+    nxt_mp_t *mp);
+static nxt_conf_value_t *ngx_http_ctrl_stats_limits(ngx_http_request_t *r,
+    nxt_mp_t *mp);
+static int ngx_http_ctrl_stats_top_compare(const void *one, const void *two);
+static nxt_int_t ngx_http_ctrl_stats_key(nxt_mp_t *mp, nxt_str_t *dst,
+    u_char *src, size_t len);
 
 
 void
 ngx_http_ctrl_stats_code(ngx_http_request_t *r)
 {
     ngx_uint_t                     status;
+    ngx_atomic_t                  *counter;
     ngx_http_ctrl_stats_t         *stats;
     ngx_http_ctrl_shctx_t         *shctx;
     ngx_http_ctrl_main_conf_t      *cmcf;
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
     shctx = cmcf->shm_zone->data;
-    stats = &shctx->sh->stats;
-
-    ngx_shmtx_lock(&shctx->shpool->mutex);
+    stats = &shctx->sh->stats[ngx_process_slot].stats;
 
     status = r->headers_out.status;
 
     if (status >= 200 && status < 300) {
-        stats->n2xx++;
+        counter = &stats->n2xx;
 
     } else if (status >= 300 && status < 400) {
-        stats->n3xx++;
+        counter = &stats->n3xx;
 
     } else if (status >= 400 && status < 500) {
-        stats->n4xx++;
+        counter = &stats->n4xx;
 
     } else if (status >= 500) {
-        stats->n5xx++;
+        counter = &stats->n5xx;
 
     } else {
-        stats->n1xx++;
+        counter = &stats->n1xx;
     }
 
+    (*counter)++;
     stats->total++;
-
-    ngx_shmtx_unlock(&shctx->shpool->mutex);
 }
 
 
@@ -58,12 +71,14 @@ ngx_http_ctrl_stats_handler(ngx_http_request_t *r)
     nxt_mp_t                 *mp;
     nxt_str_t                 path, body;
     nxt_conf_value_t         *value, *stats;
-    nxt_conf_value_t         *stub, *status;
+    nxt_conf_value_t         *stub, *status, *route_cache, *limits;
     ngx_http_ctrl_ctx_t      *ctx;
     nxt_conf_json_pretty_t    pretty;
 
     static nxt_str_t stub_str = nxt_string("stub");
     static nxt_str_t status_str = nxt_string("status");
+    static nxt_str_t route_cache_str = nxt_string("route_cache");
+    static nxt_str_t limits_str = nxt_string("limits");
 
     ctx = ngx_http_ctrl_get_ctx(r);
     if (ctx == NULL) {
@@ -72,7 +87,7 @@ ngx_http_ctrl_stats_handler(ngx_http_request_t *r)
 
     mp = ctx->mem_pool;
 
-    stats = nxt_conf_create_object(mp, 2);
+    stats = nxt_conf_create_object(mp, 4);
     if (nxt_slow_path(stats == NULL)) {
         return NGX_ERROR;
     }
@@ -87,8 +102,20 @@ ngx_http_ctrl_stats_handler(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    route_cache = ngx_http_ctrl_stats_route_cache(r, mp);
+    if (nxt_slow_path(route_cache == NULL)) {
+        return NGX_ERROR;
+    }
+
     nxt_conf_set_member(stats, &stub_str, stub, 0);
     nxt_conf_set_member(stats, &status_str, status, 1);
+    limits = ngx_http_ctrl_stats_limits(r, mp);
+    if (nxt_slow_path(limits == NULL)) {
+        return NGX_ERROR;
+    }
+
+    nxt_conf_set_member(stats, &route_cache_str, route_cache, 2);
+    nxt_conf_set_member(stats, &limits_str, limits, 3);
 
     path.start = r->uri.data;
     path.length = r->uri.len;
@@ -182,15 +209,28 @@ ngx_http_ctrl_stats_stub(ngx_http_request_t *r, nxt_mp_t *mp)
 static nxt_conf_value_t *
 ngx_http_ctrl_stats_status(ngx_http_request_t *r, nxt_mp_t *mp)
 {
+    ngx_uint_t                     i;
     nxt_conf_value_t              *value;
-    ngx_http_ctrl_stats_t         *stats;
+    ngx_http_ctrl_stats_t          sum, *stats;
     ngx_http_ctrl_shctx_t         *shctx;
     ngx_http_ctrl_main_conf_t     *cmcf;
 
     cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
 
     shctx = cmcf->shm_zone->data;
-    stats = &shctx->sh->stats;
+
+    ngx_memzero(&sum, sizeof(ngx_http_ctrl_stats_t));
+
+    for (i = 0; i < NGX_HTTP_CTRL_STATS_SLOTS; i++) {
+        stats = &shctx->sh->stats[i].stats;
+
+        sum.n1xx += stats->n1xx;
+        sum.n2xx += stats->n2xx;
+        sum.n3xx += stats->n3xx;
+        sum.n4xx += stats->n4xx;
+        sum.n5xx += stats->n5xx;
+        sum.total += stats->total;
+    }
 
     value = nxt_conf_create_object(mp, 6);
     if (nxt_slow_path(value == NULL)) {
@@ -204,16 +244,212 @@ ngx_http_ctrl_stats_status(ngx_http_request_t *r, nxt_mp_t *mp)
     static nxt_str_t  xx5_str = nxt_string("n5xx");
     static nxt_str_t  total_str = nxt_string("total");
 
-    ngx_shmtx_lock(&shctx->shpool->mutex);
+    nxt_conf_set_member_integer(value, &xx1_str, sum.n1xx, 0);
+    nxt_conf_set_member_integer(value, &xx2_str, sum.n2xx, 1);
+    nxt_conf_set_member_integer(value, &xx3_str, sum.n3xx, 2);
+    nxt_conf_set_member_integer(value, &xx4_str, sum.n4xx, 3);
+    nxt_conf_set_member_integer(value, &xx5_str, sum.n5xx, 4);
+    nxt_conf_set_member_integer(value, &total_str, sum.total, 5);
+
+    return value;
+}
+
+
+static nxt_conf_value_t *
+ngx_http_ctrl_stats_route_cache(ngx_http_request_t *r, nxt_mp_t *mp)
+{
+    ngx_uint_t                     i;
+    nxt_conf_value_t              *value;
+    ngx_http_ctrl_shctx_t         *shctx;
+    ngx_http_ctrl_main_conf_t     *cmcf;
+    ngx_http_route_cache_stats_t   sum, *stats;
+
+    static nxt_str_t  hits_str = nxt_string("hits");
+    static nxt_str_t  misses_str = nxt_string("misses");
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
+
+    shctx = cmcf->shm_zone->data;
+
+    sum.hits = 0;
+    sum.misses = 0;
+
+    for (i = 0; i < NGX_HTTP_CTRL_STATS_SLOTS; i++) {
+        stats = &shctx->sh->stats[i].stats.route_cache;
+
+        sum.hits += stats->hits;
+        sum.misses += stats->misses;
+    }
+
+    value = nxt_conf_create_object(mp, 2);
+    if (nxt_slow_path(value == NULL)) {
+        return NULL;
+    }
+
+    nxt_conf_set_member_integer(value, &hits_str, sum.hits, 0);
+    nxt_conf_set_member_integer(value, &misses_str, sum.misses, 1);
+
+    return value;
+}
+
+
+/*
+ * The heavy hitter keys are copied out of the table without a lock and
+ * skipped if an entry is replaced meanwhile, the duplicates left by
+ * concurrent replacements are skipped as well.
+ */
+
+static nxt_conf_value_t *
+ngx_http_ctrl_stats_limits(ngx_http_request_t *r, nxt_mp_t *mp)
+{
+    nxt_str_t                   key;
+    ngx_uint_t                  i, j, n;
+    nxt_conf_value_t           *value, *top, *entry;
+    ngx_atomic_uint_t           fp, fps[NGX_HTTP_CTRL_TOP_KEYS];
+    ngx_http_ctrl_top_t        *sketch;
+    ngx_http_ctrl_shctx_t      *shctx;
+    ngx_http_ctrl_top_key_t    *k;
+    ngx_http_ctrl_stats_top_t  *keys;
+    ngx_http_ctrl_main_conf_t  *cmcf;
+
+    static nxt_str_t  top_str = nxt_string("top");
+    static nxt_str_t  key_str = nxt_string("key");
+    static nxt_str_t  events_str = nxt_string("events");
+    static nxt_str_t  rejected_str = nxt_string("rejected");
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_ctrl_module);
+
+    shctx = cmcf->shm_zone->data;
+    sketch = &shctx->sh->top;
+
+    keys = nxt_mp_alloc(mp, NGX_HTTP_CTRL_TOP_KEYS
+                            * sizeof(ngx_http_ctrl_stats_top_t));
+    if (nxt_slow_path(keys == NULL)) {
+        return NULL;
+    }
+
+    n = 0;
+
+    for (i = 0; i < NGX_HTTP_CTRL_TOP_KEYS; i++) {
+        k = &sketch->keys[i];
+
+        fp = k->fp;
+
+        if (fp == 0 || k->lock != 0) {
+            continue;
+        }
+
+        keys[n].len = k->len;
+        ngx_memcpy(keys[n].key, k->key, keys[n].len);
+
+        ngx_memory_barrier();
+
+        if (k->fp != fp || k->lock != 0) {
+            continue;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (fps[j] == fp) {
+                break;
+            }
+        }
+
+        if (j < n) {
+            continue;
+        }
+
+        fps[n] = fp;
+        keys[n].events = ngx_http_ctrl_limit_top_count(sketch, fp,
+                                                       &keys[n].rejected);
+        n++;
+    }
+
+    nxt_qsort(keys, n, sizeof(ngx_http_ctrl_stats_top_t),
+              ngx_http_ctrl_stats_top_compare);
+
+    top = nxt_conf_create_array(mp, n);
+    if (nxt_slow_path(top == NULL)) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        entry = nxt_conf_create_object(mp, 3);
+        if (nxt_slow_path(entry == NULL)) {
+            return NULL;
+        }
 
-    nxt_conf_set_member_integer(value, &xx1_str, stats->n1xx, 0);
-    nxt_conf_set_member_integer(value, &xx2_str, stats->n2xx, 1);
-    nxt_conf_set_member_integer(value, &xx3_str, stats->n3xx, 2);
-    nxt_conf_set_member_integer(value, &xx4_str, stats->n4xx, 3);
-    nxt_conf_set_member_integer(value, &xx5_str, stats->n5xx, 4);
-    nxt_conf_set_member_integer(value, &total_str, stats->total, 5);
+        if (ngx_http_ctrl_stats_key(mp, &key, keys[i].key, keys[i].len)
+            != NXT_OK)
+        {
+            return NULL;
+        }
 
-    ngx_shmtx_unlock(&shctx->shpool->mutex);
+        nxt_conf_set_member_string(entry, &key_str, &key, 0);
+        nxt_conf_set_member_integer(entry, &events_str, keys[i].events, 1);
+        nxt_conf_set_member_integer(entry, &rejected_str, keys[i].rejected,
+                                    2);
+
+        nxt_conf_set_element(top, i, entry);
+    }
+
+    value = nxt_conf_create_object(mp, 1);
+    if (nxt_slow_path(value == NULL)) {
+        return NULL;
+    }
+
+    nxt_conf_set_member(value, &top_str, top, 0);
 
     return value;
 }
+
+
+static int
+ngx_http_ctrl_stats_top_compare(const void *one, const void *two)
+{
+    const ngx_http_ctrl_stats_top_t  *first = one;
+    const ngx_http_ctrl_stats_top_t  *second = two;
+
+    if (first->events != second->events) {
+        return (first->events < second->events) ? 1 : -1;
+    }
+
+    return (first->rejected < second->rejected)
+           - (first->rejected > second->rejected);
+}
+
+
+/* The bytes of binary keys, like $binary_remote_addr, are shown as \xHH. */
+
+static nxt_int_t
+ngx_http_ctrl_stats_key(nxt_mp_t *mp, nxt_str_t *dst, u_char *src, size_t len)
+{
+    u_char  c, *p;
+    size_t  i;
+
+    static const u_char  hex[] = "0123456789abcdef";
+
+    p = nxt_mp_nget(mp, len * 4 + 1);
+    if (nxt_slow_path(p == NULL)) {
+        return NXT_ERROR;
+    }
+
+    dst->start = p;
+
+    for (i = 0; i < len; i++) {
+        c = src[i];
+
+        if (c >= 0x20 && c < 0x7f && c != '\\') {
+            *p++ = c;
+            continue;
+        }
+
+        *p++ = '\\';
+        *p++ = 'x';
+        *p++ = hex[c >> 4];
+        *p++ = hex[c & 0xf];
+    }
+
+    dst->length = p - dst->start;
+
+    return NXT_OK;
+}
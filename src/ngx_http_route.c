@@ -6,6 +6,10 @@
 
 #include <ngx_http_ctrl.h>
 
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+#include <zlib.h>
+#endif
+
 
 typedef enum {
     NGX_HTTP_ROUTE_TABLE = 0,
@@ -25,6 +29,9 @@ typedef enum {
     NGX_HTTP_ROUTE_PATTERN_MIDDLE,
     NGX_HTTP_ROUTE_PATTERN_END,
     NGX_HTTP_ROUTE_PATTERN_SUBSTRING,
+#if (NXT_HAVE_REGEX)
+    NGX_HTTP_ROUTE_PATTERN_REGEX,
+#endif
 } ngx_http_route_pattern_type_t;
 
 
@@ -41,6 +48,9 @@ typedef struct {
     uint32_t                       length1;
     uint32_t                       length2;
     uint32_t                       min_length;
+#if (NXT_HAVE_REGEX)
+    nxt_regex_t                    *regex;
+#endif
 
     ngx_http_route_pattern_type_t  type:8;
     uint8_t                        case_sensitive;  /* 1 bit */
@@ -49,10 +59,35 @@ typedef struct {
 } ngx_http_route_pattern_t;
 
 
+/*
+ * Large sets of substring patterns of a rule are compiled into
+ * an Aho-Corasick automaton which scans the subject once.
+ */
+
+#define NGX_HTTP_ROUTE_AUTOMATON_PATTERNS  8
+
+#define NGX_HTTP_ROUTE_FOUND_NEGATIVE      1
+#define NGX_HTTP_ROUTE_FOUND_POSITIVE      2
+
+
+typedef struct {
+    /*
+     * The transitions of the deterministic automaton.  An entry holds
+     * the offset of the next state row shifted left by two and the found
+     * flags of the next state in the low bits.
+     */
+    uint32_t                       *next;
+    uint8_t                        stop;
+    uint8_t                        positive;        /* 1 bit */
+    uint8_t                        map[256];
+} ngx_http_route_automaton_t;
+
+
 typedef struct {
     /* The object must be the first field. */
     ngx_http_route_object_t        object:8;
     uint32_t                       items;
+    ngx_http_route_automaton_t     *automaton;
 
     union {
         uintptr_t                  offset;
@@ -95,12 +130,106 @@ typedef struct {
 } ngx_http_route_match_t;
 
 
+typedef enum {
+    NGX_HTTP_ROUTE_INDEX_HOST = 0,
+    NGX_HTTP_ROUTE_INDEX_URI,
+} ngx_http_route_index_type_t;
+
+
+typedef struct {
+    uint32_t                       items;
+    uint32_t                       *index;
+} ngx_http_route_list_t;
+
+
+typedef struct {
+    nxt_lvlhsh_t                   hash;
+    ngx_http_route_list_t          rest;
+} ngx_http_route_index_t;
+
+
+typedef struct {
+    /* The key must be the first field. */
+    nxt_str_t                      key;
+    ngx_http_route_list_t          list;
+} ngx_http_route_index_entry_t;
+
+
+typedef struct {
+    /* The key must be the first field. */
+    nxt_str_t                      key;
+    ngx_http_route_index_t         uri;
+} ngx_http_route_host_t;
+
+
+/*
+ * A node of the reversed-label trie of "*.suffix" hosts, the children
+ * are keyed by the preceding label.  The list is used only while the
+ * trie is built, then its items keep the number of routes of the node
+ * and all its shorter suffixes, which are indexed by the uri together.
+ */
+
+typedef struct {
+    /* The key must be the first field. */
+    nxt_str_t                      key;
+    nxt_lvlhsh_t                   labels;
+    ngx_http_route_list_t          list;
+    ngx_http_route_index_t         uri;
+} ngx_http_route_suffix_t;
+
+
+/* The request headers indexed by the field hash. */
+
+struct ngx_http_route_fields_s {
+    uint32_t                       mask;
+    uint32_t                       *bucket;
+    uint32_t                       *next;
+    ngx_http_name_value_t          field[0];
+};
+
+
 struct ngx_http_routes_s {
+    nxt_lvlhsh_t                   hosts;
+    nxt_lvlhsh_t                   suffixes;
+    ngx_http_route_index_t         any_host;
     uint32_t                       items;
+    /* The routes depend only on the scheme, host, method, and uri. */
+    uint8_t                        cacheable;       /* 1 bit */
     ngx_http_route_match_t         *match[0];
 };
 
 
+/*
+ * The route decision cache of a worker process is a hash of the
+ * recently resolved request keys with the entries kept in the LRU order.
+ */
+
+#define NGX_HTTP_ROUTE_CACHE_KEY       192
+
+
+typedef struct {
+    nxt_queue_link_t               link;
+    uint32_t                       hash;
+    /* The next entry in the bucket, 1-based. */
+    uint32_t                       next;
+    ngx_http_action_t              *action;
+    uint32_t                       length;
+    u_char                         key[NGX_HTTP_ROUTE_CACHE_KEY];
+} ngx_http_route_cache_entry_t;
+
+
+struct ngx_http_route_cache_s {
+    uint64_t                       generation;
+    uint32_t                       size;
+    uint32_t                       used;
+    uint32_t                       mask;
+    uint32_t                       *bucket;
+    nxt_queue_t                    lru;
+    ngx_http_route_cache_stats_t   *stats;
+    ngx_http_route_cache_entry_t   entry[0];
+};
+
+
 static ngx_http_route_match_t *ngx_http_route_match_create(ngx_http_conf_t *conf,
     nxt_conf_value_t *cv);
 static ngx_http_route_table_t *ngx_http_route_table_create(ngx_http_conf_t *conf,
@@ -117,13 +246,75 @@ static ngx_http_route_rule_t *ngx_http_route_rule_create(ngx_http_conf_t *conf,
     nxt_conf_value_t *cv, nxt_bool_t case_sensitive,
     ngx_http_route_pattern_case_t pattern_case);
 static int nxt_http_pattern_compare(const void *one, const void *two);
+static nxt_int_t ngx_http_route_automaton_create(nxt_mp_t *mp,
+    ngx_http_route_rule_t *rule);
 static nxt_int_t ngx_http_route_pattern_create(nxt_mp_t *mp,
     nxt_conf_value_t *cv, ngx_http_route_pattern_t *pattern,
     ngx_http_route_pattern_case_t pattern_case);
+#if (NXT_HAVE_REGEX)
+static nxt_int_t ngx_http_route_pattern_regex(nxt_mp_t *mp, nxt_str_t *test,
+    ngx_http_route_pattern_t *pattern,
+    ngx_http_route_pattern_case_t pattern_case);
+#endif
 static u_char *ngx_http_route_pattern_copy(nxt_mp_t *mp, nxt_str_t *test,
     ngx_http_route_pattern_case_t pattern_case);
 static nxt_int_t ngx_http_route_action_create(ngx_http_conf_t *conf,
     nxt_conf_value_t *cv, ngx_http_route_match_t *match);
+static ngx_http_action_variables_t *ngx_http_route_action_variables(
+    ngx_http_conf_t *conf, nxt_conf_value_t *cv);
+static ngx_http_action_headers_t *ngx_http_route_action_headers(nxt_mp_t *mp,
+    nxt_conf_value_t *cv);
+static nxt_int_t ngx_http_route_action_key(ngx_http_conf_t *conf,
+    nxt_str_t *src, ngx_http_action_key_t *key);
+static nxt_int_t ngx_http_route_action_key_variable(ngx_http_conf_t *conf,
+    ngx_http_action_key_part_t *part, u_char *name, size_t length);
+static ngx_http_variable_t *ngx_http_route_variable(ngx_cycle_t *cycle,
+    u_char *low, size_t length, ngx_uint_t hash, nxt_bool_t *prefix);
+static ngx_http_action_response_t *ngx_http_route_action_response(
+    nxt_mp_t *mp, ngx_http_action_t *action, nxt_str_t *type,
+    nxt_bool_t gzip);
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+static nxt_int_t ngx_http_route_action_gzip(nxt_mp_t *mp,
+    ngx_http_action_response_t *response, nxt_str_t *text);
+#endif
+static ngx_http_action_addr_t *ngx_http_route_action_addr(
+    ngx_http_conf_t *conf, nxt_mp_t *mp, nxt_conf_value_t *cv);
+static nxt_int_t ngx_http_routes_compile(ngx_http_conf_t *conf,
+    ngx_http_routes_t *routes);
+static nxt_int_t ngx_http_route_index_create(nxt_mp_t *mp,
+    ngx_http_routes_t *routes, ngx_http_route_list_t *list,
+    ngx_http_route_index_type_t type, ngx_http_route_index_t *index);
+static nxt_int_t ngx_http_route_suffixes_create(ngx_http_conf_t *conf,
+    nxt_mp_t *mp, ngx_http_routes_t *routes, ngx_http_route_list_t *list);
+static ngx_http_route_suffix_t *ngx_http_route_suffix_add(nxt_mp_t *mp,
+    nxt_lvlhsh_t *labels, ngx_http_route_pattern_t *pattern);
+static nxt_int_t ngx_http_route_suffix_alloc(nxt_mp_t *mp,
+    nxt_lvlhsh_t *labels);
+static nxt_int_t ngx_http_route_suffix_compile(ngx_http_conf_t *conf,
+    nxt_mp_t *mp, ngx_http_routes_t *routes, nxt_lvlhsh_t *labels,
+    ngx_http_route_list_t *shorter);
+static ngx_http_route_rule_t *ngx_http_route_index_rule(
+    ngx_http_route_match_t *match, ngx_http_route_index_type_t type);
+static nxt_bool_t ngx_http_route_suffix_pattern(
+    ngx_http_route_pattern_t *pattern);
+static nxt_bool_t ngx_http_route_cacheable(ngx_http_route_match_t *match);
+static nxt_int_t ngx_http_route_index_key(ngx_http_route_pattern_t *pattern,
+    ngx_http_route_index_type_t type, nxt_str_t *key);
+static void *ngx_http_route_index_add(nxt_mp_t *mp, nxt_lvlhsh_t *hash,
+    nxt_str_t *key, size_t size);
+static void *ngx_http_route_index_find(nxt_lvlhsh_t *hash, nxt_str_t *key,
+    uint32_t key_hash);
+static nxt_int_t ngx_http_route_list_alloc(nxt_mp_t *mp,
+    ngx_http_route_list_t *list);
+static void ngx_http_route_list_add(ngx_http_route_list_t *list, uint32_t n);
+static nxt_int_t ngx_http_route_list_merge(nxt_mp_t *mp,
+    ngx_http_route_list_t *one, ngx_http_route_list_t *two,
+    ngx_http_route_list_t *list);
+static size_t ngx_http_route_uri_segment(u_char *start, size_t length);
+static nxt_int_t ngx_http_route_index_test(nxt_lvlhsh_query_t *lhq,
+    void *data);
+static void *ngx_http_route_index_alloc(void *data, size_t size);
+static void ngx_http_route_index_free(void *data, void *p);
 
 static ngx_http_action_t *ngx_http_route_match(ngx_http_request_t *r,
     ngx_http_route_match_t *match);
@@ -137,22 +328,62 @@ static nxt_int_t ngx_http_route_headers(ngx_http_request_t *r,
     ngx_http_route_rule_t *rule);
 static nxt_int_t ngx_http_route_arguments(ngx_http_request_t *r,
     ngx_http_route_rule_t *rule);
+static nxt_int_t ngx_http_route_cookies(ngx_http_request_t *r,
+    ngx_http_route_rule_t *rule);
+static nxt_int_t ngx_http_route_name_values(nxt_array_t *array,
+    ngx_http_route_rule_t *rule);
 static nxt_int_t ngx_http_route_scheme(ngx_http_request_t *r,
     ngx_http_route_rule_t *rule);
 static nxt_int_t ngx_http_route_host(ngx_http_request_t *r,
     ngx_http_route_rule_t *rule);
 static nxt_int_t ngx_http_route_test_rule(ngx_http_route_rule_t *rule,
     u_char *start, size_t length);
+static nxt_int_t ngx_http_route_test_automaton(ngx_http_route_rule_t *rule,
+    u_char *start, size_t length);
+static nxt_uint_t ngx_http_route_automaton(ngx_http_route_automaton_t *ac,
+    u_char *start, size_t length);
 static nxt_int_t ngx_http_route_pattern(ngx_http_route_pattern_t *pattern,
     u_char *start, size_t length);
 static nxt_int_t ngx_http_route_memcmp(u_char *start, u_char *test,
     size_t length, nxt_bool_t case_sensitive);
+#if (NXT_HAVE_REGEX)
+static nxt_int_t ngx_http_route_regex(nxt_regex_t *regex, u_char *start,
+    size_t length);
+#endif
+static ngx_http_route_suffix_t *ngx_http_route_suffix_find(
+    nxt_lvlhsh_t *labels, nxt_str_t *host);
+static size_t ngx_http_route_cache_key(ngx_http_request_t *r, u_char *key);
+static void ngx_http_route_cache_flush(ngx_http_route_cache_t *cache,
+    uint64_t generation);
+static void ngx_http_route_cache_unlink(ngx_http_route_cache_t *cache,
+    ngx_http_route_cache_entry_t *entry);
+static nxt_uint_t ngx_http_route_index_lists(ngx_http_route_index_t *index,
+    nxt_str_t *segment, uint32_t hash, ngx_http_route_list_t *lists);
+static ngx_http_route_fields_t *ngx_http_route_headers_index(
+    ngx_http_request_t *r);
 static nxt_array_t *ngx_http_arguments_parse(ngx_http_request_t *r);
+static nxt_array_t *ngx_http_cookies_parse(ngx_http_request_t *r);
+static nxt_int_t ngx_http_cookie_parse(nxt_array_t *cookies, u_char *start,
+    u_char *end);
+
+
+static const nxt_lvlhsh_proto_t  ngx_http_route_index_proto  nxt_aligned(64) = {
+    NXT_LVLHSH_DEFAULT,
+    ngx_http_route_index_test,
+    ngx_http_route_index_alloc,
+    ngx_http_route_index_free,
+};
+
 
+/*
+ * The hashes of the request data are keyed.  The index keys use 32 bits,
+ * the names of the headers, arguments, and cookies keep 16 bits.
+ */
 
-#define NGX_HTTP_FIELD_HASH_INIT        159406U
-#define ngx_http_field_hash_char(h, c)  (((h) << 4) + (h) + (c))
-#define ngx_http_field_hash_end(h)      (((h) >> 16) ^ (h))
+#define ngx_http_route_hash(p, n)         ((uint32_t) nxt_wy_hash(p, n))
+#define ngx_http_field_hash(p, n)         ((uint16_t) nxt_wy_hash(p, n))
+#define ngx_http_field_hash_lowcase(p, n)                                     \
+    ((uint16_t) nxt_wy_hash_lowcase(p, n))
 
 
 ngx_http_routes_t *
@@ -173,6 +404,7 @@ ngx_http_routes_create(ngx_http_conf_t *conf, nxt_conf_value_t *routes_conf)
     }
 
     routes->items = n;
+    routes->cacheable = 1;
     m = &routes->match[0];
 
     for (i = 0; i < n; i++) {
@@ -183,363 +415,438 @@ ngx_http_routes_create(ngx_http_conf_t *conf, nxt_conf_value_t *routes_conf)
             return NULL;
         }
 
+        if (!ngx_http_route_cacheable(match)) {
+            routes->cacheable = 0;
+        }
+
         *m++ = match;
     }
 
+    if (ngx_http_routes_compile(conf, routes) != NXT_OK) {
+        return NULL;
+    }
+
     return routes;
 }
 
 
-typedef struct {
-    nxt_conf_value_t               *host;
-    nxt_conf_value_t               *uri;
-    nxt_conf_value_t               *method;
-    nxt_conf_value_t               *headers;
-    nxt_conf_value_t               *arguments;
-    nxt_conf_value_t               *scheme;
-} ngx_http_route_match_conf_t;
+/*
+ * The routes are dispatched first by an exact or "*.suffix" host and then
+ * by the first segment of an exact or prefix uri.  Routes that cannot be
+ * indexed on a layer are kept in its "rest" list.  All lists hold route
+ * numbers in ascending order, so a request merges the few lists it hits
+ * and tests the candidates in the configuration order, preserving the
+ * first match.
+ */
 
+static nxt_int_t
+ngx_http_routes_compile(ngx_http_conf_t *conf, ngx_http_routes_t *routes)
+{
+    uint32_t                      i;
+    nxt_mp_t                      *mp;
+    nxt_int_t                     ret;
+    nxt_lvlhsh_each_t             lhe;
+    ngx_http_route_list_t         list;
+    ngx_http_route_host_t         *host;
+    ngx_http_route_index_t        hosts;
+    ngx_http_route_index_entry_t  *entry;
+
+    nxt_lvlhsh_init(&routes->hosts);
+    nxt_lvlhsh_init(&routes->suffixes);
+    nxt_memzero(&routes->any_host, sizeof(ngx_http_route_index_t));
+
+    if (routes->items == 0) {
+        return NXT_OK;
+    }
 
-static nxt_conf_map_t  ngx_http_route_match_conf[] = {
-    {
-        nxt_string("scheme"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, scheme)
-    },
-    {
-        nxt_string("host"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, host),
-    },
+    mp = nxt_mp_create(1024, 128, 256, 32);
+    if (nxt_slow_path(mp == NULL)) {
+        return NXT_ERROR;
+    }
 
-    {
-        nxt_string("uri"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, uri),
-    },
+    ret = NXT_ERROR;
 
-    {
-        nxt_string("method"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, method),
-    },
+    list.items = routes->items;
+    list.index = nxt_mp_alloc(mp, routes->items * sizeof(uint32_t));
+    if (nxt_slow_path(list.index == NULL)) {
+        goto done;
+    }
 
-    {
-        nxt_string("headers"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, headers),
-    },
+    for (i = 0; i < routes->items; i++) {
+        list.index[i] = i;
+    }
 
-    {
-        nxt_string("arguments"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_match_conf_t, arguments),
-    },
-};
+    ret = ngx_http_route_index_create(mp, routes, &list,
+                                      NGX_HTTP_ROUTE_INDEX_HOST, &hosts);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        goto done;
+    }
 
+    nxt_lvlhsh_each_init(&lhe, &ngx_http_route_index_proto);
 
-static ngx_http_route_match_t *
-ngx_http_route_match_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv)
-{
-    size_t                       size;
-    uint32_t                     n;
-    nxt_int_t                    ret;
-    nxt_conf_value_t             *match_conf;
-    ngx_http_route_test_t        *test;
-    ngx_http_route_rule_t        *rule;
-    ngx_http_route_table_t       *table;
-    ngx_http_route_match_t       *match;
-    ngx_http_route_match_conf_t  mtcf;
+    for ( ;; ) {
+        entry = nxt_lvlhsh_each(&hosts.hash, &lhe);
 
-    static nxt_str_t  match_path = nxt_string("/match");
+        if (entry == NULL) {
+            break;
+        }
 
-    match_conf = nxt_conf_get_path(cv, &match_path);
+        host = ngx_http_route_index_add(conf->pool, &routes->hosts,
+                                        &entry->key,
+                                        sizeof(ngx_http_route_host_t));
+        if (nxt_slow_path(host == NULL)) {
+            ret = NXT_ERROR;
+            goto done;
+        }
 
-    n = (match_conf != NULL) ? nxt_conf_object_members_count(match_conf) : 0;
-    size = sizeof(ngx_http_route_match_t) + n * sizeof(ngx_http_route_rule_t *);
+        ret = ngx_http_route_index_create(conf->pool, routes, &entry->list,
+                                          NGX_HTTP_ROUTE_INDEX_URI,
+                                          &host->uri);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            goto done;
+        }
+    }
 
-    match = nxt_mp_zalloc(conf->pool, size);
-    if (nxt_slow_path(match == NULL)) {
-        return NULL;
+    ret = ngx_http_route_suffixes_create(conf, mp, routes, &list);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        goto done;
     }
 
-    match->items = n;
+    ret = ngx_http_route_index_create(conf->pool, routes, &hosts.rest,
+                                      NGX_HTTP_ROUTE_INDEX_URI,
+                                      &routes->any_host);
 
-    if (n == 0) {
-        goto action_create;
-    }
+done:
 
-    nxt_memzero(&mtcf, sizeof(mtcf));
+    nxt_mp_destroy(mp);
 
-    ret = nxt_conf_map_object(conf->pool, match_conf, ngx_http_route_match_conf,
-                              nxt_nitems(ngx_http_route_match_conf), &mtcf);
-    if (ret != NXT_OK) {
-        return NULL;
-    }
+    return ret;
+}
 
-    test = &match->test[0];
 
-    if (mtcf.scheme != NULL) {
-        rule = ngx_http_route_rule_create(conf, mtcf.scheme, 1,
-                                          NGX_HTTP_ROUTE_PATTERN_NOCASE);
-        if (rule == NULL) {
-            return NULL;
-        }
+static nxt_int_t
+ngx_http_route_index_create(nxt_mp_t *mp, ngx_http_routes_t *routes,
+    ngx_http_route_list_t *list, ngx_http_route_index_type_t type,
+    ngx_http_route_index_t *index)
+{
+    uint32_t                      i, k, n;
+    nxt_str_t                     key;
+    nxt_lvlhsh_each_t             lhe;
+    ngx_http_route_rule_t         *rule;
+    ngx_http_route_index_entry_t  *entry;
 
-        rule->object = NGX_HTTP_ROUTE_SCHEME;
-        test->rule = rule;
-        test++;
-    }
+    nxt_lvlhsh_init(&index->hash);
+    index->rest.items = 0;
 
-    if (mtcf.uri != NULL) {
-        rule = ngx_http_route_rule_create(conf, mtcf.uri, 1,
-                                          NGX_HTTP_ROUTE_PATTERN_NOCASE);
-        if (rule == NULL) {
-            return NULL;
-        }
+    /* The first pass counts routes per key. */
 
-        rule->u.offset = offsetof(ngx_http_request_t, uri);
-        rule->object = NGX_HTTP_ROUTE_STRING;
-        test->rule = rule;
-        test++;
-    }
+    for (i = 0; i < list->items; i++) {
+        rule = ngx_http_route_index_rule(routes->match[list->index[i]], type);
 
-    if (mtcf.method != NULL) {
-        rule = ngx_http_route_rule_create(conf, mtcf.method, 1,
-                                          NGX_HTTP_ROUTE_PATTERN_UPCASE);
         if (rule == NULL) {
-            return NULL;
+            index->rest.items++;
+            continue;
         }
 
-        rule->u.offset = offsetof(ngx_http_request_t, method_name);
-        rule->object = NGX_HTTP_ROUTE_STRING;
-        test->rule = rule;
-        test++;
-    }
+        for (k = 0; k < rule->items; k++) {
+            if (ngx_http_route_index_key(&rule->pattern[k], type, &key)
+                != NXT_OK)
+            {
+                continue;
+            }
 
-    if (mtcf.host != NULL) {
-        rule = ngx_http_route_rule_create(conf, mtcf.host, 1,
-                                          NGX_HTTP_ROUTE_PATTERN_LOWCASE);
-        if (rule == NULL) {
-            return NULL;
+            entry = ngx_http_route_index_add(mp, &index->hash, &key,
+                                         sizeof(ngx_http_route_index_entry_t));
+            if (nxt_slow_path(entry == NULL)) {
+                return NXT_ERROR;
+            }
+
+            entry->list.items++;
         }
+    }
 
-        rule->object = NGX_HTTP_ROUTE_HOST;
-        test->rule = rule;
-        test++;
+    if (nxt_slow_path(ngx_http_route_list_alloc(mp, &index->rest) != NXT_OK)) {
+        return NXT_ERROR;
     }
 
-    if (mtcf.headers != NULL) {
-        table = ngx_http_route_table_create(conf, mtcf.headers,
-                                            NGX_HTTP_ROUTE_HEADER, 0);
-        if (table == NULL) {
-            return NULL;
+    nxt_lvlhsh_each_init(&lhe, &ngx_http_route_index_proto);
+
+    for ( ;; ) {
+        entry = nxt_lvlhsh_each(&index->hash, &lhe);
+
+        if (entry == NULL) {
+            break;
         }
 
-        test->table = table;
-        test++;
+        if (nxt_slow_path(ngx_http_route_list_alloc(mp, &entry->list)
+                          != NXT_OK))
+        {
+            return NXT_ERROR;
+        }
     }
 
-    if (mtcf.arguments != NULL) {
-        table = ngx_http_route_table_create(conf, mtcf.arguments,
-                                            NGX_HTTP_ROUTE_ARGUMENT, 1);
-        if (table == NULL) {
-            return NULL;
+    /* The second pass fills the lists in the routes order. */
+
+    for (i = 0; i < list->items; i++) {
+        n = list->index[i];
+        rule = ngx_http_route_index_rule(routes->match[n], type);
+
+        if (rule == NULL) {
+            ngx_http_route_list_add(&index->rest, n);
+            continue;
         }
 
-        test->table = table;
-        test++;
-    }
+        for (k = 0; k < rule->items; k++) {
+            if (ngx_http_route_index_key(&rule->pattern[k], type, &key)
+                != NXT_OK)
+            {
+                continue;
+            }
 
-action_create:
+            entry = ngx_http_route_index_find(&index->hash, &key,
+                                              ngx_http_route_hash(key.start,
+                                                                  key.length));
 
-    ret = ngx_http_route_action_create(conf, cv, match);
-    if (nxt_slow_path(ret != NXT_OK)) {
-        return NULL;
+            ngx_http_route_list_add(&entry->list, n);
+        }
     }
 
-    return match;
+    return NXT_OK;
 }
 
 
-static ngx_http_route_table_t *
-ngx_http_route_table_create(ngx_http_conf_t *conf, nxt_conf_value_t *table_cv,
-    ngx_http_route_object_t object, nxt_bool_t case_sensitive)
+static nxt_int_t
+ngx_http_route_suffixes_create(ngx_http_conf_t *conf, nxt_mp_t *mp,
+    ngx_http_routes_t *routes, ngx_http_route_list_t *list)
 {
-    size_t                    size;
-    uint32_t                  i, n;
-    nxt_bool_t                array;
-    nxt_conf_value_t          *ruleset_cv;
-    ngx_http_route_table_t    *table;
-    ngx_http_route_ruleset_t  *ruleset;
+    uint32_t                  i, k, n;
+    nxt_uint_t                pass;
+    ngx_http_route_rule_t     *rule;
+    ngx_http_route_suffix_t   *node;
+    ngx_http_route_list_t     shorter;
+    ngx_http_route_pattern_t  *pattern;
 
-    array = (nxt_conf_type(table_cv) == NXT_CONF_ARRAY);
-    n = array ? nxt_conf_array_elements_count(table_cv) : 1;
-    size = sizeof(ngx_http_route_table_t)
-           + n * sizeof(ngx_http_route_ruleset_t *);
+    /* The first pass counts routes per suffix, the second one fills. */
 
-    table = nxt_mp_alloc(conf->pool, size);
-    if (nxt_slow_path(table == NULL)) {
-        return NULL;
-    }
+    for (pass = 0; pass < 2; pass++) {
 
-    table->items = n;
-    table->object = NGX_HTTP_ROUTE_TABLE;
+        for (i = 0; i < list->items; i++) {
+            n = list->index[i];
+            rule = ngx_http_route_index_rule(routes->match[n],
+                                             NGX_HTTP_ROUTE_INDEX_HOST);
+            if (rule == NULL) {
+                continue;
+            }
 
-    if (!array) {
-        ruleset = ngx_http_route_ruleset_create(conf, table_cv, object,
-                                                case_sensitive);
-        if (nxt_slow_path(ruleset == NULL)) {
-            return NULL;
-        }
+            for (k = 0; k < rule->items; k++) {
+                pattern = &rule->pattern[k];
 
-        table->ruleset[0] = ruleset;
+                if (!ngx_http_route_suffix_pattern(pattern)) {
+                    continue;
+                }
 
-        return table;
-    }
+                node = ngx_http_route_suffix_add(conf->pool,
+                                                 &routes->suffixes, pattern);
+                if (nxt_slow_path(node == NULL)) {
+                    return NXT_ERROR;
+                }
 
-    for (i = 0; i < n; i++) {
-        ruleset_cv = nxt_conf_get_array_element(table_cv, i);
+                if (pass == 0) {
+                    node->list.items++;
 
-        ruleset = ngx_http_route_ruleset_create(conf, ruleset_cv, object,
-                                                case_sensitive);
-        if (nxt_slow_path(ruleset == NULL)) {
-            return NULL;
+                } else {
+                    ngx_http_route_list_add(&node->list, n);
+                }
+            }
         }
 
-        table->ruleset[i] = ruleset;
+        if (pass == 0
+            && ngx_http_route_suffix_alloc(mp, &routes->suffixes) != NXT_OK)
+        {
+            return NXT_ERROR;
+        }
     }
 
-    return table;
+    shorter.items = 0;
+    shorter.index = NULL;
+
+    return ngx_http_route_suffix_compile(conf, mp, routes, &routes->suffixes,
+                                         &shorter);
 }
 
 
-static ngx_http_route_ruleset_t *
-ngx_http_route_ruleset_create(ngx_http_conf_t *conf, nxt_conf_value_t *ruleset_cv,
-    ngx_http_route_object_t object, nxt_bool_t case_sensitive)
+static ngx_http_route_suffix_t *
+ngx_http_route_suffix_add(nxt_mp_t *mp, nxt_lvlhsh_t *labels,
+    ngx_http_route_pattern_t *pattern)
 {
-    size_t                    size;
-    uint32_t                  i, n, next;
-    nxt_str_t                 name;
-    nxt_conf_value_t          *rule_cv;
-    ngx_http_route_rule_t     *rule;
-    ngx_http_route_ruleset_t  *ruleset;
+    u_char                   *p, *end;
+    nxt_str_t                label;
+    ngx_http_route_suffix_t  *node;
 
-    n = nxt_conf_object_members_count(ruleset_cv);
-    size = sizeof(ngx_http_route_ruleset_t)
-           + n * sizeof(ngx_http_route_rule_t *);
+    /* The suffix starts with a dot, so the labels are taken from the end. */
 
-    ruleset = nxt_mp_alloc(conf->pool, size);
-    if (nxt_slow_path(ruleset == NULL)) {
-        return NULL;
-    }
+    p = pattern->start1 + pattern->length1;
 
-    ruleset->items = n;
+    for ( ;; ) {
+        end = p;
 
-    next = 0;
+        while (p[-1] != '.') {
+            p--;
+        }
 
-    for (i = 0; i < n; i++) {
-        rule_cv = nxt_conf_next_object_member(ruleset_cv, &name, &next);
+        label.start = p;
+        label.length = end - p;
 
-        rule = ngx_http_route_rule_name_create(conf, rule_cv, &name,
-                                               case_sensitive);
-        if (nxt_slow_path(rule == NULL)) {
+        node = ngx_http_route_index_add(mp, labels, &label,
+                                        sizeof(ngx_http_route_suffix_t));
+        if (nxt_slow_path(node == NULL)) {
             return NULL;
         }
 
-        rule->object = object;
-        ruleset->rule[i] = rule;
-    }
+        p--;
 
-    return ruleset;
+        if (p == pattern->start1) {
+            return node;
+        }
+
+        labels = &node->labels;
+    }
 }
 
 
-static ngx_http_route_rule_t *
-ngx_http_route_rule_name_create(ngx_http_conf_t *conf, nxt_conf_value_t *rule_cv,
-    nxt_str_t *name, nxt_bool_t case_sensitive)
+static nxt_int_t
+ngx_http_route_suffix_alloc(nxt_mp_t *mp, nxt_lvlhsh_t *labels)
 {
-    u_char                 c, *p;
-    uint32_t               hash;
-    nxt_uint_t             i;
-    ngx_http_route_rule_t  *rule;
+    nxt_lvlhsh_each_t        lhe;
+    ngx_http_route_suffix_t  *node;
 
-    rule = ngx_http_route_rule_create(conf, rule_cv, case_sensitive,
-                                      NGX_HTTP_ROUTE_PATTERN_NOCASE);
-    if (nxt_slow_path(rule == NULL)) {
-        return NULL;
-    }
+    nxt_lvlhsh_each_init(&lhe, &ngx_http_route_index_proto);
 
-    rule->u.name.length = name->length;
+    for ( ;; ) {
+        node = nxt_lvlhsh_each(labels, &lhe);
 
-    p = nxt_mp_nget(conf->pool, name->length);
-    if (nxt_slow_path(p == NULL)) {
-        return NULL;
+        if (node == NULL) {
+            return NXT_OK;
+        }
+
+        if (nxt_slow_path(ngx_http_route_list_alloc(mp, &node->list)
+                          != NXT_OK))
+        {
+            return NXT_ERROR;
+        }
+
+        if (nxt_slow_path(ngx_http_route_suffix_alloc(mp, &node->labels)
+                          != NXT_OK))
+        {
+            return NXT_ERROR;
+        }
     }
+}
 
-    rule->u.name.start = p;
 
-    hash = NGX_HTTP_FIELD_HASH_INIT;
+static nxt_int_t
+ngx_http_route_suffix_compile(ngx_http_conf_t *conf, nxt_mp_t *mp,
+    ngx_http_routes_t *routes, nxt_lvlhsh_t *labels,
+    ngx_http_route_list_t *shorter)
+{
+    nxt_int_t                ret;
+    nxt_lvlhsh_each_t        lhe;
+    ngx_http_route_list_t    list;
+    ngx_http_route_suffix_t  *node;
 
-    for (i = 0; i < name->length; i++) {
-        c = name->start[i];
-        *p++ = c;
+    nxt_lvlhsh_each_init(&lhe, &ngx_http_route_index_proto);
 
-        c = case_sensitive ? c : nxt_lowcase(c);
-        hash = ngx_http_field_hash_char(hash, c);
-    }
+    for ( ;; ) {
+        node = nxt_lvlhsh_each(labels, &lhe);
+
+        if (node == NULL) {
+            return NXT_OK;
+        }
 
-    rule->u.name.hash = ngx_http_field_hash_end(hash) & 0xFFFF;
+        /* A host that matches the suffix matches all its shorter ones. */
 
-    return rule;
+        ret = ngx_http_route_list_merge(mp, shorter, &node->list, &list);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return NXT_ERROR;
+        }
+
+        if (list.items != 0) {
+            ret = ngx_http_route_index_create(conf->pool, routes, &list,
+                                              NGX_HTTP_ROUTE_INDEX_URI,
+                                              &node->uri);
+            if (nxt_slow_path(ret != NXT_OK)) {
+                return NXT_ERROR;
+            }
+        }
+
+        ret = ngx_http_route_suffix_compile(conf, mp, routes, &node->labels,
+                                            &list);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return NXT_ERROR;
+        }
+
+        node->list.items = list.items;
+        node->list.index = NULL;
+    }
 }
 
 
 static ngx_http_route_rule_t *
-ngx_http_route_rule_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv,
-    nxt_bool_t case_sensitive, ngx_http_route_pattern_case_t pattern_case)
+ngx_http_route_index_rule(ngx_http_route_match_t *match,
+    ngx_http_route_index_type_t type)
 {
-    size_t                    size;
-    uint32_t                  i, n;
-    nxt_int_t                 ret;
-    nxt_bool_t                string;
-    nxt_conf_value_t          *value;
+    uint32_t                  i;
     ngx_http_route_rule_t     *rule;
-    ngx_http_route_pattern_t  *pattern;
+    ngx_http_route_pattern_t  *pattern, *end;
 
-    string = (nxt_conf_type(cv) != NXT_CONF_ARRAY);
-    n = string ? 1 : nxt_conf_array_elements_count(cv);
-    size = sizeof(ngx_http_route_rule_t) + n * sizeof(ngx_http_route_pattern_t);
+    for (i = 0; i < match->items; i++) {
+        rule = match->test[i].rule;
 
-    rule = nxt_mp_alloc(conf->pool, size);
-    if (nxt_slow_path(rule == NULL)) {
+        if (type == NGX_HTTP_ROUTE_INDEX_HOST) {
+            if (rule->object == NGX_HTTP_ROUTE_HOST) {
+                goto found;
+            }
+
+        } else if (rule->object == NGX_HTTP_ROUTE_STRING
+                   && rule->u.offset == offsetof(ngx_http_request_t, uri))
+        {
+            goto found;
+        }
+    }
+
+    return NULL;
+
+found:
+
+    /* An empty rule matches everything. */
+
+    if (rule->items == 0 || rule->automaton != NULL) {
         return NULL;
     }
 
-    rule->items = n;
+    end = &rule->pattern[rule->items];
 
-    pattern = &rule->pattern[0];
+    for (pattern = &rule->pattern[0]; pattern < end; pattern++) {
 
-    if (string) {
-        pattern[0].case_sensitive = case_sensitive;
-        ret = ngx_http_route_pattern_create(conf->pool, cv, &pattern[0],
-                                            pattern_case);
-        if (nxt_slow_path(ret != NXT_OK)) {
+        if (pattern->negative || !pattern->case_sensitive) {
             return NULL;
         }
 
-        return rule;
-    }
-
-    nxt_conf_array_qsort(cv, nxt_http_pattern_compare);
+        if (pattern->type == NGX_HTTP_ROUTE_PATTERN_EXACT) {
+            continue;
+        }
 
-    for (i = 0; i < n; i++) {
-        pattern[i].case_sensitive = case_sensitive;
-        value = nxt_conf_get_array_element(cv, i);
+        if (type == NGX_HTTP_ROUTE_INDEX_HOST) {
+            if (!ngx_http_route_suffix_pattern(pattern)) {
+                return NULL;
+            }
 
-        ret = ngx_http_route_pattern_create(conf->pool, value, &pattern[i],
-                                            pattern_case);
-        if (nxt_slow_path(ret != NXT_OK)) {
+        } else if (pattern->type != NGX_HTTP_ROUTE_PATTERN_BEGIN
+                   || ngx_http_route_uri_segment(pattern->start1,
+                                                 pattern->length1)
+                      == pattern->length1)
+        {
+            /* The prefix must cover the whole first segment. */
             return NULL;
         }
     }
@@ -548,532 +855,2165 @@ ngx_http_route_rule_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv,
 }
 
 
-static int
-nxt_http_pattern_compare(const void *one, const void *two)
+static nxt_bool_t
+ngx_http_route_suffix_pattern(ngx_http_route_pattern_t *pattern)
 {
-    nxt_str_t         test;
-    nxt_bool_t        negative1, negative2;
-    nxt_conf_value_t  *value;
-
-    value = (nxt_conf_value_t *) one;
-    nxt_conf_get_string(value, &test);
-    negative1 = (test.length != 0 && test.start[0] == '!');
-
-    value = (nxt_conf_value_t *) two;
-    nxt_conf_get_string(value, &test);
-    negative2 = (test.length != 0 && test.start[0] == '!');
+    /* "*.example.com" */
 
-    return (negative2 - negative1);
+    return (pattern->type == NGX_HTTP_ROUTE_PATTERN_END
+            && pattern->length1 != 0
+            && pattern->start1[0] == '.');
 }
 
 
-static nxt_int_t
-ngx_http_route_pattern_create(nxt_mp_t *mp, nxt_conf_value_t *cv,
-    ngx_http_route_pattern_t *pattern, ngx_http_route_pattern_case_t pattern_case)
+static nxt_bool_t
+ngx_http_route_cacheable(ngx_http_route_match_t *match)
 {
-    u_char                         *start;
-    nxt_str_t                      test;
-    nxt_uint_t                     n, length;
-    ngx_http_route_pattern_type_t  type;
-
-    /* Suppress warning about uninitialized variable. */
-    length = 0;
+    uint32_t               i;
+    ngx_http_route_rule_t  *rule;
 
-    type = NGX_HTTP_ROUTE_PATTERN_EXACT;
+    for (i = 0; i < match->items; i++) {
+        rule = match->test[i].rule;
 
-    nxt_conf_get_string(cv, &test);
+        switch (rule->object) {
 
-    pattern->negative = 0;
-    pattern->any = 1;
+        case NGX_HTTP_ROUTE_HOST:
+        case NGX_HTTP_ROUTE_SCHEME:
+            break;
 
-    if (test.length != 0) {
+        case NGX_HTTP_ROUTE_STRING:
+            if (rule->u.offset == offsetof(ngx_http_request_t, uri)
+                || rule->u.offset == offsetof(ngx_http_request_t, method_name))
+            {
+                break;
+            }
 
-        if (test.start[0] == '!') {
-            test.start++;
-            test.length--;
+            return 0;
 
-            pattern->negative = 1;
-            pattern->any = 0;
+        default:
+            return 0;
         }
+    }
 
-        if (test.length != 0) {
+    return 1;
+}
 
-            if (test.start[0] == '*') {
-                test.start++;
-                test.length--;
 
-                if (test.length != 0) {
-                    if (test.start[test.length - 1] == '*') {
-                        test.length--;
-                        type = NGX_HTTP_ROUTE_PATTERN_SUBSTRING;
+static nxt_int_t
+ngx_http_route_index_key(ngx_http_route_pattern_t *pattern,
+    ngx_http_route_index_type_t type, nxt_str_t *key)
+{
+    key->start = pattern->start1;
+    key->length = pattern->length1;
 
-                    } else {
-                        type = NGX_HTTP_ROUTE_PATTERN_END;
-                    }
+    if (type == NGX_HTTP_ROUTE_INDEX_URI) {
+        key->length = ngx_http_route_uri_segment(key->start, key->length);
 
-                } else {
-                    type = NGX_HTTP_ROUTE_PATTERN_BEGIN;
-                }
+    } else if (pattern->type != NGX_HTTP_ROUTE_PATTERN_EXACT) {
+        /* The suffixes are indexed by the trie. */
+        return NXT_DECLINED;
+    }
 
-            } else if (test.start[test.length - 1] == '*') {
-                test.length--;
-                type = NGX_HTTP_ROUTE_PATTERN_BEGIN;
+    return NXT_OK;
+}
 
-            } else {
-                length = test.length - 1;
 
-                for (n = 1; n < length; n++) {
-                    if (test.start[n] == '*') {
-                        test.length = n;
-                        type = NGX_HTTP_ROUTE_PATTERN_MIDDLE;
-                        break;
-                    }
-                }
-            }
-        }
+static void *
+ngx_http_route_index_add(nxt_mp_t *mp, nxt_lvlhsh_t *hash, nxt_str_t *key,
+    size_t size)
+{
+    nxt_str_t           *entry;
+    nxt_lvlhsh_query_t  lhq;
+
+    lhq.key_hash = ngx_http_route_hash(key->start, key->length);
+    lhq.key = *key;
+    lhq.proto = &ngx_http_route_index_proto;
+
+    if (nxt_lvlhsh_find(hash, &lhq) == NXT_OK) {
+        return lhq.value;
     }
 
-    pattern->type = type;
-    pattern->min_length = test.length;
-    pattern->length1 = test.length;
+    entry = nxt_mp_zalloc(mp, size);
+    if (nxt_slow_path(entry == NULL)) {
+        return NULL;
+    }
 
-    start = ngx_http_route_pattern_copy(mp, &test, pattern_case);
-    if (nxt_slow_path(start == NULL)) {
-        return NXT_ERROR;
+    *entry = *key;
+
+    lhq.replace = 0;
+    lhq.value = entry;
+    lhq.pool = mp;
+
+    if (nxt_slow_path(nxt_lvlhsh_insert(hash, &lhq) != NXT_OK)) {
+        return NULL;
     }
 
-    pattern->start1 = start;
+    return entry;
+}
 
-    if (type == NGX_HTTP_ROUTE_PATTERN_MIDDLE) {
-        length -= test.length;
-        pattern->length2 = length;
-        pattern->min_length += length;
 
-        test.start = &test.start[test.length + 1];
-        test.length = length;
+static void *
+ngx_http_route_index_find(nxt_lvlhsh_t *hash, nxt_str_t *key,
+    uint32_t key_hash)
+{
+    nxt_lvlhsh_query_t  lhq;
 
-        start = ngx_http_route_pattern_copy(mp, &test, pattern_case);
-        if (nxt_slow_path(start == NULL)) {
-            return NXT_ERROR;
-        }
+    lhq.key_hash = key_hash;
+    lhq.key = *key;
+    lhq.proto = &ngx_http_route_index_proto;
+
+    if (nxt_lvlhsh_find(hash, &lhq) == NXT_OK) {
+        return lhq.value;
+    }
+
+    return NULL;
+}
+
+
+static nxt_int_t
+ngx_http_route_list_alloc(nxt_mp_t *mp, ngx_http_route_list_t *list)
+{
+    if (list->items != 0) {
+        list->index = nxt_mp_alloc(mp, list->items * sizeof(uint32_t));
+        if (nxt_slow_path(list->index == NULL)) {
+            return NXT_ERROR;
+        }
+
+        /* The items are counted again while the list is filled. */
+        list->items = 0;
+    }
+
+    return NXT_OK;
+}
+
+
+static void
+ngx_http_route_list_add(ngx_http_route_list_t *list, uint32_t n)
+{
+    /* A route may list the same key more than once. */
+
+    if (list->items == 0 || list->index[list->items - 1] != n) {
+        list->index[list->items++] = n;
+    }
+}
+
+
+static nxt_int_t
+ngx_http_route_list_merge(nxt_mp_t *mp, ngx_http_route_list_t *one,
+    ngx_http_route_list_t *two, ngx_http_route_list_t *list)
+{
+    uint32_t  i, j, n;
+
+    if (one->items == 0 || two->items == 0) {
+        *list = (one->items != 0) ? *one : *two;
+        return NXT_OK;
+    }
+
+    list->index = nxt_mp_alloc(mp, (one->items + two->items)
+                                   * sizeof(uint32_t));
+    if (nxt_slow_path(list->index == NULL)) {
+        return NXT_ERROR;
+    }
+
+    list->items = 0;
+
+    i = 0;
+    j = 0;
+
+    while (i < one->items || j < two->items) {
+
+        if (j == two->items
+            || (i < one->items && one->index[i] < two->index[j]))
+        {
+            n = one->index[i++];
+
+        } else {
+            n = two->index[j++];
+        }
+
+        ngx_http_route_list_add(list, n);
+    }
+
+    return NXT_OK;
+}
+
+
+static size_t
+ngx_http_route_uri_segment(u_char *start, size_t length)
+{
+    u_char  *p;
+
+    if (length > 1) {
+        p = nxt_memchr(start + 1, '/', length - 1);
+
+        if (p != NULL) {
+            return p - start;
+        }
+    }
+
+    return length;
+}
+
+
+static nxt_int_t
+ngx_http_route_index_test(nxt_lvlhsh_query_t *lhq, void *data)
+{
+    nxt_str_t  *key;
+
+    key = data;
+
+    return nxt_strstr_eq(&lhq->key, key) ? NXT_OK : NXT_DECLINED;
+}
+
+
+static void *
+ngx_http_route_index_alloc(void *data, size_t size)
+{
+    return nxt_mp_align(data, size, size);
+}
+
+
+static void
+ngx_http_route_index_free(void *data, void *p)
+{
+    nxt_mp_free(data, p);
+}
+
+
+typedef struct {
+    nxt_conf_value_t               *host;
+    nxt_conf_value_t               *uri;
+    nxt_conf_value_t               *method;
+    nxt_conf_value_t               *headers;
+    nxt_conf_value_t               *arguments;
+    nxt_conf_value_t               *cookies;
+    nxt_conf_value_t               *scheme;
+} ngx_http_route_match_conf_t;
+
+
+static nxt_conf_map_t  ngx_http_route_match_conf[] = {
+    {
+        nxt_string("scheme"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, scheme)
+    },
+    {
+        nxt_string("host"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, host),
+    },
+
+    {
+        nxt_string("uri"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, uri),
+    },
+
+    {
+        nxt_string("method"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, method),
+    },
+
+    {
+        nxt_string("headers"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, headers),
+    },
+
+    {
+        nxt_string("arguments"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, arguments),
+    },
+
+    {
+        nxt_string("cookies"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_match_conf_t, cookies),
+    },
+};
+
+
+static ngx_http_route_match_t *
+ngx_http_route_match_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv)
+{
+    size_t                       size;
+    uint32_t                     n;
+    nxt_int_t                    ret;
+    nxt_conf_value_t             *match_conf;
+    ngx_http_route_test_t        *test;
+    ngx_http_route_rule_t        *rule;
+    ngx_http_route_table_t       *table;
+    ngx_http_route_match_t       *match;
+    ngx_http_route_match_conf_t  mtcf;
+
+    static nxt_str_t  match_path = nxt_string("/match");
+
+    match_conf = nxt_conf_get_path(cv, &match_path);
+
+    n = (match_conf != NULL) ? nxt_conf_object_members_count(match_conf) : 0;
+    size = sizeof(ngx_http_route_match_t) + n * sizeof(ngx_http_route_rule_t *);
+
+    match = nxt_mp_zalloc(conf->pool, size);
+    if (nxt_slow_path(match == NULL)) {
+        return NULL;
+    }
+
+    match->items = n;
+
+    if (n == 0) {
+        goto action_create;
+    }
+
+    nxt_memzero(&mtcf, sizeof(mtcf));
+
+    ret = nxt_conf_map_object(conf->pool, match_conf, ngx_http_route_match_conf,
+                              nxt_nitems(ngx_http_route_match_conf), &mtcf);
+    if (ret != NXT_OK) {
+        return NULL;
+    }
+
+    test = &match->test[0];
+
+    if (mtcf.scheme != NULL) {
+        rule = ngx_http_route_rule_create(conf, mtcf.scheme, 1,
+                                          NGX_HTTP_ROUTE_PATTERN_NOCASE);
+        if (rule == NULL) {
+            return NULL;
+        }
+
+        rule->object = NGX_HTTP_ROUTE_SCHEME;
+        test->rule = rule;
+        test++;
+    }
+
+    if (mtcf.uri != NULL) {
+        rule = ngx_http_route_rule_create(conf, mtcf.uri, 1,
+                                          NGX_HTTP_ROUTE_PATTERN_NOCASE);
+        if (rule == NULL) {
+            return NULL;
+        }
+
+        rule->u.offset = offsetof(ngx_http_request_t, uri);
+        rule->object = NGX_HTTP_ROUTE_STRING;
+        test->rule = rule;
+        test++;
+    }
+
+    if (mtcf.method != NULL) {
+        rule = ngx_http_route_rule_create(conf, mtcf.method, 1,
+                                          NGX_HTTP_ROUTE_PATTERN_UPCASE);
+        if (rule == NULL) {
+            return NULL;
+        }
+
+        rule->u.offset = offsetof(ngx_http_request_t, method_name);
+        rule->object = NGX_HTTP_ROUTE_STRING;
+        test->rule = rule;
+        test++;
+    }
+
+    if (mtcf.host != NULL) {
+        rule = ngx_http_route_rule_create(conf, mtcf.host, 1,
+                                          NGX_HTTP_ROUTE_PATTERN_LOWCASE);
+        if (rule == NULL) {
+            return NULL;
+        }
+
+        rule->object = NGX_HTTP_ROUTE_HOST;
+        test->rule = rule;
+        test++;
+    }
+
+    if (mtcf.headers != NULL) {
+        table = ngx_http_route_table_create(conf, mtcf.headers,
+                                            NGX_HTTP_ROUTE_HEADER, 0);
+        if (table == NULL) {
+            return NULL;
+        }
+
+        test->table = table;
+        test++;
+    }
+
+    if (mtcf.arguments != NULL) {
+        table = ngx_http_route_table_create(conf, mtcf.arguments,
+                                            NGX_HTTP_ROUTE_ARGUMENT, 1);
+        if (table == NULL) {
+            return NULL;
+        }
+
+        test->table = table;
+        test++;
+    }
+
+    if (mtcf.cookies != NULL) {
+        table = ngx_http_route_table_create(conf, mtcf.cookies,
+                                            NGX_HTTP_ROUTE_COOKIE, 1);
+        if (table == NULL) {
+            return NULL;
+        }
+
+        test->table = table;
+        test++;
+    }
+
+action_create:
+
+    ret = ngx_http_route_action_create(conf, cv, match);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        return NULL;
+    }
+
+    return match;
+}
+
+
+static ngx_http_route_table_t *
+ngx_http_route_table_create(ngx_http_conf_t *conf, nxt_conf_value_t *table_cv,
+    ngx_http_route_object_t object, nxt_bool_t case_sensitive)
+{
+    size_t                    size;
+    uint32_t                  i, n;
+    nxt_bool_t                array;
+    nxt_conf_value_t          *ruleset_cv;
+    ngx_http_route_table_t    *table;
+    ngx_http_route_ruleset_t  *ruleset;
+
+    array = (nxt_conf_type(table_cv) == NXT_CONF_ARRAY);
+    n = array ? nxt_conf_array_elements_count(table_cv) : 1;
+    size = sizeof(ngx_http_route_table_t)
+           + n * sizeof(ngx_http_route_ruleset_t *);
+
+    table = nxt_mp_alloc(conf->pool, size);
+    if (nxt_slow_path(table == NULL)) {
+        return NULL;
+    }
+
+    table->items = n;
+    table->object = NGX_HTTP_ROUTE_TABLE;
+
+    if (!array) {
+        ruleset = ngx_http_route_ruleset_create(conf, table_cv, object,
+                                                case_sensitive);
+        if (nxt_slow_path(ruleset == NULL)) {
+            return NULL;
+        }
+
+        table->ruleset[0] = ruleset;
+
+        return table;
+    }
+
+    for (i = 0; i < n; i++) {
+        ruleset_cv = nxt_conf_get_array_element(table_cv, i);
+
+        ruleset = ngx_http_route_ruleset_create(conf, ruleset_cv, object,
+                                                case_sensitive);
+        if (nxt_slow_path(ruleset == NULL)) {
+            return NULL;
+        }
+
+        table->ruleset[i] = ruleset;
+    }
+
+    return table;
+}
+
+
+static ngx_http_route_ruleset_t *
+ngx_http_route_ruleset_create(ngx_http_conf_t *conf, nxt_conf_value_t *ruleset_cv,
+    ngx_http_route_object_t object, nxt_bool_t case_sensitive)
+{
+    size_t                    size;
+    uint32_t                  i, n, next;
+    nxt_str_t                 name;
+    nxt_conf_value_t          *rule_cv;
+    ngx_http_route_rule_t     *rule;
+    ngx_http_route_ruleset_t  *ruleset;
+
+    n = nxt_conf_object_members_count(ruleset_cv);
+    size = sizeof(ngx_http_route_ruleset_t)
+           + n * sizeof(ngx_http_route_rule_t *);
+
+    ruleset = nxt_mp_alloc(conf->pool, size);
+    if (nxt_slow_path(ruleset == NULL)) {
+        return NULL;
+    }
+
+    ruleset->items = n;
+
+    next = 0;
+
+    for (i = 0; i < n; i++) {
+        rule_cv = nxt_conf_next_object_member(ruleset_cv, &name, &next);
+
+        rule = ngx_http_route_rule_name_create(conf, rule_cv, &name,
+                                               case_sensitive);
+        if (nxt_slow_path(rule == NULL)) {
+            return NULL;
+        }
+
+        rule->object = object;
+        ruleset->rule[i] = rule;
+    }
+
+    return ruleset;
+}
+
+
+static ngx_http_route_rule_t *
+ngx_http_route_rule_name_create(ngx_http_conf_t *conf, nxt_conf_value_t *rule_cv,
+    nxt_str_t *name, nxt_bool_t case_sensitive)
+{
+    u_char                 *p;
+    ngx_http_route_rule_t  *rule;
+
+    rule = ngx_http_route_rule_create(conf, rule_cv, case_sensitive,
+                                      NGX_HTTP_ROUTE_PATTERN_NOCASE);
+    if (nxt_slow_path(rule == NULL)) {
+        return NULL;
+    }
+
+    rule->u.name.length = name->length;
+
+    p = nxt_mp_nget(conf->pool, name->length);
+    if (nxt_slow_path(p == NULL)) {
+        return NULL;
+    }
+
+    rule->u.name.start = p;
+
+    nxt_memcpy(p, name->start, name->length);
+
+    rule->u.name.hash = case_sensitive
+                        ? ngx_http_field_hash(p, name->length)
+                        : ngx_http_field_hash_lowcase(p, name->length);
+
+    return rule;
+}
+
+
+static ngx_http_route_rule_t *
+ngx_http_route_rule_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv,
+    nxt_bool_t case_sensitive, ngx_http_route_pattern_case_t pattern_case)
+{
+    size_t                    size;
+    uint32_t                  i, n;
+    nxt_int_t                 ret;
+    nxt_bool_t                string;
+    nxt_conf_value_t          *value;
+    ngx_http_route_rule_t     *rule;
+    ngx_http_route_pattern_t  *pattern;
+
+    string = (nxt_conf_type(cv) != NXT_CONF_ARRAY);
+    n = string ? 1 : nxt_conf_array_elements_count(cv);
+    size = sizeof(ngx_http_route_rule_t) + n * sizeof(ngx_http_route_pattern_t);
+
+    rule = nxt_mp_alloc(conf->pool, size);
+    if (nxt_slow_path(rule == NULL)) {
+        return NULL;
+    }
+
+    rule->items = n;
+    rule->automaton = NULL;
+
+    pattern = &rule->pattern[0];
+
+    if (string) {
+        pattern[0].case_sensitive = case_sensitive;
+        ret = ngx_http_route_pattern_create(conf->pool, cv, &pattern[0],
+                                            pattern_case);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return NULL;
+        }
+
+        return rule;
+    }
+
+    nxt_conf_array_qsort(cv, nxt_http_pattern_compare);
+
+    for (i = 0; i < n; i++) {
+        pattern[i].case_sensitive = case_sensitive;
+        value = nxt_conf_get_array_element(cv, i);
+
+        ret = ngx_http_route_pattern_create(conf->pool, value, &pattern[i],
+                                            pattern_case);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return NULL;
+        }
+    }
+
+    ret = ngx_http_route_automaton_create(conf->pool, rule);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        return NULL;
+    }
+
+    return rule;
+}
+
+
+static int
+nxt_http_pattern_compare(const void *one, const void *two)
+{
+    nxt_str_t         test;
+    nxt_bool_t        negative1, negative2;
+    nxt_conf_value_t  *value;
+
+    value = (nxt_conf_value_t *) one;
+    nxt_conf_get_string(value, &test);
+    negative1 = (test.length != 0 && test.start[0] == '!');
+
+    value = (nxt_conf_value_t *) two;
+    nxt_conf_get_string(value, &test);
+    negative2 = (test.length != 0 && test.start[0] == '!');
+
+    return (negative2 - negative1);
+}
+
+
+static nxt_int_t
+ngx_http_route_automaton_create(nxt_mp_t *mp, ngx_http_route_rule_t *rule)
+{
+    u_char                      c;
+    size_t                      size;
+    uint8_t                     *found;
+    uint32_t                    i, j, k, n, s, t, head, tail;
+    uint32_t                    classes, states, *next, *fail, *queue;
+    nxt_mp_t                    *temp;
+    nxt_int_t                   ret;
+    nxt_bool_t                  case_sensitive;
+    ngx_http_route_pattern_t    *pattern;
+    ngx_http_route_automaton_t  *ac;
+
+    n = 0;
+    states = 1;
+
+    for (i = 0; i < rule->items; i++) {
+        pattern = &rule->pattern[i];
+
+        if (pattern->type == NGX_HTTP_ROUTE_PATTERN_SUBSTRING
+            && pattern->length1 != 0)
+        {
+            n++;
+            states += pattern->length1;
+        }
+    }
+
+    if (n < NGX_HTTP_ROUTE_AUTOMATON_PATTERNS) {
+        return NXT_OK;
+    }
+
+    ac = nxt_mp_zalloc(mp, sizeof(ngx_http_route_automaton_t));
+    if (nxt_slow_path(ac == NULL)) {
+        return NXT_ERROR;
+    }
+
+    case_sensitive = rule->pattern[0].case_sensitive;
+
+    /* The class 0 stands for all bytes absent in the patterns. */
+
+    classes = 1;
+
+    for (i = 0; i < rule->items; i++) {
+        pattern = &rule->pattern[i];
+
+        if (pattern->type != NGX_HTTP_ROUTE_PATTERN_SUBSTRING) {
+            continue;
+        }
+
+        for (j = 0; j < pattern->length1; j++) {
+            c = pattern->start1[j];
+            c = case_sensitive ? c : nxt_lowcase(c);
+
+            if (ac->map[c] == 0) {
+                ac->map[c] = classes++;
+            }
+        }
+    }
+
+    if (!case_sensitive) {
+        for (c = 'A'; c <= 'Z'; c++) {
+            ac->map[c] = ac->map[c | 0x20];
+        }
+    }
+
+    if ((uint64_t) states * classes > (UINT32_MAX >> 2)) {
+        /* Too large, the patterns are tested one by one. */
+        return NXT_OK;
+    }
+
+    temp = nxt_mp_create(1024, 128, 256, 32);
+    if (nxt_slow_path(temp == NULL)) {
+        return NXT_ERROR;
+    }
+
+    ret = NXT_ERROR;
+
+    size = (size_t) states * classes * sizeof(uint32_t);
+
+    next = nxt_mp_zalloc(temp, size);
+    fail = nxt_mp_zalloc(temp, states * sizeof(uint32_t));
+    queue = nxt_mp_alloc(temp, states * sizeof(uint32_t));
+    found = nxt_mp_zalloc(temp, states);
+
+    if (nxt_slow_path(next == NULL || fail == NULL || queue == NULL
+                      || found == NULL))
+    {
+        goto done;
+    }
+
+    /* The trie, the root state 0 is never a target here. */
+
+    states = 1;
+
+    for (i = 0; i < rule->items; i++) {
+        pattern = &rule->pattern[i];
+
+        if (pattern->type != NGX_HTTP_ROUTE_PATTERN_SUBSTRING
+            || pattern->length1 == 0)
+        {
+            continue;
+        }
+
+        s = 0;
+
+        for (j = 0; j < pattern->length1; j++) {
+            c = pattern->start1[j];
+            k = ac->map[case_sensitive ? c : nxt_lowcase(c)];
+
+            t = next[s * classes + k];
+
+            if (t == 0) {
+                t = states++;
+                next[s * classes + k] = t;
+            }
+
+            s = t;
+        }
+
+        if (pattern->negative) {
+            found[s] |= NGX_HTTP_ROUTE_FOUND_NEGATIVE;
+            ac->stop = NGX_HTTP_ROUTE_FOUND_NEGATIVE;
+
+        } else {
+            found[s] |= NGX_HTTP_ROUTE_FOUND_POSITIVE;
+            ac->positive = 1;
+        }
+    }
+
+    if (ac->stop == 0) {
+        /* Without negative patterns the first positive one is enough. */
+        ac->stop = NGX_HTTP_ROUTE_FOUND_POSITIVE;
+    }
+
+    /* The failure links and the missing transitions in breadth order. */
+
+    head = 0;
+    tail = 0;
+
+    for (k = 0; k < classes; k++) {
+        if (next[k] != 0) {
+            queue[tail++] = next[k];
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+
+        found[s] |= found[fail[s]];
+
+        for (k = 0; k < classes; k++) {
+            t = next[s * classes + k];
+
+            if (t != 0) {
+                fail[t] = next[fail[s] * classes + k];
+                queue[tail++] = t;
+
+            } else {
+                next[s * classes + k] = next[fail[s] * classes + k];
+            }
+        }
+    }
+
+    ac->next = nxt_mp_alloc(mp, (size_t) states * classes * sizeof(uint32_t));
+    if (nxt_slow_path(ac->next == NULL)) {
+        goto done;
+    }
+
+    for (i = 0; i < states * classes; i++) {
+        t = next[i];
+        ac->next[i] = ((t * classes) << 2) | found[t];
+    }
+
+    /* The rest of the patterns are still tested one by one. */
+
+    for (i = 0, j = 0; i < rule->items; i++) {
+        pattern = &rule->pattern[i];
+
+        if (pattern->type == NGX_HTTP_ROUTE_PATTERN_SUBSTRING
+            && pattern->length1 != 0)
+        {
+            continue;
+        }
+
+        rule->pattern[j++] = *pattern;
+    }
+
+    rule->items = j;
+    rule->automaton = ac;
+
+    ret = NXT_OK;
+
+done:
+
+    nxt_mp_destroy(temp);
+
+    return ret;
+}
+
+
+static nxt_int_t
+ngx_http_route_pattern_create(nxt_mp_t *mp, nxt_conf_value_t *cv,
+    ngx_http_route_pattern_t *pattern, ngx_http_route_pattern_case_t pattern_case)
+{
+    u_char                         *start;
+    nxt_str_t                      test;
+    nxt_uint_t                     n, length;
+    ngx_http_route_pattern_type_t  type;
+
+    /* Suppress warning about uninitialized variable. */
+    length = 0;
+
+    type = NGX_HTTP_ROUTE_PATTERN_EXACT;
+
+    nxt_conf_get_string(cv, &test);
+
+    pattern->negative = 0;
+    pattern->any = 1;
+
+    if (test.length != 0) {
+
+        if (test.start[0] == '!') {
+            test.start++;
+            test.length--;
+
+            pattern->negative = 1;
+            pattern->any = 0;
+        }
+
+#if (NXT_HAVE_REGEX)
+        if (test.length != 0 && test.start[0] == '~') {
+            test.start++;
+            test.length--;
+
+            return ngx_http_route_pattern_regex(mp, &test, pattern,
+                                                pattern_case);
+        }
+#endif
+
+        if (test.length != 0) {
+
+            if (test.start[0] == '*') {
+                test.start++;
+                test.length--;
+
+                if (test.length != 0) {
+                    if (test.start[test.length - 1] == '*') {
+                        test.length--;
+                        type = NGX_HTTP_ROUTE_PATTERN_SUBSTRING;
+
+                    } else {
+                        type = NGX_HTTP_ROUTE_PATTERN_END;
+                    }
+
+                } else {
+                    type = NGX_HTTP_ROUTE_PATTERN_BEGIN;
+                }
+
+            } else if (test.start[test.length - 1] == '*') {
+                test.length--;
+                type = NGX_HTTP_ROUTE_PATTERN_BEGIN;
+
+            } else {
+                length = test.length - 1;
+
+                for (n = 1; n < length; n++) {
+                    if (test.start[n] == '*') {
+                        test.length = n;
+                        type = NGX_HTTP_ROUTE_PATTERN_MIDDLE;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    pattern->type = type;
+    pattern->min_length = test.length;
+    pattern->length1 = test.length;
+
+    start = ngx_http_route_pattern_copy(mp, &test, pattern_case);
+    if (nxt_slow_path(start == NULL)) {
+        return NXT_ERROR;
+    }
+
+    pattern->start1 = start;
+
+    if (type == NGX_HTTP_ROUTE_PATTERN_MIDDLE) {
+        length -= test.length;
+        pattern->length2 = length;
+        pattern->min_length += length;
+
+        test.start = &test.start[test.length + 1];
+        test.length = length;
+
+        start = ngx_http_route_pattern_copy(mp, &test, pattern_case);
+        if (nxt_slow_path(start == NULL)) {
+            return NXT_ERROR;
+        }
+
+        pattern->start2 = start;
+    }
+
+    return NXT_OK;
+}
+
+
+#if (NXT_HAVE_REGEX)
+
+static nxt_int_t
+ngx_http_route_pattern_regex(nxt_mp_t *mp, nxt_str_t *test,
+    ngx_http_route_pattern_t *pattern,
+    ngx_http_route_pattern_case_t pattern_case)
+{
+    nxt_uint_t       flags;
+    nxt_regex_err_t  err;
+
+    /*
+     * The expression text is not case transformed, the normalized
+     * subjects of host and method are matched caselessly instead.
+     */
+
+    flags = (!pattern->case_sensitive
+             || pattern_case != NGX_HTTP_ROUTE_PATTERN_NOCASE)
+            ? NXT_REGEX_CASELESS : 0;
+
+    pattern->regex = nxt_regex_compile(mp, test, flags, &err);
+    if (nxt_slow_path(pattern->regex == NULL)) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "regex \"%V\" compilation failed: %s at offset %uz",
+                      test, err.msg, err.offset);
+        return NXT_ERROR;
+    }
+
+    pattern->type = NGX_HTTP_ROUTE_PATTERN_REGEX;
+    pattern->min_length = 0;
+    pattern->start1 = NULL;
+    pattern->length1 = 0;
+
+    return NXT_OK;
+}
+
+#endif
+
+
+static u_char *
+ngx_http_route_pattern_copy(nxt_mp_t *mp, nxt_str_t *test,
+    ngx_http_route_pattern_case_t pattern_case)
+{
+    u_char  *start;
+
+    start = nxt_mp_nget(mp, test->length);
+    if (nxt_slow_path(start == NULL)) {
+        return start;
+    }
+
+    switch (pattern_case) {
+
+    case NGX_HTTP_ROUTE_PATTERN_UPCASE:
+        nxt_memcpy_upcase(start, test->start, test->length);
+        break;
+
+    case NGX_HTTP_ROUTE_PATTERN_LOWCASE:
+        nxt_memcpy_lowcase(start, test->start, test->length);
+        break;
+
+    case NGX_HTTP_ROUTE_PATTERN_NOCASE:
+        nxt_memcpy(start, test->start, test->length);
+        break;
+    }
+
+    return start;
+}
+
+
+typedef struct {
+    nxt_conf_value_t               *variables;
+    nxt_conf_value_t               *blacklist;
+    nxt_conf_value_t               *whitelist;
+    nxt_conf_value_t               *add_headers;
+    uint8_t                        add_headers_always;
+    nxt_conf_value_t               *limit_conn;
+    nxt_conf_value_t               *limit_req;
+    nxt_uint_t                     limit_rate;
+    nxt_uint_t                     return_status;
+    nxt_str_t                      return_text;
+    nxt_str_t                      return_location;
+    nxt_str_t                      return_type;
+    uint8_t                        return_gzip;
+} ngx_http_route_action_conf_t;
+
+
+static nxt_conf_map_t  ngx_http_route_action_conf[] = {
+
+    {
+        nxt_string("variables"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, variables)
+    },
+
+    {
+        nxt_string("blacklist"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, blacklist),
+    },
+
+    {
+        nxt_string("whitelist"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, whitelist),
+    },
+
+    {
+        nxt_string("add_headers"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, add_headers)
+    },
+
+    {
+        nxt_string("add_headers_always"),
+        NXT_CONF_MAP_INT8,
+        offsetof(ngx_http_route_action_conf_t, add_headers_always)
+    },
+
+    {
+        nxt_string("limit_conn"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, limit_conn)
+    },
+
+    {
+        nxt_string("limit_req"),
+        NXT_CONF_MAP_PTR,
+        offsetof(ngx_http_route_action_conf_t, limit_req)
+    },
+
+    {
+        nxt_string("limit_rate"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_route_action_conf_t, limit_rate)
+    },
+
+    {
+        nxt_string("return"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_route_action_conf_t, return_status),
+    },
+
+    {
+        nxt_string("text"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_route_action_conf_t, return_text),
+    },
+
+    {
+        nxt_string("location"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_route_action_conf_t, return_location),
+    },
+
+    {
+        nxt_string("type"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_route_action_conf_t, return_type),
+    },
+
+    {
+        nxt_string("gzip"),
+        NXT_CONF_MAP_INT8,
+        offsetof(ngx_http_route_action_conf_t, return_gzip),
+    },
+};
+
+
+static nxt_conf_map_t  ngx_http_route_action_limit_conn_conf[] = {
+    {
+        nxt_string("key"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_action_limit_conn_t, key),
+    },
+
+    {
+        nxt_string("conn"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_action_limit_conn_t, conn),
+    },
+};
+
+
+static nxt_conf_map_t  ngx_http_route_action_limit_req_conf[] = {
+    {
+        nxt_string("key"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_action_limit_req_t, key),
+    },
+
+    {
+        nxt_string("rate"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_action_limit_req_t, rate),
+    },
+
+    {
+        nxt_string("burst"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_action_limit_req_t, burst),
+    },
+
+    {
+        nxt_string("delay"),
+        NXT_CONF_MAP_INT32,
+        offsetof(ngx_http_action_limit_req_t, delay),
+    },
+
+    {
+        nxt_string("nodelay"),
+        NXT_CONF_MAP_INT8,
+        offsetof(ngx_http_action_limit_req_t, nodelay),
+    },
+
+    {
+        nxt_string("algorithm"),
+        NXT_CONF_MAP_STR,
+        offsetof(ngx_http_action_limit_req_t, algorithm),
+    },
+};
+
+
+static nxt_int_t
+ngx_http_route_action_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv,
+    ngx_http_route_match_t *match)
+{
+    nxt_mp_t                       *mp;
+    nxt_int_t                      ret;
+    nxt_conf_value_t               *action_conf, *headers_conf;
+    nxt_conf_value_t               *variables_conf;
+    nxt_conf_value_t               *blacklist_conf, *whitelist_conf;
+    nxt_conf_value_t               *limit_conn_conf, *limit_req_conf;
+    ngx_http_action_addr_t         *blacklist, *whitelist;
+    ngx_http_action_headers_t      *headers;
+    ngx_http_action_variables_t    *variables;
+    ngx_http_action_limit_req_t    *limit_req;
+    ngx_http_action_limit_conn_t   *limit_conn;
+    ngx_http_route_action_conf_t   accf;
+
+    static nxt_str_t  action_path = nxt_string("/action");
+
+    mp = conf->pool;
+
+    action_conf = nxt_conf_get_path(cv, &action_path);
+    if (action_conf == NULL) {
+        return NXT_ERROR;
+    }
+
+    nxt_memzero(&accf, sizeof(accf));
+
+    ret = nxt_conf_map_object(mp, action_conf, ngx_http_route_action_conf,
+                              nxt_nitems(ngx_http_route_action_conf), &accf);
+    if (ret != NXT_OK) {
+        return ret;
+    }
+
+    variables_conf = accf.variables;
+
+    if (variables_conf != NULL) {
+        variables = ngx_http_route_action_variables(conf, variables_conf);
+        if (nxt_slow_path(variables == NULL)) {
+            return NXT_ERROR;
+        }
+
+        match->action.variables = variables;
+    }
+
+    blacklist_conf = accf.blacklist;
+
+    if (blacklist_conf != NULL) {
+        blacklist = ngx_http_route_action_addr(conf, mp, blacklist_conf);
+        if (nxt_slow_path(blacklist == NULL)) {
+            return NXT_ERROR;
+        }
+
+        match->action.blacklist = blacklist;
+    }
+
+    whitelist_conf = accf.whitelist;
+
+    if (whitelist_conf != NULL) {
+        whitelist = ngx_http_route_action_addr(conf, mp, whitelist_conf);
+        if (nxt_slow_path(whitelist == NULL)) {
+            return NXT_ERROR;
+        }
+
+        match->action.whitelist = whitelist;
+    }
+
+    headers_conf = accf.add_headers;
+
+    if (headers_conf != NULL) {
+        headers = ngx_http_route_action_headers(mp, headers_conf);
+        if (nxt_slow_path(headers == NULL)) {
+            return NXT_ERROR;
+        }
+
+        headers->always = accf.add_headers_always;
+
+        match->action.add_headers = headers;
+    }
+
+    limit_conn_conf = accf.limit_conn;
+
+    if (limit_conn_conf != NULL) {
+        limit_conn = nxt_mp_alloc(mp, sizeof(ngx_http_action_limit_conn_t));
+        if (nxt_slow_path(limit_conn == NULL)) {
+            return NXT_ERROR;
+        }
+
+        ret = nxt_conf_map_object(mp, limit_conn_conf,
+                                  ngx_http_route_action_limit_conn_conf,
+                                  nxt_nitems(ngx_http_route_action_limit_conn_conf),
+                                  limit_conn);
+        if (ret != NXT_OK) {
+            return ret;
+        }
+
+        ret = ngx_http_route_action_key(conf, &limit_conn->key,
+                                        &limit_conn->complex_key);
+        if (ret != NXT_OK) {
+            return ret;
+        }
+
+        match->action.limit_conn = limit_conn;
+    }
+
+    limit_req_conf = accf.limit_req;
+
+    if (limit_req_conf != NULL) {
+        limit_req = nxt_mp_zalloc(mp, sizeof(ngx_http_action_limit_req_t));
+        if (nxt_slow_path(limit_req == NULL)) {
+            return NXT_ERROR;
+        }
+
+        ret = nxt_conf_map_object(mp, limit_req_conf,
+                                  ngx_http_route_action_limit_req_conf,
+                                  nxt_nitems(ngx_http_route_action_limit_req_conf),
+                                  limit_req);
+        if (ret != NXT_OK) {
+            return ret;
+        }
+
+        limit_req->rate *= 1000;
+        limit_req->burst *= 1000;
+
+        /* The excess up to the delay is served at once. */
+
+        limit_req->delay = limit_req->nodelay ? limit_req->burst
+                                              : limit_req->delay * 1000;
+
+        if (nxt_str_eq(&limit_req->algorithm, "gcra", 4)) {
+            limit_req->mode = NGX_HTTP_LIMIT_REQ_GCRA;
+
+        } else if (nxt_str_eq(&limit_req->algorithm, "local", 5)) {
+            limit_req->mode = NGX_HTTP_LIMIT_REQ_LOCAL;
+        }
+
+        ret = ngx_http_route_action_key(conf, &limit_req->key,
+                                        &limit_req->complex_key);
+        if (ret != NXT_OK) {
+            return ret;
+        }
+
+        match->action.limit_req = limit_req;
+    }
+
+    match->action.limit_rate = accf.limit_rate;
+
+    match->action.return_status = accf.return_status;
+    match->action.return_text = accf.return_text;
+    match->action.return_location = accf.return_location;
+
+    if (accf.return_status != 0
+        && (accf.return_status < NGX_HTTP_BAD_REQUEST
+            || accf.return_text.length != 0))
+    {
+        match->action.response = ngx_http_route_action_response(mp,
+                                      &match->action, &accf.return_type,
+                                      accf.return_gzip);
+        if (nxt_slow_path(match->action.response == NULL)) {
+            return NXT_ERROR;
+        }
+    }
+
+    return NXT_OK;
+}
+
+
+static ngx_http_action_response_t *
+ngx_http_route_action_response(nxt_mp_t *mp, ngx_http_action_t *action,
+    nxt_str_t *type, nxt_bool_t gzip)
+{
+    ngx_buf_t                   *b;
+    ngx_table_elt_t             *h;
+    ngx_http_action_response_t  *response;
+
+    response = nxt_mp_zalloc(mp, sizeof(ngx_http_action_response_t));
+    if (nxt_slow_path(response == NULL)) {
+        return NULL;
+    }
+
+    switch (action->return_status) {
+
+    case NGX_HTTP_MOVED_PERMANENTLY:
+    case NGX_HTTP_MOVED_TEMPORARILY:
+    case NGX_HTTP_SEE_OTHER:
+    case NGX_HTTP_TEMPORARY_REDIRECT:
+    case NGX_HTTP_PERMANENT_REDIRECT:
+        h = &response->location;
+
+        h->hash = 1;
+        ngx_str_set(&h->key, "Location");
+        h->value.len = action->return_location.length;
+        h->value.data = action->return_location.start;
+
+        return response;
+    }
+
+    response->type.len = type->length;
+    response->type.data = type->start;
+
+    b = &response->body;
+
+    b->start = action->return_text.start;
+    b->pos = b->start;
+    b->last = b->start + action->return_text.length;
+    b->end = b->last;
+
+    b->memory = (action->return_text.length != 0);
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+
+    if (gzip && action->return_text.length != 0) {
+        if (ngx_http_route_action_gzip(mp, response, &action->return_text)
+            != NXT_OK)
+        {
+            return NULL;
+        }
+    }
+
+#endif
+
+    return response;
+}
+
+
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+
+static nxt_int_t
+ngx_http_route_action_gzip(nxt_mp_t *mp, ngx_http_action_response_t *response,
+    nxt_str_t *text)
+{
+    int              rc;
+    size_t           size;
+    u_char           *out;
+    z_stream         zs;
+    ngx_buf_t        *b;
+    ngx_table_elt_t  *h;
+
+    nxt_memzero(&zs, sizeof(z_stream));
+
+    rc = deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16,
+                      MAX_MEM_LEVEL - 1, Z_DEFAULT_STRATEGY);
+    if (rc != Z_OK) {
+        return NXT_ERROR;
+    }
+
+    size = deflateBound(&zs, text->length);
+
+    out = nxt_mp_nget(mp, size);
+    if (nxt_slow_path(out == NULL)) {
+        (void) deflateEnd(&zs);
+        return NXT_ERROR;
+    }
+
+    zs.next_in = text->start;
+    zs.avail_in = text->length;
+    zs.next_out = out;
+    zs.avail_out = size;
+
+    rc = deflate(&zs, Z_FINISH);
+
+    (void) deflateEnd(&zs);
+
+    if (rc != Z_STREAM_END) {
+        return NXT_ERROR;
+    }
+
+    /* The text is sent as is if it does not compress. */
+
+    if (zs.total_out >= text->length) {
+        return NXT_OK;
+    }
+
+    b = &response->gzip;
+
+    b->start = out;
+    b->pos = out;
+    b->last = out + zs.total_out;
+    b->end = b->last;
+
+    b->memory = 1;
+    b->last_buf = 1;
+    b->last_in_chain = 1;
+
+    h = &response->content_encoding;
+
+    h->hash = 1;
+    ngx_str_set(&h->key, "Content-Encoding");
+    ngx_str_set(&h->value, "gzip");
+
+    return NXT_OK;
+}
+
+#endif
+
+
+static nxt_int_t
+ngx_http_route_action_key(ngx_http_conf_t *conf, nxt_str_t *src,
+    ngx_http_action_key_t *key)
+{
+    u_char                      *p, *end, *start;
+    nxt_uint_t                  n;
+    ngx_http_action_key_part_t  *part;
+
+    p = src->start;
+    end = p + src->length;
+
+    n = 1;
+
+    while (p < end) {
+        n += (*p++ == '$') ? 2 : 0;
+    }
+
+    key->parts = nxt_mp_zalloc(conf->pool,
+                               n * sizeof(ngx_http_action_key_part_t));
+    if (nxt_slow_path(key->parts == NULL)) {
+        return NXT_ERROR;
+    }
+
+    key->nparts = 0;
+
+    /* The syntax has been checked by the validator. */
+
+    p = src->start;
+
+    while (p < end) {
+        part = &key->parts[key->nparts++];
+
+        if (*p != '$') {
+            start = p;
+
+            while (p < end && *p != '$') {
+                p++;
+            }
+
+            part->text.len = p - start;
+            part->text.data = start;
+
+            continue;
+        }
+
+        p++;
+
+        if (*p == '{') {
+            start = ++p;
+
+            while (*p != '}') {
+                p++;
+            }
+
+            n = p++ - start;
+
+        } else {
+            start = p;
+
+            while (p < end
+                   && (*p == '_' || (*p >= '0' && *p <= '9')
+                       || ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z')))
+            {
+                p++;
+            }
+
+            n = p - start;
+        }
+
+        if (ngx_http_route_action_key_variable(conf, part, start, n)
+            != NXT_OK)
+        {
+            return NXT_ERROR;
+        }
+    }
+
+    return NXT_OK;
+}
+
+
+static nxt_int_t
+ngx_http_route_action_key_variable(ngx_http_conf_t *conf,
+    ngx_http_action_key_part_t *part, u_char *name, size_t length)
+{
+    u_char               *low;
+    ngx_str_t            var;
+    ngx_uint_t           hash;
+    nxt_bool_t           prefix;
+    ngx_http_variable_t  *v;
+
+    low = nxt_mp_nget(conf->pool, length);
+    if (nxt_slow_path(low == NULL)) {
+        return NXT_ERROR;
+    }
+
+    hash = ngx_hash_strlow(low, name, length);
+
+    part->text.len = length;
+    part->text.data = low;
+
+    v = ngx_http_route_variable(conf->cycle, low, length, hash, &prefix);
+
+    if (v == NULL) {
+        var.len = length;
+        var.data = name;
+
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "unknown \"%V\" variable in limit key", &var);
+
+        return NXT_ERROR;
+    }
+
+    part->variable = v;
+
+    if (prefix) {
+        part->index = NGX_ERROR;
+        part->data = (uintptr_t) &part->text;
+
+    } else {
+        part->index = (v->flags & NGX_HTTP_VAR_INDEXED) ? (ngx_int_t) v->index
+                                                        : NGX_ERROR;
+        part->data = v->data;
+    }
+
+    return NXT_OK;
+}
+
+
+/*
+ * Checks a limit key variable on validation, so an unknown variable is
+ * reported to the client.  The context is the cycle of the variables.
+ */
+
+nxt_int_t
+ngx_http_route_variable_check(void *ctx, nxt_mp_t *mp, nxt_str_t *name)
+{
+    u_char      *low;
+    ngx_uint_t  hash;
+    nxt_bool_t  prefix;
+
+    low = nxt_mp_nget(mp, name->length);
+    if (nxt_slow_path(low == NULL)) {
+        return NXT_ERROR;
+    }
+
+    hash = ngx_hash_strlow(low, name->start, name->length);
+
+    if (ngx_http_route_variable(ctx, low, name->length, hash, &prefix)
+        == NULL)
+    {
+        return NXT_DECLINED;
+    }
+
+    return NXT_OK;
+}
+
+
+static ngx_http_variable_t *
+ngx_http_route_variable(ngx_cycle_t *cycle, u_char *low, size_t length,
+    ngx_uint_t hash, nxt_bool_t *prefix)
+{
+    ngx_uint_t                 i;
+    ngx_http_variable_t        *v, *found;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_core_module);
+
+    *prefix = 0;
+
+    v = ngx_hash_find(&cmcf->variables_hash, hash, low, length);
+
+    if (v != NULL) {
+        return v;
+    }
+
+    /* The longest prefix variable, such as "http_" or "arg_". */
+
+    found = NULL;
+    v = cmcf->prefix_variables.elts;
+
+    for (i = 0; i < cmcf->prefix_variables.nelts; i++) {
+
+        if (length >= v[i].name.len
+            && (found == NULL || v[i].name.len > found->name.len)
+            && ngx_strncmp(low, v[i].name.data, v[i].name.len) == 0)
+        {
+            found = &v[i];
+        }
+    }
+
+    *prefix = (found != NULL);
+
+    return found;
+}
+
+
+static ngx_http_action_variables_t *
+ngx_http_route_action_variables(ngx_http_conf_t *conf, nxt_conf_value_t *cv)
+{
+    size_t                        size;
+    u_char                        *low;
+    uint32_t                      i, n, next;
+    nxt_mp_t                      *mp;
+    nxt_str_t                     name, value;
+    ngx_uint_t                    key;
+    nxt_conf_value_t              *value_conf;
+    ngx_http_variable_t           *v;
+    ngx_http_action_variable_t    *var;
+    ngx_http_core_main_conf_t     *cmcf;
+    ngx_http_action_variables_t   *variables;
+
+    mp = conf->pool;
+
+    cmcf = ngx_http_cycle_get_module_main_conf(conf->cycle,
+                                               ngx_http_core_module);
+
+    n = nxt_conf_object_members_count(cv);
+
+    size = sizeof(ngx_http_action_variables_t)
+           + n * sizeof(ngx_http_action_variable_t);
+
+    variables = nxt_mp_zalloc(mp, size);
+    if (nxt_slow_path(variables == NULL)) {
+        return NULL;
+    }
+
+    next = 0;
+
+    for (i = 0; i < n; i++) {
+        value_conf = nxt_conf_next_object_member(cv, &name, &next);
+        nxt_conf_get_string(value_conf, &value);
+
+        low = nxt_mp_alloc(mp, name.length);
+        if (nxt_slow_path(low == NULL)) {
+            return NULL;
+        }
+
+        key = ngx_hash_strlow(low, name.start, name.length);
+
+        v = ngx_hash_find(&cmcf->variables_hash, key, low, name.length);
+
+        nxt_mp_free(mp, low);
+
+        /* The unknown and not indexed variables are ignored. */
+
+        if (v == NULL
+            || (v->set_handler == NULL && !(v->flags & NGX_HTTP_VAR_INDEXED)))
+        {
+            continue;
+        }
+
+        var = &variables->variable[variables->items++];
 
-        pattern->start2 = start;
+        var->variable = v;
+        var->value.len = value.length;
+        var->value.valid = 1;
+        var->value.data = value.start;
     }
 
-    return NXT_OK;
+    return variables;
 }
 
 
-static u_char *
-ngx_http_route_pattern_copy(nxt_mp_t *mp, nxt_str_t *test,
-    ngx_http_route_pattern_case_t pattern_case)
+static ngx_http_action_headers_t *
+ngx_http_route_action_headers(nxt_mp_t *mp, nxt_conf_value_t *cv)
 {
-    u_char  *start;
-
-    start = nxt_mp_nget(mp, test->length);
-    if (nxt_slow_path(start == NULL)) {
-        return start;
-    }
-
-    switch (pattern_case) {
+    size_t                       size;
+    uint32_t                     i, n, next;
+    nxt_str_t                    name, value;
+    ngx_table_elt_t              *h;
+    nxt_conf_value_t             *value_conf;
+    ngx_http_action_headers_t    *headers;
 
-    case NGX_HTTP_ROUTE_PATTERN_UPCASE:
-        nxt_memcpy_upcase(start, test->start, test->length);
-        break;
+    n = nxt_conf_object_members_count(cv);
 
-    case NGX_HTTP_ROUTE_PATTERN_LOWCASE:
-        nxt_memcpy_lowcase(start, test->start, test->length);
-        break;
+    size = sizeof(ngx_http_action_headers_t) + n * sizeof(ngx_table_elt_t);
 
-    case NGX_HTTP_ROUTE_PATTERN_NOCASE:
-        nxt_memcpy(start, test->start, test->length);
-        break;
+    headers = nxt_mp_zalloc(mp, size);
+    if (nxt_slow_path(headers == NULL)) {
+        return NULL;
     }
 
-    return start;
-}
+    next = 0;
 
+    for (i = 0; i < n; i++) {
+        value_conf = nxt_conf_next_object_member(cv, &name, &next);
+        nxt_conf_get_string(value_conf, &value);
 
-typedef struct {
-    nxt_conf_value_t               *variables;
-    nxt_conf_value_t               *blacklist;
-    nxt_conf_value_t               *whitelist;
-    nxt_conf_value_t               *add_headers;
-    nxt_conf_value_t               *limit_conn;
-    nxt_conf_value_t               *limit_req;
-    nxt_uint_t                     limit_rate;
-    nxt_uint_t                     return_status;
-    nxt_str_t                      return_text;
-    nxt_str_t                      return_location;
-} ngx_http_route_action_conf_t;
+        /* The headers with empty values are not added, as in add_header. */
 
+        if (value.length == 0) {
+            continue;
+        }
 
-static nxt_conf_map_t  ngx_http_route_action_conf[] = {
+        h = &headers->header[headers->items++];
 
-    {
-        nxt_string("variables"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, variables)
-    },
+        h->lowcase_key = nxt_mp_nget(mp, name.length);
+        if (nxt_slow_path(h->lowcase_key == NULL)) {
+            return NULL;
+        }
 
-    {
-        nxt_string("blacklist"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, blacklist),
-    },
+        h->hash = ngx_hash_strlow(h->lowcase_key, name.start, name.length);
 
-    {
-        nxt_string("whitelist"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, whitelist),
-    },
+        if (h->hash == 0) {
+            h->hash = 1;
+        }
 
-    {
-        nxt_string("add_headers"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, add_headers)
-    },
+        h->key.len = name.length;
+        h->key.data = name.start;
+        h->value.len = value.length;
+        h->value.data = value.start;
+    }
 
-    {
-        nxt_string("limit_conn"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, limit_conn)
-    },
+    return headers;
+}
 
-    {
-        nxt_string("limit_req"),
-        NXT_CONF_MAP_PTR,
-        offsetof(ngx_http_route_action_conf_t, limit_req)
-    },
 
-    {
-        nxt_string("limit_rate"),
-        NXT_CONF_MAP_INT32,
-        offsetof(ngx_http_route_action_conf_t, limit_rate)
-    },
+static ngx_http_action_addr_t *
+ngx_http_route_action_addr(ngx_http_conf_t *conf, nxt_mp_t *mp,
+    nxt_conf_value_t *cv)
+{
+    uint32_t                   i, n;
+    nxt_mp_t                   *temp;
+    nxt_int_t                  ret;
+    nxt_str_t                  name, dir, error;
+    nxt_conf_value_t           *addr_conf;
+    nxt_addr_pattern_t         *patterns;
+    ngx_http_action_addr_t     *addr;
+    ngx_http_ctrl_main_conf_t  *cmcf;
+
+    static nxt_str_t  file_path = nxt_string("/file");
+
+    addr = nxt_mp_zalloc(mp, sizeof(ngx_http_action_addr_t));
+    if (nxt_slow_path(addr == NULL)) {
+        return NULL;
+    }
 
-    {
-        nxt_string("return"),
-        NXT_CONF_MAP_INT32,
-        offsetof(ngx_http_route_action_conf_t, return_status),
-    },
+    if (nxt_conf_type(cv) == NXT_CONF_OBJECT) {
+        nxt_conf_get_string(nxt_conf_get_path(cv, &file_path), &name);
 
-    {
-        nxt_string("text"),
-        NXT_CONF_MAP_STR,
-        offsetof(ngx_http_route_action_conf_t, return_text),
-    },
+        cmcf = ngx_http_cycle_get_module_main_conf(conf->cycle,
+                                                   ngx_http_ctrl_module);
 
-    {
-        nxt_string("location"),
-        NXT_CONF_MAP_STR,
-        offsetof(ngx_http_route_action_conf_t, return_location),
-    },
-};
+        dir.length = cmcf->addr_path->name.len;
+        dir.start = cmcf->addr_path->name.data;
 
+        addr->tree = nxt_addr_tree_load(mp, &name, &dir, &error);
 
-static nxt_conf_map_t  ngx_http_route_action_limit_conn_conf[] = {
-    {
-        nxt_string("key"),
-        NXT_CONF_MAP_STR,
-        offsetof(ngx_http_action_limit_conn_t, key),
-    },
+        if (nxt_slow_path(addr->tree == NULL)) {
+            ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                          "address list \"%*s\" cannot be loaded: %*s",
+                          name.length, name.start, error.length, error.start);
+            return NULL;
+        }
 
-    {
-        nxt_string("conn"),
-        NXT_CONF_MAP_INT32,
-        offsetof(ngx_http_action_limit_conn_t, conn),
-    },
-};
+        return addr;
+    }
 
+    n = (nxt_conf_type(cv) == NXT_CONF_ARRAY)
+        ? nxt_conf_array_elements_count(cv) : 1;
 
-static nxt_conf_map_t  ngx_http_route_action_limit_req_conf[] = {
-    {
-        nxt_string("key"),
-        NXT_CONF_MAP_STR,
-        offsetof(ngx_http_action_limit_req_t, key),
-    },
+    /*
+     * The patterns are only needed to build the tree.  They are zeroed,
+     * so equal lists have equal patterns and share the same tree.
+     */
 
-    {
-        nxt_string("rate"),
-        NXT_CONF_MAP_INT32,
-        offsetof(ngx_http_action_limit_req_t, rate),
-    },
+    temp = nxt_mp_create(1024, 128, 256, 32);
+    if (nxt_slow_path(temp == NULL)) {
+        return NULL;
+    }
 
-    {
-        nxt_string("burst"),
-        NXT_CONF_MAP_INT32,
-        offsetof(ngx_http_action_limit_req_t, burst),
-    },
-};
+    patterns = nxt_mp_zalloc(temp, n * sizeof(nxt_addr_pattern_t));
+    if (nxt_slow_path(patterns == NULL)) {
+        goto fail;
+    }
 
+    for (i = 0; i < n; i++) {
+        addr_conf = (nxt_conf_type(cv) == NXT_CONF_ARRAY)
+                    ? nxt_conf_get_array_element(cv, i) : cv;
 
-static nxt_int_t
-ngx_http_route_action_create(ngx_http_conf_t *conf, nxt_conf_value_t *cv,
-    ngx_http_route_match_t *match)
-{
-    size_t                         size;
-    uint32_t                       i, n, next;
-    nxt_mp_t                       *mp;
-    nxt_int_t                      ret;
-    nxt_str_t                      name, value;
-    nxt_bool_t                     array;
-    nxt_conf_value_t               *action_conf, *addr_conf;
-    nxt_conf_value_t               *headers_conf, *header_conf;
-    nxt_conf_value_t               *variables_conf, *variable_conf;
-    nxt_conf_value_t               *blacklist_conf, *whitelist_conf;
-    nxt_conf_value_t               *limit_conn_conf, *limit_req_conf;
-    nxt_addr_pattern_t             *pattern;
-    ngx_http_name_value_t          *nv;
-    ngx_http_action_addr_t         *blacklist, *whitelist;
-    ngx_http_action_headers_t      *headers;
-    ngx_http_action_variables_t    *variables;
-    ngx_http_action_limit_req_t    *limit_req;
-    ngx_http_action_limit_conn_t   *limit_conn;
-    ngx_http_route_action_conf_t   accf;
+        ret = nxt_addr_pattern_parse(temp, &patterns[i], addr_conf);
+        if (ret != NXT_OK) {
+            goto fail;
+        }
+    }
 
-    static nxt_str_t  action_path = nxt_string("/action");
+    addr->tree = ngx_http_ctrl_addr_tree(mp, patterns, n);
+    if (nxt_slow_path(addr->tree == NULL)) {
+        goto fail;
+    }
 
-    mp = conf->pool;
+    nxt_mp_destroy(temp);
 
-    action_conf = nxt_conf_get_path(cv, &action_path);
-    if (action_conf == NULL) {
-        return NXT_ERROR;
-    }
+    return addr;
 
-    nxt_memzero(&accf, sizeof(accf));
+fail:
 
-    ret = nxt_conf_map_object(mp, action_conf, ngx_http_route_action_conf,
-                              nxt_nitems(ngx_http_route_action_conf), &accf);
-    if (ret != NXT_OK) {
-        return ret;
-    }
+    nxt_mp_destroy(temp);
 
-    variables_conf = accf.variables;
+    return NULL;
+}
 
-    if (variables_conf != NULL) {
 
-        n = nxt_conf_object_members_count(variables_conf);
+ngx_http_action_t *
+ngx_http_route_action(ngx_http_request_t *r, ngx_http_routes_t *routes)
+{
+    uint32_t                 hash, last;
+    nxt_str_t                host, segment;
+    nxt_uint_t               i, n;
+    ngx_http_action_t        *action;
+    ngx_http_route_list_t    lists[6], *list;
+    ngx_http_route_host_t    *entry;
+    ngx_http_route_suffix_t  *node;
+
+    segment.start = r->uri.data;
+    segment.length = ngx_http_route_uri_segment(r->uri.data, r->uri.len);
+
+    hash = ngx_http_route_hash(segment.start, segment.length);
+
+    n = 0;
+
+    host.start = r->headers_in.server.data;
+    host.length = r->headers_in.server.len;
+
+    if (!nxt_lvlhsh_is_empty(&routes->hosts)) {
+        entry = ngx_http_route_index_find(&routes->hosts, &host,
+                                          ngx_http_route_hash(host.start,
+                                                              host.length));
+        if (entry != NULL) {
+            n = ngx_http_route_index_lists(&entry->uri, &segment, hash, lists);
+        }
+    }
 
-        size = sizeof(ngx_http_action_variables_t)
-               + n * sizeof(ngx_http_name_value_t *);
+    if (!nxt_lvlhsh_is_empty(&routes->suffixes)) {
+        node = ngx_http_route_suffix_find(&routes->suffixes, &host);
 
-        variables = nxt_mp_alloc(mp, size);
-        if (nxt_slow_path(variables == NULL)) {
-            return NXT_ERROR;
+        if (node != NULL) {
+            n += ngx_http_route_index_lists(&node->uri, &segment, hash,
+                                            &lists[n]);
         }
+    }
 
-        variables->items = n;
+    n += ngx_http_route_index_lists(&routes->any_host, &segment, hash,
+                                    &lists[n]);
 
-        next = 0;
+    /* A route may be listed both by an exact host and by a suffix. */
+    last = routes->items;
+
+    for ( ;; ) {
+        list = NULL;
 
         for (i = 0; i < n; i++) {
-            nv = nxt_mp_alloc(mp, sizeof(ngx_http_name_value_t));
-            if (nxt_slow_path(nv == NULL)) {
-                return NXT_ERROR;
+            if (lists[i].items != 0
+                && (list == NULL || lists[i].index[0] < list->index[0]))
+            {
+                list = &lists[i];
             }
+        }
 
-            variable_conf = nxt_conf_next_object_member(variables_conf, &name, &next);
-            nxt_conf_get_string(variable_conf, &value);
+        if (list == NULL) {
+            return NULL;
+        }
 
-            nv->name_length = name.length;
-            nv->name = name.start;
-            nv->value_length = value.length;
-            nv->value = value.start;
+        if (list->index[0] != last) {
+            last = list->index[0];
 
-            variables->variable[i] = nv;
+            action = ngx_http_route_match(r, routes->match[last]);
+            if (action != NULL) {
+                return action;
+            }
         }
 
-        match->action.variables = variables;
+        list->index++;
+        list->items--;
     }
+}
 
-    blacklist_conf = accf.blacklist;
 
-    if (blacklist_conf != NULL) {
+static ngx_http_route_suffix_t *
+ngx_http_route_suffix_find(nxt_lvlhsh_t *labels, nxt_str_t *host)
+{
+    u_char                   *p, *end;
+    nxt_str_t                label;
+    ngx_http_route_suffix_t  *node, *found;
 
-        array = (nxt_conf_type(blacklist_conf) == NXT_CONF_ARRAY);
-        n = array ? nxt_conf_array_elements_count(blacklist_conf) : 1;
+    found = NULL;
+    p = host->start + host->length;
 
-        size = sizeof(ngx_http_action_addr_t)
-               + n * sizeof(nxt_addr_pattern_t *);
+    for ( ;; ) {
+        end = p;
 
-        blacklist = nxt_mp_alloc(mp, size);
-        if (nxt_slow_path(blacklist == NULL)) {
-            return NXT_ERROR;
+        while (p > host->start && p[-1] != '.') {
+            p--;
         }
 
-        blacklist->items = n;
+        label.start = p;
+        label.length = end - p;
 
-        if (!array) {
-            pattern = &blacklist->addr_pattern[0];
+        node = ngx_http_route_index_find(labels, &label,
+                                         ngx_http_route_hash(label.start,
+                                                             label.length));
 
-            ret = nxt_addr_pattern_parse(mp, pattern, blacklist_conf);
-            if (ret != NXT_OK) {
-                return ret;
-            }
+        /* The suffix matches only if a dot precedes the label. */
 
-        } else {
-            for (i = 0; i < n; i++) {
-                pattern = &blacklist->addr_pattern[i];
-                addr_conf = nxt_conf_get_array_element(blacklist_conf, i);
+        if (node == NULL || p == host->start) {
+            return found;
+        }
 
-                ret = nxt_addr_pattern_parse(mp, pattern, addr_conf);
-                if (ret != NXT_OK) {
-                    return ret;
-                }
-            }
+        if (node->list.items != 0) {
+            found = node;
         }
 
-        match->action.blacklist = blacklist;
+        labels = &node->labels;
+        p--;
     }
+}
 
-    whitelist_conf = accf.whitelist;
 
-    if (whitelist_conf != NULL) {
+static nxt_uint_t
+ngx_http_route_index_lists(ngx_http_route_index_t *index, nxt_str_t *segment,
+    uint32_t hash, ngx_http_route_list_t *lists)
+{
+    nxt_uint_t                    n;
+    ngx_http_route_index_entry_t  *entry;
 
-        array = (nxt_conf_type(whitelist_conf) == NXT_CONF_ARRAY);
-        n = array ? nxt_conf_array_elements_count(whitelist_conf) : 1;
+    n = 0;
 
-        size = sizeof(ngx_http_action_addr_t)
-               + n * sizeof(nxt_addr_pattern_t *);
+    entry = ngx_http_route_index_find(&index->hash, segment, hash);
 
-        whitelist = nxt_mp_alloc(mp, size);
-        if (nxt_slow_path(whitelist == NULL)) {
-            return NXT_ERROR;
-        }
+    if (entry != NULL) {
+        lists[n++] = entry->list;
+    }
 
-        whitelist->items = n;
+    if (index->rest.items != 0) {
+        lists[n++] = index->rest;
+    }
 
-        if (!array) {
-            pattern = &whitelist->addr_pattern[0];
+    return n;
+}
 
-            ret = nxt_addr_pattern_parse(mp, pattern, whitelist_conf);
-            if (ret != NXT_OK) {
-                return ret;
-            }
 
-        } else {
-            for (i = 0; i < n; i++) {
-                pattern = &whitelist->addr_pattern[i];
-                addr_conf = nxt_conf_get_array_element(whitelist_conf, i);
+ngx_http_route_cache_t *
+ngx_http_route_cache_create(nxt_uint_t size,
+    ngx_http_route_cache_stats_t *stats)
+{
+    nxt_uint_t              buckets;
+    ngx_http_route_cache_t  *cache;
 
-                ret = nxt_addr_pattern_parse(mp, pattern, addr_conf);
-                if (ret != NXT_OK) {
-                    return ret;
-                }
-            }
-        }
+    buckets = 1;
 
-        match->action.whitelist = whitelist;
+    while (buckets < size) {
+        buckets <<= 1;
     }
 
-    headers_conf = accf.add_headers;
+    cache = nxt_zalloc(sizeof(ngx_http_route_cache_t)
+                       + size * sizeof(ngx_http_route_cache_entry_t)
+                       + buckets * sizeof(uint32_t));
+    if (nxt_slow_path(cache == NULL)) {
+        return NULL;
+    }
 
-    if (headers_conf != NULL) {
+    cache->size = size;
+    cache->mask = buckets - 1;
+    cache->bucket = (uint32_t *) &cache->entry[size];
+    cache->stats = stats;
 
-        n = nxt_conf_object_members_count(headers_conf);
+    nxt_queue_init(&cache->lru);
 
-        size = sizeof(ngx_http_action_headers_t)
-               + n * sizeof(ngx_http_name_value_t *);
+    return cache;
+}
 
-        headers = nxt_mp_alloc(mp, size);
-        if (nxt_slow_path(headers == NULL)) {
-            return NXT_ERROR;
-        }
 
-        headers->items = n;
+ngx_http_action_t *
+ngx_http_route_cache_action(ngx_http_request_t *r,
+    ngx_http_route_cache_t *cache, ngx_http_routes_t *routes,
+    uint64_t generation)
+{
+    u_char                        key[NGX_HTTP_ROUTE_CACHE_KEY];
+    size_t                        length;
+    uint32_t                      hash, n, *bucket;
+    nxt_queue_link_t              *lnk;
+    ngx_http_action_t             *action;
+    ngx_http_route_cache_entry_t  *entry;
+
+    if (!routes->cacheable) {
+        return ngx_http_route_action(r, routes);
+    }
 
-        next = 0;
+    length = ngx_http_route_cache_key(r, key);
 
-        for (i = 0; i < n; i++) {
-            nv = nxt_mp_alloc(mp, sizeof(ngx_http_name_value_t));
-            if (nxt_slow_path(nv == NULL)) {
-                return NXT_ERROR;
-            }
+    if (length == 0) {
+        return ngx_http_route_action(r, routes);
+    }
 
-            header_conf = nxt_conf_next_object_member(headers_conf, &name, &next);
-            nxt_conf_get_string(header_conf, &value);
+    if (cache->generation != generation) {
+        ngx_http_route_cache_flush(cache, generation);
+    }
 
-            nv->name_length = name.length;
-            nv->name = name.start;
-            nv->value_length = value.length;
-            nv->value = value.start;
+    hash = ngx_http_route_hash(key, length);
+    bucket = &cache->bucket[hash & cache->mask];
 
-            headers->header[i] = nv;
-        }
+    for (n = *bucket; n != 0; n = entry->next) {
+        entry = &cache->entry[n - 1];
 
-        match->action.add_headers = headers;
-    }
+        if (entry->hash == hash
+            && entry->length == length
+            && nxt_memcmp(entry->key, key, length) == 0)
+        {
+            nxt_queue_remove(&entry->link);
+            nxt_queue_insert_head(&cache->lru, &entry->link);
 
-    limit_conn_conf = accf.limit_conn;
+            cache->stats->hits++;
 
-    if (limit_conn_conf != NULL) {
-        limit_conn = nxt_mp_alloc(mp, sizeof(ngx_http_action_limit_conn_t));
-        if (nxt_slow_path(limit_conn == NULL)) {
-            return NXT_ERROR;
+            return entry->action;
         }
+    }
 
-        ret = nxt_conf_map_object(mp, limit_conn_conf,
-                                  ngx_http_route_action_limit_conn_conf,
-                                  nxt_nitems(ngx_http_route_action_limit_conn_conf),
-                                  limit_conn);
-        if (ret != NXT_OK) {
-            return ret;
-        }
+    cache->stats->misses++;
 
-        match->action.limit_conn = limit_conn;
+    action = ngx_http_route_action(r, routes);
+
+    if (action == NGX_HTTP_ACTION_ERROR) {
+        return action;
+    }
+
+    if (cache->used < cache->size) {
+        entry = &cache->entry[cache->used++];
+
+    } else {
+        lnk = nxt_queue_last(&cache->lru);
+        entry = nxt_queue_link_data(lnk, ngx_http_route_cache_entry_t, link);
+
+        ngx_http_route_cache_unlink(cache, entry);
+        nxt_queue_remove(&entry->link);
     }
 
-    limit_req_conf = accf.limit_req;
+    entry->hash = hash;
+    entry->action = action;
+    entry->length = length;
+    nxt_memcpy(entry->key, key, length);
 
-    if (limit_req_conf != NULL) {
-        limit_req = nxt_mp_alloc(mp, sizeof(ngx_http_action_limit_req_t));
-        if (nxt_slow_path(limit_req == NULL)) {
-            return NXT_ERROR;
-        }
+    entry->next = *bucket;
+    *bucket = entry - cache->entry + 1;
 
-        ret = nxt_conf_map_object(mp, limit_req_conf,
-                                  ngx_http_route_action_limit_req_conf,
-                                  nxt_nitems(ngx_http_route_action_limit_req_conf),
-                                  limit_req);
-        if (ret != NXT_OK) {
-            return ret;
-        }
+    nxt_queue_insert_head(&cache->lru, &entry->link);
 
-        limit_req->rate *= 1000;
+    return action;
+}
 
-        match->action.limit_req = limit_req;
+
+static size_t
+ngx_http_route_cache_key(ngx_http_request_t *r, u_char *key)
+{
+    u_char  *p;
+    size_t  length;
+
+    /*
+     * Neither the method nor the host contain spaces,
+     * so "scheme method host uri" is not ambiguous.
+     */
+
+    length = 2 + r->method_name.len + 1 + r->headers_in.server.len + 1
+             + r->uri.len;
+
+    if (length > NGX_HTTP_ROUTE_CACHE_KEY) {
+        return 0;
     }
 
-    match->action.limit_rate = accf.limit_rate;
+    p = key;
 
-    match->action.return_status = accf.return_status;
-    match->action.return_text = accf.return_text;
-    match->action.return_location = accf.return_location;
+#if (NGX_HTTP_SSL)
+    *p++ = (r->connection->ssl != NULL) ? 's' : 'p';
+#else
+    *p++ = 'p';
+#endif
 
-    return NXT_OK;
+    *p++ = ' ';
+    p = nxt_cpymem(p, r->method_name.data, r->method_name.len);
+    *p++ = ' ';
+    p = nxt_cpymem(p, r->headers_in.server.data, r->headers_in.server.len);
+    *p++ = ' ';
+    nxt_memcpy(p, r->uri.data, r->uri.len);
+
+    return length;
 }
 
 
-ngx_http_action_t *
-ngx_http_route_action(ngx_http_request_t *r, ngx_http_routes_t *routes)
+static void
+ngx_http_route_cache_flush(ngx_http_route_cache_t *cache, uint64_t generation)
 {
-    ngx_http_action_t       *action;
-    ngx_http_route_match_t  **match, **end;
+    /* The actions of the previous configuration may be already freed. */
 
-    match = &routes->match[0];
-    end = match + routes->items;
+    nxt_memzero(cache->bucket, (cache->mask + 1) * sizeof(uint32_t));
+    nxt_queue_init(&cache->lru);
 
-    while (match < end) {
-        action = ngx_http_route_match(r, *match);
-        if (action != NULL) {
-            return action;
-        }
+    cache->used = 0;
+    cache->generation = generation;
+}
+
+
+static void
+ngx_http_route_cache_unlink(ngx_http_route_cache_t *cache,
+    ngx_http_route_cache_entry_t *entry)
+{
+    uint32_t  n, *next;
 
-        match++;
+    n = entry - cache->entry + 1;
+    next = &cache->bucket[entry->hash & cache->mask];
+
+    while (*next != n) {
+        next = &cache->entry[*next - 1].next;
     }
 
-    return NULL;
+    *next = entry->next;
 }
 
 
@@ -1174,6 +3114,9 @@ ngx_http_route_rule(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
     case NGX_HTTP_ROUTE_ARGUMENT:
         return ngx_http_route_arguments(r, rule);
 
+    case NGX_HTTP_ROUTE_COOKIE:
+        return ngx_http_route_cookies(r, rule);
+
     case NGX_HTTP_ROUTE_SCHEME:
         return ngx_http_route_scheme(r, rule);
 
@@ -1209,16 +3152,88 @@ ngx_http_route_rule(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
 static nxt_int_t
 ngx_http_route_headers(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
 {
-    u_char               c;
-    uint32_t             hash;
-    nxt_int_t            ret;
-    ngx_str_t           *name, *value;
-    ngx_uint_t           i, j;
-    ngx_list_part_t     *part;
-    ngx_table_elt_t     *header;
+    uint32_t                 i;
+    nxt_int_t                ret;
+    ngx_http_name_value_t    *nv;
+    ngx_http_route_fields_t  *headers;
+
+    headers = ngx_http_route_headers_index(r);
+    if (nxt_slow_path(headers == NULL)) {
+        return -1;
+    }
 
     ret = 0;
-        
+
+    i = headers->bucket[rule->u.name.hash & headers->mask];
+
+    while (i != 0) {
+        nv = &headers->field[i - 1];
+        i = headers->next[i - 1];
+
+        if (rule->u.name.hash != nv->hash
+            || rule->u.name.length != nv->name_length
+            || nxt_strncasecmp(rule->u.name.start, nv->name, nv->name_length)
+               != 0)
+        {
+            continue;
+        }
+
+        ret = ngx_http_route_test_rule(rule, nv->value, nv->value_length);
+
+        if (ret == 0) {
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+
+static ngx_http_route_fields_t *
+ngx_http_route_headers_index(ngx_http_request_t *r)
+{
+    size_t                   size;
+    uint32_t                 mask, n;
+    ngx_str_t                *name;
+    ngx_uint_t               i;
+    ngx_list_part_t          *part;
+    ngx_table_elt_t          *header;
+    ngx_http_ctrl_ctx_t      *ctx;
+    ngx_http_name_value_t    *nv;
+    ngx_http_route_fields_t  *headers;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+
+    if (ctx->route.headers != NULL) {
+        return ctx->route.headers;
+    }
+
+    n = 0;
+
+    for (part = &r->headers_in.headers.part; part != NULL; part = part->next) {
+        n += part->nelts;
+    }
+
+    for (mask = 1; mask < n; mask <<= 1) { /* void */ }
+
+    mask--;
+
+    size = sizeof(ngx_http_route_fields_t)
+           + n * sizeof(ngx_http_name_value_t)
+           + (mask + 1 + n) * sizeof(uint32_t);
+
+    headers = nxt_mp_zalloc(ctx->mem_pool, size);
+    if (nxt_slow_path(headers == NULL)) {
+        return NULL;
+    }
+
+    headers->mask = mask;
+    headers->bucket = (uint32_t *) &headers->field[n];
+    headers->next = headers->bucket + mask + 1;
+
+    n = 0;
+    nv = &headers->field[0];
+
     part = &r->headers_in.headers.part;
     header = part->elts;
 
@@ -1235,43 +3250,33 @@ ngx_http_route_headers(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
         }
 
         name = &header[i].key;
-        value = &header[i].value;
-
-        hash = NGX_HTTP_FIELD_HASH_INIT;
-
-        for (j = 0; j < name->len; j++) {
-            c = name->data[j];
-            c = nxt_lowcase(c);
-            hash = ngx_http_field_hash_char(hash, c);
-        }
 
-        hash = ngx_http_field_hash_end(hash) & 0xFFFF;
-
-        if (rule->u.name.hash != hash
-            || rule->u.name.length != name->len
-            || nxt_strncasecmp(rule->u.name.start, name->data, name->len)
-               != 0)
-        {
+        if (name->len > 0xFFFF) {
             continue;
         }
 
-        ret = ngx_http_route_test_rule(rule, value->data, value->len);
+        nv->hash = ngx_http_field_hash_lowcase(name->data, name->len);
+        nv->name_length = name->len;
+        nv->name = name->data;
+        nv->value_length = header[i].value.len;
+        nv->value = header[i].value.data;
 
-        if (ret == 0) {
-            return ret;
-        }
+        headers->next[n] = headers->bucket[nv->hash & mask];
+        headers->bucket[nv->hash & mask] = ++n;
+
+        nv++;
     }
 
-    return ret;
+    ctx->route.headers = headers;
+
+    return headers;
 }
 
 
 static nxt_int_t
 ngx_http_route_arguments(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
 {
-    nxt_bool_t             ret;
-    nxt_array_t            *arguments;
-    ngx_http_name_value_t  *nv, *end;
+    nxt_array_t  *arguments;
 
     if (r->args.data == NULL) {
         return 0;
@@ -1282,10 +3287,34 @@ ngx_http_route_arguments(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
         return -1;
     }
 
+    return ngx_http_route_name_values(arguments, rule);
+}
+
+
+static nxt_int_t
+ngx_http_route_cookies(ngx_http_request_t *r, ngx_http_route_rule_t *rule)
+{
+    nxt_array_t  *cookies;
+
+    cookies = ngx_http_cookies_parse(r);
+    if (nxt_slow_path(cookies == NULL)) {
+        return -1;
+    }
+
+    return ngx_http_route_name_values(cookies, rule);
+}
+
+
+static nxt_int_t
+ngx_http_route_name_values(nxt_array_t *array, ngx_http_route_rule_t *rule)
+{
+    nxt_bool_t             ret;
+    ngx_http_name_value_t  *nv, *end;
+
     ret = 0;
 
-    nv = arguments->elts;
-    end = nv + arguments->nelts;
+    nv = array->elts;
+    end = nv + array->nelts;
 
     while (nv < end) {
 
@@ -1348,6 +3377,10 @@ ngx_http_route_test_rule(ngx_http_route_rule_t *rule, u_char *start,
     nxt_int_t                 ret;
     ngx_http_route_pattern_t  *pattern, *end;
 
+    if (rule->automaton != NULL) {
+        return ngx_http_route_test_automaton(rule, start, length);
+    }
+
     ret = 1;
     pattern = &rule->pattern[0];
     end = pattern + rule->items;
@@ -1369,6 +3402,84 @@ ngx_http_route_test_rule(ngx_http_route_rule_t *rule, u_char *start,
 }
 
 
+/*
+ * The same result as the patterns tested one by one: no negative pattern
+ * may match, and some positive pattern must match if there are any.
+ */
+
+static nxt_int_t
+ngx_http_route_test_automaton(ngx_http_route_rule_t *rule, u_char *start,
+    size_t length)
+{
+    nxt_uint_t                found;
+    ngx_http_route_pattern_t  *pattern, *end;
+
+    pattern = &rule->pattern[0];
+    end = pattern + rule->items;
+
+    /* The negative patterns go first. */
+
+    while (pattern < end && pattern->negative) {
+        if (ngx_http_route_pattern(pattern, start, length)) {
+            return 0;
+        }
+
+        pattern++;
+    }
+
+    found = ngx_http_route_automaton(rule->automaton, start, length);
+
+    if (found & NGX_HTTP_ROUTE_FOUND_NEGATIVE) {
+        return 0;
+    }
+
+    if (found & NGX_HTTP_ROUTE_FOUND_POSITIVE) {
+        return 1;
+    }
+
+    if (pattern == end) {
+        return !rule->automaton->positive;
+    }
+
+    while (pattern < end) {
+        if (ngx_http_route_pattern(pattern, start, length)) {
+            return 1;
+        }
+
+        pattern++;
+    }
+
+    return 0;
+}
+
+
+static nxt_uint_t
+ngx_http_route_automaton(ngx_http_route_automaton_t *ac, u_char *start,
+    size_t length)
+{
+    u_char      *end;
+    uint32_t    state;
+    nxt_uint_t  found;
+
+    found = 0;
+    state = 0;
+
+    for (end = start + length; start < end; start++) {
+        state = ac->next[(state >> 2) + ac->map[*start]];
+
+        if (state & 3) {
+            found |= state & 3;
+
+            if (found & ac->stop) {
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+
 static nxt_int_t
 ngx_http_route_pattern(ngx_http_route_pattern_t *pattern, u_char *start,
     size_t length)
@@ -1423,6 +3534,11 @@ ngx_http_route_pattern(ngx_http_route_pattern_t *pattern, u_char *start,
         }
 
         return (p != NULL);
+
+#if (NXT_HAVE_REGEX)
+    case NGX_HTTP_ROUTE_PATTERN_REGEX:
+        return ngx_http_route_regex(pattern->regex, start, length);
+#endif
     }
 
     return ngx_http_route_memcmp(start, test, test_length,
@@ -1447,9 +3563,38 @@ ngx_http_route_memcmp(u_char *start, u_char *test, size_t test_length,
 }
 
 
+#if (NXT_HAVE_REGEX)
+
+static nxt_int_t
+ngx_http_route_regex(nxt_regex_t *regex, u_char *start, size_t length)
+{
+    nxt_int_t  ret;
+
+    /*
+     * Patterns have no captures, so a single match data block
+     * is shared by all the requests of the worker process.
+     */
+
+    static nxt_regex_match_t  *match;
+
+    if (nxt_slow_path(match == NULL)) {
+        match = nxt_regex_match_create(NULL, 1);
+        if (nxt_slow_path(match == NULL)) {
+            return 0;
+        }
+    }
+
+    ret = nxt_regex_match(regex, start, length, match);
+
+    return (ret == 1);
+}
+
+#endif
+
+
 static ngx_http_name_value_t *
 ngx_http_argument(nxt_array_t *array, u_char *name, size_t name_length,
-    uint32_t hash, u_char *start, u_char *end)
+    u_char *start, u_char *end)
 {
     size_t                 length;
     ngx_http_name_value_t  *nv;
@@ -1459,8 +3604,6 @@ ngx_http_argument(nxt_array_t *array, u_char *name, size_t name_length,
         return NULL;
     }
 
-    nv->hash = ngx_http_field_hash_end(hash) & 0xFFFF;
-
     length = end - start;
 
     if (name == NULL) {
@@ -1469,6 +3612,8 @@ ngx_http_argument(nxt_array_t *array, u_char *name, size_t name_length,
         length = 0;
     }
 
+    nv->hash = ngx_http_field_hash(name, name_length);
+
     nv->name_length = name_length;
     nv->value_length = length;
     nv->name = name;
@@ -1483,7 +3628,6 @@ ngx_http_arguments_parse(ngx_http_request_t *r)
 {
     size_t                 name_length;
     u_char                 c, *p, *start, *end, *name;
-    uint32_t               hash;
     nxt_bool_t             valid;
     nxt_array_t            *args;
     ngx_http_ctrl_ctx_t    *ctx;
@@ -1491,12 +3635,20 @@ ngx_http_arguments_parse(ngx_http_request_t *r)
 
     ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
 
+    /* The arguments may be changed by rewrites. */
+
+    if (ctx->route.arguments != NULL
+        && ctx->route.args.data == r->args.data
+        && ctx->route.args.len == r->args.len)
+    {
+        return ctx->route.arguments;
+    }
+
     args = nxt_array_create(ctx->mem_pool, 2, sizeof(ngx_http_name_value_t));
     if (nxt_slow_path(args == NULL)) {
         return NULL;
     }
 
-    hash = NGX_HTTP_FIELD_HASH_INIT;
     valid = 1;
     name = NULL;
     name_length = 0;
@@ -1515,29 +3667,136 @@ ngx_http_arguments_parse(ngx_http_request_t *r)
 
         } else if (c == '&') {
             if (valid) {
-                nv = ngx_http_argument(args, name, name_length, hash,
-                                       start, p);
+                nv = ngx_http_argument(args, name, name_length, start, p);
                 if (nxt_slow_path(nv == NULL)) {
                     return NULL;
                 }
             }
 
-            hash = NGX_HTTP_FIELD_HASH_INIT;
             valid = 1;
             name = NULL;
             start = p + 1;
-
-        } else if (name == NULL) {
-            hash = ngx_http_field_hash_char(hash, c);
         }
     }
 
     if (valid) {
-        nv = ngx_http_argument(args, name, name_length, hash, start, p);
+        nv = ngx_http_argument(args, name, name_length, start, p);
         if (nxt_slow_path(nv == NULL)) {
             return NULL;
         }
     }
 
+    ctx->route.args = r->args;
+    ctx->route.arguments = args;
+
     return args;
 }
+
+
+static nxt_array_t *
+ngx_http_cookies_parse(ngx_http_request_t *r)
+{
+    uint32_t                 i, hash;
+    nxt_array_t              *cookies;
+    ngx_http_ctrl_ctx_t      *ctx;
+    ngx_http_name_value_t    *nv;
+    ngx_http_route_fields_t  *headers;
+
+    static const u_char      cookie[] = "cookie";
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_ctrl_module);
+
+    if (ctx->route.cookies != NULL) {
+        return ctx->route.cookies;
+    }
+
+    headers = ngx_http_route_headers_index(r);
+    if (nxt_slow_path(headers == NULL)) {
+        return NULL;
+    }
+
+    cookies = nxt_array_create(ctx->mem_pool, 4, sizeof(ngx_http_name_value_t));
+    if (nxt_slow_path(cookies == NULL)) {
+        return NULL;
+    }
+
+    hash = ngx_http_field_hash_lowcase(cookie, nxt_length(cookie));
+
+    /* All the "Cookie" header lines are tokenized at once. */
+
+    i = headers->bucket[hash & headers->mask];
+
+    while (i != 0) {
+        nv = &headers->field[i - 1];
+        i = headers->next[i - 1];
+
+        if (nv->hash != hash
+            || nv->name_length != nxt_length(cookie)
+            || nxt_strncasecmp(nv->name, (u_char *) cookie, nxt_length(cookie))
+               != 0)
+        {
+            continue;
+        }
+
+        if (nxt_slow_path(ngx_http_cookie_parse(cookies, nv->value,
+                                                nv->value + nv->value_length)
+                          != NXT_OK))
+        {
+            return NULL;
+        }
+    }
+
+    ctx->route.cookies = cookies;
+
+    return cookies;
+}
+
+
+static nxt_int_t
+ngx_http_cookie_parse(nxt_array_t *cookies, u_char *start, u_char *end)
+{
+    size_t                 name_length;
+    u_char                 c, *p, *name;
+    ngx_http_name_value_t  *nv;
+
+    name = NULL;
+    name_length = 0;
+
+    for (p = start; p < end; p++) {
+        c = *p;
+
+        if (c == ';') {
+            if (name != NULL) {
+                nv = ngx_http_argument(cookies, name, name_length, start, p);
+                if (nxt_slow_path(nv == NULL)) {
+                    return NXT_ERROR;
+                }
+            }
+
+            name = NULL;
+            start = p + 1;
+
+        } else if (name == NULL) {
+
+            if (c == '=') {
+                name_length = p - start;
+                name = start;
+                start = p + 1;
+
+            } else if (p == start && (c == ' ' || c == '\t')) {
+                start++;
+            }
+        }
+    }
+
+    /* A cookie without "=" is ignored. */
+
+    if (name != NULL) {
+        nv = ngx_http_argument(cookies, name, name_length, start, p);
+        if (nxt_slow_path(nv == NULL)) {
+            return NXT_ERROR;
+        }
+    }
+
+    return NXT_OK;
+}
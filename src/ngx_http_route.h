@@ -10,6 +10,8 @@
 
 typedef struct ngx_http_routes_s    ngx_http_routes_t;
 typedef struct ngx_http_conf_s      ngx_http_conf_t;
+typedef struct ngx_http_route_fields_s  ngx_http_route_fields_t;
+typedef struct ngx_http_route_cache_s   ngx_http_route_cache_t;
 
 
 typedef struct {
@@ -21,37 +23,122 @@ typedef struct {
 } ngx_http_name_value_t;
 
 
+/*
+ * The match context is shared by all rules evaluated for a request:
+ * the arguments and cookies are parsed and the headers are indexed
+ * only once.
+ */
+
+typedef struct {
+    ngx_str_t                       args;
+    nxt_array_t                     *arguments;
+    nxt_array_t                     *cookies;
+    ngx_http_route_fields_t         *headers;
+} ngx_http_route_ctx_t;
+
+
+typedef struct {
+    ngx_atomic_t                    hits;
+    ngx_atomic_t                    misses;
+} ngx_http_route_cache_stats_t;
+
+
+/*
+ * The variables are resolved when the route is created, the request
+ * gets the prebuilt values.
+ */
+
+typedef struct {
+    ngx_http_variable_t             *variable;
+    ngx_http_variable_value_t       value;
+} ngx_http_action_variable_t;
+
+
 typedef struct {
     uint32_t                        items;
-    ngx_http_name_value_t           *variable[0];
+    ngx_http_action_variable_t      variable[0];
 } ngx_http_action_variables_t;
 
 
 typedef struct {
-    uint32_t                        items;
-    nxt_addr_pattern_t              addr_pattern[0];
+    nxt_addr_tree_t                 *tree;
 } ngx_http_action_addr_t;
 
 
+/*
+ * The response headers are prebuilt list elements, they are copied
+ * into the response as is.
+ */
+
 typedef struct {
     uint32_t                        items;
-    ngx_http_name_value_t           *header[0];
+    nxt_bool_t                      always;
+    ngx_table_elt_t                 header[0];
 } ngx_http_action_headers_t;
 
 
+/*
+ * A limit key is a sequence of literal and variable parts.  The
+ * variables are resolved when the route is created: the indexed ones
+ * are read from the request, the others are got by their handlers.
+ */
+
+typedef struct {
+    ngx_str_t                       text;
+    ngx_http_variable_t             *variable;
+    ngx_int_t                       index;
+    uintptr_t                       data;
+} ngx_http_action_key_part_t;
+
+
+typedef struct {
+    nxt_uint_t                      nparts;
+    ngx_http_action_key_part_t      *parts;
+} ngx_http_action_key_t;
+
+
 typedef struct {
     nxt_str_t                       key;
+    ngx_http_action_key_t           complex_key;
     nxt_uint_t                      conn;
 } ngx_http_action_limit_conn_t;
 
 
+typedef enum {
+    NGX_HTTP_LIMIT_REQ_LEAKY_BUCKET = 0,
+    NGX_HTTP_LIMIT_REQ_GCRA,
+    NGX_HTTP_LIMIT_REQ_LOCAL,
+} ngx_http_action_limit_req_mode_t;
+
+
 typedef struct {
     nxt_str_t                       key;
+    ngx_http_action_key_t           complex_key;
     nxt_uint_t                      rate;
     nxt_uint_t                      burst;
+    nxt_uint_t                      delay;
+    nxt_str_t                       algorithm;
+    nxt_uint_t                      mode;
+    uint8_t                         nodelay;  /* 1 bit */
 } ngx_http_action_limit_req_t;
 
 
+/*
+ * The return response is prebuilt: a request copies the buffer and the
+ * header elements, the body is shared read-only.
+ */
+
+typedef struct {
+    ngx_str_t                       type;
+    ngx_table_elt_t                 location;
+    ngx_buf_t                       body;
+#if (NGX_HTTP_GZIP && NGX_ZLIB)
+    ngx_buf_t                       gzip;
+    ngx_table_elt_t                 content_encoding;
+#endif
+} ngx_http_action_response_t;
+
+
 typedef struct {
     ngx_http_action_variables_t     *variables;
     ngx_http_action_addr_t          *blacklist;
@@ -63,6 +150,7 @@ typedef struct {
     nxt_uint_t                       return_status;
     nxt_str_t                        return_text;
     nxt_str_t                        return_location;
+    ngx_http_action_response_t      *response;
 } ngx_http_action_t;
 
 
@@ -70,9 +158,19 @@ ngx_http_routes_t *ngx_http_routes_create(ngx_http_conf_t *conf,
     nxt_conf_value_t *routes_conf);
 ngx_http_action_t *ngx_http_route_action(ngx_http_request_t *r,
     ngx_http_routes_t *routes);
+nxt_int_t ngx_http_route_variable_check(void *ctx, nxt_mp_t *mp,
+    nxt_str_t *name);
+ngx_http_route_cache_t *ngx_http_route_cache_create(nxt_uint_t size,
+    ngx_http_route_cache_stats_t *stats);
+ngx_http_action_t *ngx_http_route_cache_action(ngx_http_request_t *r,
+    ngx_http_route_cache_t *cache, ngx_http_routes_t *routes,
+    uint64_t generation);
 
 
 #define NGX_HTTP_ACTION_ERROR  ((ngx_http_action_t *) -1)
 
+/* The cache entries are indexed by 32-bit numbers. */
+#define NGX_HTTP_ROUTE_CACHE_MAX  (1024 * 1024)
+
 
 #endif /* _NGX_HTTP_ROUTE_H_INCLUDED_ */
@@ -13,14 +13,72 @@ static nxt_bool_t nxt_valid_ipv6_blocks(u_char *c, size_t len);
 #endif
 
 
+typedef struct {
+    nxt_addr_node_t        *nodes;
+    uint32_t               items;
+    uint32_t               size;
+
+    const u_char           *low;
+    const u_char           *high;
+    nxt_uint_t             levels;
+} nxt_addr_tree_build_t;
+
+
+static nxt_int_t nxt_addr_tree_init(nxt_addr_tree_build_t *build);
+static nxt_int_t nxt_addr_tree_add(nxt_addr_tree_build_t *build,
+    nxt_addr_pattern_t *p);
+static uint32_t nxt_addr_tree_node(nxt_addr_tree_build_t *build);
+static nxt_int_t nxt_addr_tree_range(nxt_addr_tree_build_t *build,
+    uint32_t node, nxt_uint_t level, nxt_bool_t low, nxt_bool_t high);
+static nxt_bool_t nxt_addr_tree_tail(const u_char *addr, nxt_uint_t level,
+    nxt_uint_t levels, nxt_uint_t fill);
+static nxt_addr_tree_t *nxt_addr_tree_map(nxt_mp_t *mp, nxt_file_t *image,
+    nxt_file_info_t *fi);
+static nxt_bool_t nxt_addr_tree_valid(nxt_addr_node_t *nodes, uint32_t items);
+static void nxt_addr_tree_unmap(void *data);
+static nxt_int_t nxt_addr_tree_compile(nxt_mp_t *mp, nxt_file_t *file,
+    nxt_file_t *image, nxt_file_info_t *fi, nxt_str_t *error);
+static nxt_int_t nxt_addr_tree_write(nxt_mp_t *mp, nxt_addr_tree_build_t *build,
+    nxt_file_t *image, nxt_file_info_t *fi, nxt_str_t *error);
+static void nxt_addr_tree_error(nxt_mp_t *mp, nxt_str_t *error,
+    const char *fmt, ...);
+
+
+/*
+ * The image of a tree compiled from a list file.  The header takes the
+ * place of the first node, so the mapped nodes stay cache line aligned.
+ * The source file attributes tell whether the image is up to date, the
+ * nanoseconds of mtime, where stat() has them, catch an edit within the
+ * second of the last one.
+ */
+
+#define NXT_ADDR_IMAGE_MAGIC   "NXTADDR2"
+#define NXT_ADDR_ERROR_LEN     256
+
+/* The reasons are only logged, so the API cannot probe other paths. */
+#define NXT_ADDR_READ_ERROR    "cannot read the list file"
+
+
+typedef struct {
+    u_char                 magic[8];
+    uint64_t               items;
+    uint64_t               ino;
+    uint64_t               size;
+    uint64_t               mtime;
+    uint64_t               mtime_nsec;
+} nxt_addr_image_t;
+
+
+#define nxt_addr_nibble(addr, level)                                          \
+    (((level) & 1) ? ((addr)[(level) >> 1] & 0x0F)                            \
+                   : ((addr)[(level) >> 1] >> 4))
+
+
 nxt_int_t
 nxt_addr_pattern_parse(nxt_mp_t *mp, nxt_addr_pattern_t *pattern,
     nxt_conf_value_t *cv)
 {
-    u_char                 *delim;
-    nxt_int_t              ret, cidr_prefix;
-    nxt_str_t              addr;
-    nxt_addr_range_t       *inet;
+    nxt_str_t  addr;
 
     if (nxt_conf_type(cv) != NXT_CONF_STRING) {
         return NXT_ADDR_PATTERN_CV_TYPE_ERROR;
@@ -28,6 +86,20 @@ nxt_addr_pattern_parse(nxt_mp_t *mp, nxt_addr_pattern_t *pattern,
 
     nxt_conf_get_string(cv, &addr);
 
+    return nxt_addr_pattern_parse_str(pattern, &addr);
+}
+
+
+nxt_int_t
+nxt_addr_pattern_parse_str(nxt_addr_pattern_t *pattern, nxt_str_t *str)
+{
+    u_char                 *delim;
+    nxt_int_t              ret, cidr_prefix;
+    nxt_str_t              addr;
+    nxt_addr_range_t       *inet;
+
+    addr = *str;
+
     if (nxt_slow_path(addr.length < 2)) {
         return NXT_ADDR_PATTERN_LENGTH_ERROR;
     }
@@ -199,7 +271,7 @@ nxt_addr_pattern_parse(nxt_mp_t *mp, nxt_addr_pattern_t *pattern,
         }
 
         addr.length = delim - addr.start;
-        inet->end = htonl(0xFFFFFFFF & (0xFFFFFFFF << (32 - cidr_prefix)));
+        inet->end = htonl((uint32_t) (0xFFFFFFFFULL << (32 - cidr_prefix)));
 
         inet->start = nxt_inet_addr(addr.start, addr.length) & inet->end;
         if (nxt_slow_path(inet->start == INADDR_NONE)) {
@@ -211,6 +283,9 @@ nxt_addr_pattern_parse(nxt_mp_t *mp, nxt_addr_pattern_t *pattern,
 
         } else if (cidr_prefix < 32) {
             pattern->match_type = NXT_ADDR_CIDR;
+
+        } else {
+            pattern->match_type = NXT_ADDR_EXACT;
         }
 
         return NXT_OK;
@@ -386,3 +461,714 @@ nxt_addr_pattern_match(nxt_addr_pattern_t *p, nxt_sockaddr_t *sa)
 
     return match;
 }
+
+
+nxt_addr_tree_t *
+nxt_addr_tree_create(nxt_mp_t *mp, nxt_addr_pattern_t *patterns, nxt_uint_t n)
+{
+    nxt_int_t              ret;
+    nxt_uint_t             i;
+    nxt_addr_tree_t        *tree;
+    nxt_addr_tree_build_t  build;
+
+    tree = nxt_mp_alloc(mp, sizeof(nxt_addr_tree_t));
+    if (nxt_slow_path(tree == NULL)) {
+        return NULL;
+    }
+
+    if (nxt_slow_path(nxt_addr_tree_init(&build) != NXT_OK)) {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        ret = nxt_addr_tree_add(&build, &patterns[i]);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            goto fail;
+        }
+    }
+
+    tree->items = build.items;
+    tree->nodes = nxt_mp_align(mp, sizeof(nxt_addr_node_t),
+                               build.items * sizeof(nxt_addr_node_t));
+    if (nxt_slow_path(tree->nodes == NULL)) {
+        goto fail;
+    }
+
+    nxt_memcpy(tree->nodes, build.nodes,
+               build.items * sizeof(nxt_addr_node_t));
+
+    nxt_free(build.nodes);
+
+    return tree;
+
+fail:
+
+    nxt_free(build.nodes);
+
+    return NULL;
+}
+
+
+static nxt_int_t
+nxt_addr_tree_init(nxt_addr_tree_build_t *build)
+{
+    build->size = 16;
+    build->items = 2;
+
+    build->nodes = nxt_zalloc(build->size * sizeof(nxt_addr_node_t));
+    if (nxt_slow_path(build->nodes == NULL)) {
+        return NXT_ERROR;
+    }
+
+    return NXT_OK;
+}
+
+
+static nxt_int_t
+nxt_addr_tree_add(nxt_addr_tree_build_t *build, nxt_addr_pattern_t *p)
+{
+    u_char      *start, *end;
+    uint32_t    root;
+    nxt_uint_t  i, length;
+    u_char      low[16], high[16];
+
+    switch (p->addr_family) {
+
+    case AF_INET:
+        root = NXT_ADDR_TREE_INET;
+        length = sizeof(struct in_addr);
+        start = (u_char *) &p->addr.v4.start;
+        end = (u_char *) &p->addr.v4.end;
+        break;
+
+#if (NXT_INET6)
+    case AF_INET6:
+        root = NXT_ADDR_TREE_INET6;
+        length = sizeof(struct in6_addr);
+        start = p->addr.v6.start.s6_addr;
+        end = p->addr.v6.end.s6_addr;
+        break;
+#endif
+
+    default:
+        return NXT_OK;
+    }
+
+    /* Every pattern is converted to the [low, high] range in network order. */
+
+    for (i = 0; i < length; i++) {
+
+        switch (p->match_type) {
+
+        case NXT_ADDR_ANY:
+            low[i] = 0x00;
+            high[i] = 0xFF;
+            break;
+
+        case NXT_ADDR_EXACT:
+            low[i] = start[i];
+            high[i] = start[i];
+            break;
+
+        case NXT_ADDR_RANGE:
+            low[i] = start[i];
+            high[i] = end[i];
+            break;
+
+        default: /* NXT_ADDR_CIDR, "end" is the mask. */
+            low[i] = start[i];
+            high[i] = start[i] | (u_char) ~end[i];
+            break;
+        }
+    }
+
+    build->low = low;
+    build->high = high;
+    build->levels = length * 2;
+
+    return nxt_addr_tree_range(build, root, 0, 1, 1);
+}
+
+
+/*
+ * Covers the slots of the node that lie within the range.  "low" and
+ * "high" tell whether the node lies on the lower or the upper boundary
+ * of the range, so only the boundary slots may need deeper nodes.
+ */
+
+static nxt_int_t
+nxt_addr_tree_range(nxt_addr_tree_build_t *build, uint32_t node,
+    nxt_uint_t level, nxt_bool_t low, nxt_bool_t high)
+{
+    uint32_t    slot;
+    nxt_int_t   ret;
+    nxt_uint_t  n, first, last;
+    nxt_bool_t  child_low, child_high;
+
+    first = low ? nxt_addr_nibble(build->low, level) : 0;
+    last = high ? nxt_addr_nibble(build->high, level)
+                : NXT_ADDR_TREE_SLOTS - 1;
+
+    for (n = first; n <= last; n++) {
+        slot = build->nodes[node].slot[n];
+
+        if (slot == NXT_ADDR_TREE_MATCH) {
+            continue;
+        }
+
+        child_low = (low && n == first
+                     && !nxt_addr_tree_tail(build->low, level + 1,
+                                            build->levels, 0x00));
+
+        child_high = (high && n == last
+                      && !nxt_addr_tree_tail(build->high, level + 1,
+                                             build->levels, 0x0F));
+
+        if (!child_low && !child_high) {
+            build->nodes[node].slot[n] = NXT_ADDR_TREE_MATCH;
+            continue;
+        }
+
+        if (slot == 0) {
+            slot = nxt_addr_tree_node(build);
+            if (nxt_slow_path(slot == 0)) {
+                return NXT_ERROR;
+            }
+
+            build->nodes[node].slot[n] = slot;
+        }
+
+        ret = nxt_addr_tree_range(build, slot, level + 1, child_low,
+                                  child_high);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return ret;
+        }
+    }
+
+    return NXT_OK;
+}
+
+
+static nxt_bool_t
+nxt_addr_tree_tail(const u_char *addr, nxt_uint_t level, nxt_uint_t levels,
+    nxt_uint_t fill)
+{
+    while (level < levels) {
+        if (nxt_addr_nibble(addr, level) != fill) {
+            return 0;
+        }
+
+        level++;
+    }
+
+    return 1;
+}
+
+
+static uint32_t
+nxt_addr_tree_node(nxt_addr_tree_build_t *build)
+{
+    uint32_t         size;
+    nxt_addr_node_t  *nodes;
+
+    if (build->items == build->size) {
+        size = build->size * 2;
+
+        nodes = nxt_realloc(build->nodes, size * sizeof(nxt_addr_node_t));
+        if (nxt_slow_path(nodes == NULL)) {
+            return 0;
+        }
+
+        build->nodes = nodes;
+        build->size = size;
+    }
+
+    nxt_memzero(&build->nodes[build->items], sizeof(nxt_addr_node_t));
+
+    return build->items++;
+}
+
+
+nxt_bool_t
+nxt_addr_tree_match(nxt_addr_tree_t *tree, struct sockaddr *sa)
+{
+    u_char      *addr;
+    uint32_t    slot;
+    nxt_uint_t  level, levels;
+
+    switch (sa->sa_family) {
+
+    case AF_INET:
+        slot = NXT_ADDR_TREE_INET;
+        addr = (u_char *) &((struct sockaddr_in *) sa)->sin_addr;
+        levels = sizeof(struct in_addr) * 2;
+        break;
+
+#if (NXT_INET6)
+    case AF_INET6:
+        slot = NXT_ADDR_TREE_INET6;
+        addr = ((struct sockaddr_in6 *) sa)->sin6_addr.s6_addr;
+        levels = sizeof(struct in6_addr) * 2;
+        break;
+#endif
+
+    default:
+        return 0;
+    }
+
+    for (level = 0; level < levels; level++) {
+        slot = tree->nodes[slot].slot[nxt_addr_nibble(addr, level)];
+
+        if (slot == 0) {
+            return 0;
+        }
+
+        if (slot == NXT_ADDR_TREE_MATCH) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Parses the address list file "name" without compiling it. */
+
+nxt_int_t
+nxt_addr_list_check(nxt_mp_t *mp, nxt_str_t *name, nxt_str_t *error)
+{
+    nxt_file_t       file;
+    nxt_file_info_t  fi;
+
+    nxt_memzero(&file, sizeof(nxt_file_t));
+
+    error->length = 0;
+
+    file.name = nxt_mp_nget(mp, name->length + 1);
+    if (nxt_slow_path(file.name == NULL)) {
+        return NXT_ERROR;
+    }
+
+    nxt_memcpy(file.name, name->start, name->length);
+    file.name[name->length] = '\0';
+    file.fd = NXT_FILE_INVALID;
+
+    return nxt_addr_tree_compile(mp, &file, NULL, &fi, error);
+}
+
+
+/*
+ * Loads the tree of the address list file "name", one pattern per line.
+ * The list is compiled once into an image in the directory "dir", named
+ * by the hash of the list path, and the image is mapped read-only, so
+ * all worker processes share its pages.  The image is replaced by
+ * rename(), so the trees that are already mapped are not affected.
+ */
+
+nxt_addr_tree_t *
+nxt_addr_tree_load(nxt_mp_t *mp, nxt_str_t *name, nxt_str_t *dir,
+    nxt_str_t *error)
+{
+    u_char           *p;
+    nxt_int_t        ret;
+    nxt_file_t       file, image;
+    nxt_file_info_t  fi;
+    nxt_addr_tree_t  *tree;
+
+    nxt_memzero(&file, sizeof(nxt_file_t));
+    nxt_memzero(&image, sizeof(nxt_file_t));
+
+    error->length = 0;
+
+    p = nxt_mp_nget(mp, name->length + dir->length
+                        + nxt_length("/12345678.trie") + 2);
+    if (nxt_slow_path(p == NULL)) {
+        return NULL;
+    }
+
+    file.name = p;
+    file.fd = NXT_FILE_INVALID;
+
+    p = nxt_cpymem(p, name->start, name->length);
+    *p++ = '\0';
+
+    image.name = p;
+    image.fd = NXT_FILE_INVALID;
+
+    p = nxt_cpymem(p, dir->start, dir->length);
+
+    (void) nxt_sprintf(p, p + nxt_length("/12345678.trie") + 1,
+                       "/%08xD.trie%Z",
+                       nxt_djb_hash(name->start, name->length));
+
+    ret = nxt_file_info(&file, &fi);
+    if (ret != NXT_OK) {
+        nxt_thread_log_error(NXT_LOG_ERR, "stat() \"%s\" failed (%d: %s)",
+                             file.name, file.error, strerror(file.error));
+        nxt_addr_tree_error(mp, error, NXT_ADDR_READ_ERROR);
+        return NULL;
+    }
+
+    tree = nxt_addr_tree_map(mp, &image, &fi);
+    if (tree != NULL) {
+        return tree;
+    }
+
+    ret = nxt_addr_tree_compile(mp, &file, &image, &fi, error);
+    if (ret != NXT_OK) {
+        return NULL;
+    }
+
+    tree = nxt_addr_tree_map(mp, &image, &fi);
+    if (nxt_slow_path(tree == NULL)) {
+        nxt_addr_tree_error(mp, error, "the image \"%s\" cannot be mapped",
+                            image.name);
+    }
+
+    return tree;
+}
+
+
+static nxt_addr_tree_t *
+nxt_addr_tree_map(nxt_mp_t *mp, nxt_file_t *image, nxt_file_info_t *fi)
+{
+    u_char            *map;
+    size_t            size;
+    ssize_t           n;
+    nxt_int_t         ret;
+    nxt_file_info_t   info;
+    nxt_addr_tree_t   *tree;
+    nxt_addr_image_t  header;
+
+    ret = nxt_file_open(image, NXT_FILE_RDONLY, NXT_FILE_OPEN, 0);
+    if (ret != NXT_OK) {
+        return NULL;
+    }
+
+    tree = NULL;
+
+    n = nxt_file_read(image, (u_char *) &header, sizeof(nxt_addr_image_t), 0);
+
+    if (n != sizeof(nxt_addr_image_t)
+        || nxt_memcmp(header.magic, NXT_ADDR_IMAGE_MAGIC,
+                      sizeof(header.magic)) != 0
+        || header.ino != (uint64_t) fi->st_ino
+        || header.size != (uint64_t) fi->st_size
+        || header.mtime != (uint64_t) fi->st_mtime
+#if (NXT_HAVE_STAT_MTIM)
+        || header.mtime_nsec != (uint64_t) fi->st_mtim.tv_nsec
+#endif
+        || header.items < 2
+        || header.items >= NXT_ADDR_TREE_MATCH)
+    {
+        goto done;
+    }
+
+    size = (header.items + 1) * sizeof(nxt_addr_node_t);
+
+    ret = nxt_file_info(image, &info);
+    if (ret != NXT_OK || (size_t) nxt_file_size(&info) != size) {
+        goto done;
+    }
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, image->fd, 0);
+    if (nxt_slow_path(map == MAP_FAILED)) {
+        goto done;
+    }
+
+    if (!nxt_addr_tree_valid((nxt_addr_node_t *) map + 1, header.items)) {
+        (void) munmap(map, size);
+        goto done;
+    }
+
+    tree = nxt_mp_alloc(mp, sizeof(nxt_addr_tree_t));
+
+    if (nxt_slow_path(tree == NULL
+                      || nxt_mp_cleanup(mp, nxt_addr_tree_unmap, tree)
+                         != NXT_OK))
+    {
+        (void) munmap(map, size);
+        tree = NULL;
+        goto done;
+    }
+
+    tree->items = header.items;
+    tree->nodes = (nxt_addr_node_t *) map + 1;
+
+done:
+
+    nxt_file_close(image);
+
+    return tree;
+}
+
+
+/*
+ * The image is checked once before it is used, so a stale or damaged one
+ * cannot make the lookups read past the nodes.  The roots are never
+ * referenced, the other nodes are taken from 2 on.
+ */
+
+static nxt_bool_t
+nxt_addr_tree_valid(nxt_addr_node_t *nodes, uint32_t items)
+{
+    uint32_t    i, slot;
+    nxt_uint_t  k;
+
+    for (i = 0; i < items; i++) {
+        for (k = 0; k < NXT_ADDR_TREE_SLOTS; k++) {
+            slot = nodes[i].slot[k];
+
+            if (slot == 1 || (slot >= items && slot != NXT_ADDR_TREE_MATCH)) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+static void
+nxt_addr_tree_unmap(void *data)
+{
+    nxt_addr_tree_t  *tree;
+
+    tree = data;
+
+    /* The mapping starts with the header. */
+
+    (void) munmap(tree->nodes - 1, (tree->items + 1) * sizeof(nxt_addr_node_t));
+}
+
+
+/* Without an image, the list is only parsed. */
+
+static nxt_int_t
+nxt_addr_tree_compile(nxt_mp_t *mp, nxt_file_t *file, nxt_file_t *image,
+    nxt_file_info_t *fi, nxt_str_t *error)
+{
+    u_char                 *buf, *p, *end, *eol;
+    size_t                 size;
+    ssize_t                n;
+    nxt_int_t              ret;
+    nxt_str_t              line;
+    nxt_uint_t             number;
+    nxt_addr_pattern_t     pattern;
+    nxt_addr_tree_build_t  build;
+
+    ret = nxt_file_open(file, NXT_FILE_RDONLY, NXT_FILE_OPEN, 0);
+    if (ret != NXT_OK) {
+        nxt_thread_log_error(NXT_LOG_ERR, "open() \"%s\" failed (%d: %s)",
+                             file->name, file->error, strerror(file->error));
+        nxt_addr_tree_error(mp, error, NXT_ADDR_READ_ERROR);
+        return NXT_ERROR;
+    }
+
+    /* The image is tied to the file that is actually read. */
+
+    ret = nxt_file_info(file, fi);
+    if (ret != NXT_OK) {
+        nxt_file_close(file);
+        nxt_thread_log_error(NXT_LOG_ERR, "fstat() \"%s\" failed (%d: %s)",
+                             file->name, file->error, strerror(file->error));
+        nxt_addr_tree_error(mp, error, NXT_ADDR_READ_ERROR);
+        return NXT_ERROR;
+    }
+
+    size = nxt_file_size(fi);
+
+    buf = nxt_malloc(size + 1);
+    if (nxt_slow_path(buf == NULL)) {
+        nxt_file_close(file);
+        return NXT_ERROR;
+    }
+
+    n = nxt_file_read(file, buf, size, 0);
+
+    nxt_file_close(file);
+
+    if (n != (ssize_t) size) {
+        nxt_free(buf);
+        nxt_thread_log_error(NXT_LOG_ERR, "read() \"%s\" failed (%d: %s)",
+                             file->name, file->error, strerror(file->error));
+        nxt_addr_tree_error(mp, error, NXT_ADDR_READ_ERROR);
+        return NXT_ERROR;
+    }
+
+    build.nodes = NULL;
+
+    if (image != NULL) {
+        ret = nxt_addr_tree_init(&build);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            nxt_free(buf);
+            return NXT_ERROR;
+        }
+    }
+
+    number = 0;
+    p = buf;
+    end = buf + size;
+
+    while (p < end) {
+        number++;
+
+        eol = nxt_memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        line.start = p;
+        line.length = eol - p;
+
+        p = eol + 1;
+
+        while (line.length != 0
+               && (line.start[0] == ' ' || line.start[0] == '\t'))
+        {
+            line.start++;
+            line.length--;
+        }
+
+        while (line.length != 0
+               && (line.start[line.length - 1] == ' '
+                   || line.start[line.length - 1] == '\t'
+                   || line.start[line.length - 1] == '\r'))
+        {
+            line.length--;
+        }
+
+        if (line.length == 0 || line.start[0] == '#') {
+            continue;
+        }
+
+        ret = nxt_addr_pattern_parse_str(&pattern, &line);
+        if (ret != NXT_OK) {
+            nxt_addr_tree_error(mp, error, "invalid address in line %ui "
+                                "of \"%s\"", number, file->name);
+            goto fail;
+        }
+
+        if (image == NULL) {
+            continue;
+        }
+
+        ret = nxt_addr_tree_add(&build, &pattern);
+        if (nxt_slow_path(ret != NXT_OK)) {
+            goto fail;
+        }
+    }
+
+    ret = (image != NULL) ? nxt_addr_tree_write(mp, &build, image, fi, error)
+                          : NXT_OK;
+
+fail:
+
+    nxt_free(buf);
+    nxt_free(build.nodes);
+
+    return (ret == NXT_OK) ? NXT_OK : NXT_ERROR;
+}
+
+
+static nxt_int_t
+nxt_addr_tree_write(nxt_mp_t *mp, nxt_addr_tree_build_t *build,
+    nxt_file_t *image, nxt_file_info_t *fi, nxt_str_t *error)
+{
+    size_t            size;
+    ssize_t           n;
+    nxt_int_t         ret;
+    nxt_file_t        temp;
+    nxt_addr_node_t   head;
+    nxt_addr_image_t  *header;
+
+    nxt_memzero(&temp, sizeof(nxt_file_t));
+
+    size = nxt_strlen(image->name) + 32;
+
+    temp.name = nxt_mp_nget(mp, size);
+    if (nxt_slow_path(temp.name == NULL)) {
+        return NXT_ERROR;
+    }
+
+    (void) nxt_sprintf(temp.name, temp.name + size, "%s.%d%Z",
+                       image->name, (int) getpid());
+
+    ret = nxt_file_open(&temp, NXT_FILE_WRONLY, NXT_FILE_TRUNCATE,
+                        NXT_FILE_DEFAULT_ACCESS);
+    if (ret != NXT_OK) {
+        nxt_addr_tree_error(mp, error, "open() \"%s\" failed (%d: %s)",
+                            temp.name, temp.error, strerror(temp.error));
+        return NXT_ERROR;
+    }
+
+    nxt_memzero(&head, sizeof(nxt_addr_node_t));
+
+    header = (nxt_addr_image_t *) &head;
+
+    nxt_memcpy(header->magic, NXT_ADDR_IMAGE_MAGIC, sizeof(header->magic));
+    header->items = build->items;
+    header->ino = fi->st_ino;
+    header->size = fi->st_size;
+    header->mtime = fi->st_mtime;
+#if (NXT_HAVE_STAT_MTIM)
+    header->mtime_nsec = fi->st_mtim.tv_nsec;
+#endif
+
+    size = build->items * sizeof(nxt_addr_node_t);
+
+    if (nxt_file_write(&temp, (u_char *) &head, sizeof(nxt_addr_node_t), 0)
+        != sizeof(nxt_addr_node_t))
+    {
+        goto fail;
+    }
+
+    n = nxt_file_write(&temp, (u_char *) build->nodes, size,
+                       sizeof(nxt_addr_node_t));
+    if (n != (ssize_t) size) {
+        goto fail;
+    }
+
+    nxt_file_close(&temp);
+
+    if (rename((char *) temp.name, (char *) image->name) != 0) {
+        nxt_addr_tree_error(mp, error, "rename() \"%s\" failed (%d: %s)",
+                            image->name, nxt_errno, strerror(nxt_errno));
+        (void) unlink((char *) temp.name);
+        return NXT_ERROR;
+    }
+
+    return NXT_OK;
+
+fail:
+
+    nxt_addr_tree_error(mp, error, "write() \"%s\" failed (%d: %s)",
+                        temp.name, temp.error, strerror(temp.error));
+
+    nxt_file_close(&temp);
+    (void) unlink((char *) temp.name);
+
+    return NXT_ERROR;
+}
+
+
+static void
+nxt_addr_tree_error(nxt_mp_t *mp, nxt_str_t *error, const char *fmt, ...)
+{
+    u_char   *p;
+    va_list  args;
+
+    error->length = 0;
+
+    error->start = nxt_mp_nget(mp, NXT_ADDR_ERROR_LEN);
+    if (nxt_slow_path(error->start == NULL)) {
+        return;
+    }
+
+    va_start(args, fmt);
+    p = nxt_vsprintf(error->start, error->start + NXT_ADDR_ERROR_LEN, fmt,
+                     args);
+    va_end(args);
+
+    error->length = p - error->start;
+}
@@ -53,10 +53,48 @@ typedef struct {
 } nxt_addr_pattern_t;
 
 
+/*
+ * A multibit trie with 4-bit strides over the address bytes in network
+ * order.  A node fits a cache line, so an IPv4 lookup takes at most 8
+ * and an IPv6 lookup at most 32 steps regardless of the pattern count.
+ * Ranges are expanded into covering slots when the tree is built, and
+ * a slot covered by a pattern terminates the lookup.
+ */
+
+#define NXT_ADDR_TREE_STRIDE  4
+#define NXT_ADDR_TREE_SLOTS   (1 << NXT_ADDR_TREE_STRIDE)
+#define NXT_ADDR_TREE_MATCH   0xFFFFFFFF
+
+/* The roots of the IPv4 and IPv6 tries, an empty slot is 0. */
+#define NXT_ADDR_TREE_INET    0
+#define NXT_ADDR_TREE_INET6   1
+
+
+typedef struct {
+    uint32_t            slot[NXT_ADDR_TREE_SLOTS];
+} nxt_addr_node_t;
+
+
+typedef struct {
+    uint32_t            items;
+    nxt_addr_node_t     *nodes;
+} nxt_addr_tree_t;
+
+
 NXT_EXPORT nxt_int_t nxt_addr_pattern_parse(nxt_mp_t *mp,
     nxt_addr_pattern_t *pattern, nxt_conf_value_t *cv);
+NXT_EXPORT nxt_int_t nxt_addr_pattern_parse_str(nxt_addr_pattern_t *pattern,
+    nxt_str_t *str);
 NXT_EXPORT nxt_int_t nxt_addr_pattern_match(nxt_addr_pattern_t *p,
     nxt_sockaddr_t *sa);
+NXT_EXPORT nxt_addr_tree_t *nxt_addr_tree_create(nxt_mp_t *mp,
+    nxt_addr_pattern_t *patterns, nxt_uint_t n);
+NXT_EXPORT nxt_int_t nxt_addr_list_check(nxt_mp_t *mp, nxt_str_t *name,
+    nxt_str_t *error);
+NXT_EXPORT nxt_addr_tree_t *nxt_addr_tree_load(nxt_mp_t *mp, nxt_str_t *name,
+    nxt_str_t *dir, nxt_str_t *error);
+NXT_EXPORT nxt_bool_t nxt_addr_tree_match(nxt_addr_tree_t *tree,
+    struct sockaddr *sa);
 
 
 #endif /* _NXT_ADDR_H_INCLUDED_ */
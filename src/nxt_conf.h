@@ -70,6 +70,8 @@ typedef struct {
     nxt_mp_t             *pool;
     nxt_str_t            error;
     void                 *ctx;
+    nxt_int_t            (*variable)(void *ctx, nxt_mp_t *mp,
+                                     nxt_str_t *name);
 } nxt_conf_validation_t;
 
 
@@ -70,6 +70,8 @@ static nxt_int_t nxt_conf_vldt_match_addrs(nxt_conf_validation_t *vldt,
     nxt_conf_value_t *value, void *data);
 static nxt_int_t nxt_conf_vldt_match_addr(nxt_conf_validation_t *vldt,
     nxt_conf_value_t *value);
+static nxt_int_t nxt_conf_vldt_addr_file(nxt_conf_validation_t *vldt,
+    nxt_conf_value_t *value, void *data);
 
 static nxt_int_t nxt_conf_vldt_upstream(nxt_conf_validation_t *vldt,
      nxt_str_t *name, nxt_conf_value_t *value);
@@ -86,6 +88,10 @@ static nxt_int_t nxt_conf_vldt_server_max_fails(nxt_conf_validation_t *vldt,
 static nxt_int_t nxt_conf_vldt_server_fail_timeout(nxt_conf_validation_t *vldt,
     nxt_conf_value_t *value, void *data);
 
+static nxt_int_t nxt_conf_vldt_limit_key(nxt_conf_validation_t *vldt,
+    nxt_conf_value_t *value, void *data);
+static nxt_int_t nxt_conf_vldt_limit_algorithm(nxt_conf_validation_t *vldt,
+    nxt_conf_value_t *value, void *data);
 static nxt_int_t nxt_conf_vldt_variable(nxt_conf_validation_t *vldt,
     nxt_str_t *name, nxt_conf_value_t *value);
 static nxt_int_t nxt_conf_vldt_add_header(nxt_conf_validation_t *vldt,
@@ -151,7 +157,7 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_match_members[] = {
 static nxt_conf_vldt_object_t  nxt_conf_vldt_limit_conn_members[] = {
     { nxt_string("key"),
       NXT_CONF_VLDT_STRING,
-      NULL,
+      &nxt_conf_vldt_limit_key,
       NULL },
 
     { nxt_string("conn"),
@@ -166,7 +172,7 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_limit_conn_members[] = {
 static nxt_conf_vldt_object_t  nxt_conf_vldt_limit_req_members[] = {
     { nxt_string("key"),
       NXT_CONF_VLDT_STRING,
-      NULL,
+      &nxt_conf_vldt_limit_key,
       NULL },
 
     { nxt_string("rate"),
@@ -179,6 +185,31 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_limit_req_members[] = {
       NULL,
       NULL },
 
+    { nxt_string("delay"),
+      NXT_CONF_VLDT_INTEGER,
+      NULL,
+      NULL },
+
+    { nxt_string("nodelay"),
+      NXT_CONF_VLDT_BOOLEAN,
+      NULL,
+      NULL },
+
+    { nxt_string("algorithm"),
+      NXT_CONF_VLDT_STRING,
+      &nxt_conf_vldt_limit_algorithm,
+      NULL },
+
+    NXT_CONF_VLDT_END
+};
+
+
+static nxt_conf_vldt_object_t  nxt_conf_vldt_addr_list_members[] = {
+    { nxt_string("file"),
+      NXT_CONF_VLDT_STRING,
+      &nxt_conf_vldt_addr_file,
+      NULL },
+
     NXT_CONF_VLDT_END
 };
 
@@ -191,12 +222,12 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_action_members[] = {
       (void *) &nxt_conf_vldt_variable },
 
     { nxt_string("blacklist"),
-      NXT_CONF_VLDT_STRING | NXT_CONF_VLDT_ARRAY,
+      NXT_CONF_VLDT_STRING | NXT_CONF_VLDT_ARRAY | NXT_CONF_VLDT_OBJECT,
       &nxt_conf_vldt_match_addrs,
       NULL },
 
     { nxt_string("whitelist"),
-      NXT_CONF_VLDT_STRING | NXT_CONF_VLDT_ARRAY,
+      NXT_CONF_VLDT_STRING | NXT_CONF_VLDT_ARRAY | NXT_CONF_VLDT_OBJECT,
       &nxt_conf_vldt_match_addrs,
       NULL },
 
@@ -205,6 +236,11 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_action_members[] = {
       &nxt_conf_vldt_object_iterator,
       (void *) &nxt_conf_vldt_add_header },
 
+    { nxt_string("add_headers_always"),
+      NXT_CONF_VLDT_BOOLEAN,
+      NULL,
+      NULL },
+
     { nxt_string("limit_conn"),
       NXT_CONF_VLDT_OBJECT,
       &nxt_conf_vldt_object,
@@ -235,6 +271,16 @@ static nxt_conf_vldt_object_t  nxt_conf_vldt_action_members[] = {
       NULL,
       NULL },
 
+    { nxt_string("type"),
+      NXT_CONF_VLDT_STRING,
+      NULL,
+      NULL },
+
+    { nxt_string("gzip"),
+      NXT_CONF_VLDT_BOOLEAN,
+      NULL,
+      NULL },
+
     NXT_CONF_VLDT_END
 };
 
@@ -614,9 +660,12 @@ static nxt_int_t
 nxt_conf_vldt_match_pattern(nxt_conf_validation_t *vldt,
     nxt_conf_value_t *value)
 {
-    u_char      ch;
-    nxt_str_t   pattern;
-    nxt_uint_t  i, first, last;
+    u_char           ch;
+    nxt_str_t        pattern;
+    nxt_uint_t       i, first, last;
+#if (NXT_HAVE_REGEX)
+    nxt_regex_err_t  err;
+#endif
 
     enum {
         sw_none,
@@ -636,6 +685,27 @@ nxt_conf_vldt_match_pattern(nxt_conf_validation_t *vldt,
     }
 
     first = (pattern.start[0] == '!');
+
+    if (first < pattern.length && pattern.start[first] == '~') {
+#if (NXT_HAVE_REGEX)
+        pattern.start += first + 1;
+        pattern.length -= first + 1;
+
+        if (nxt_regex_compile(vldt->pool, &pattern, 0, &err) == NULL) {
+            return nxt_conf_vldt_error(vldt, "The \"match\" pattern "
+                                       "\"~%V\" is not a valid regular "
+                                       "expression: %s at offset %uz.",
+                                       &pattern, err.msg, err.offset);
+        }
+
+        return NXT_OK;
+#else
+        return nxt_conf_vldt_error(vldt, "The \"match\" patterns starting "
+                                   "with \"~\" require regular expressions "
+                                   "support (nginx built with PCRE2).");
+#endif
+    }
+
     last = pattern.length - 1;
     state = sw_none;
 
@@ -701,12 +771,67 @@ static nxt_int_t
 nxt_conf_vldt_match_addrs(nxt_conf_validation_t *vldt,
     nxt_conf_value_t *value, void *data)
 {
-    if (nxt_conf_type(value) == NXT_CONF_ARRAY) {
+    nxt_int_t  ret;
+
+    static nxt_str_t  file_str = nxt_string("file");
+
+    switch (nxt_conf_type(value)) {
+
+    case NXT_CONF_ARRAY:
         return nxt_conf_vldt_array_iterator(vldt, value,
                                             &nxt_conf_vldt_match_addr);
+
+    case NXT_CONF_OBJECT:
+        ret = nxt_conf_vldt_object(vldt, value,
+                                   nxt_conf_vldt_addr_list_members);
+        if (ret != NXT_OK) {
+            return ret;
+        }
+
+        if (nxt_conf_get_object_member(value, &file_str, NULL) == NULL) {
+            return nxt_conf_vldt_error(vldt, "The address list object must "
+                                       "have the \"file\" member.");
+        }
+
+        return NXT_OK;
+
+    default:
+        return nxt_conf_vldt_match_addr(vldt, value);
+    }
+}
+
+
+/*
+ * The list is only parsed here, its image is compiled when the
+ * configuration is applied.
+ */
+
+static nxt_int_t
+nxt_conf_vldt_addr_file(nxt_conf_validation_t *vldt, nxt_conf_value_t *value,
+    void *data)
+{
+    nxt_int_t  ret;
+    nxt_str_t  name, error;
+
+    nxt_conf_get_string(value, &name);
+
+    if (name.length == 0) {
+        return nxt_conf_vldt_error(vldt, "The \"file\" value must not be "
+                                   "empty.");
     }
 
-    return nxt_conf_vldt_match_addr(vldt, value);
+    ret = nxt_addr_list_check(vldt->pool, &name, &error);
+
+    if (ret != NXT_OK) {
+        if (error.length == 0) {
+            return NXT_ERROR;
+        }
+
+        return nxt_conf_vldt_error(vldt, "The address list \"%V\" cannot be "
+                                   "loaded: %V.", &name, &error);
+    }
+
+    return NXT_OK;
 }
 
 
@@ -793,6 +918,106 @@ nxt_conf_vldt_match_patterns_set_member(nxt_conf_validation_t *vldt,
 }
 
 
+static nxt_int_t
+nxt_conf_vldt_limit_key(nxt_conf_validation_t *vldt, nxt_conf_value_t *value,
+    void *data)
+{
+    u_char     *p, *end, *start;
+    nxt_int_t  ret;
+    nxt_str_t  key, name;
+
+    nxt_conf_get_string(value, &key);
+
+    p = key.start;
+    end = p + key.length;
+
+    while (p < end) {
+
+        if (*p++ != '$') {
+            continue;
+        }
+
+        if (p < end && *p == '{') {
+            start = ++p;
+
+            while (p < end && *p != '}') {
+                p++;
+            }
+
+            if (p == end) {
+                return nxt_conf_vldt_error(vldt, "The limit key \"%V\" "
+                                           "misses the closing bracket.",
+                                           &key);
+            }
+
+            name.length = p++ - start;
+
+        } else {
+            start = p;
+
+            while (p < end
+                   && (*p == '_' || (*p >= '0' && *p <= '9')
+                       || ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z')))
+            {
+                p++;
+            }
+
+            name.length = p - start;
+        }
+
+        if (name.length == 0) {
+            return nxt_conf_vldt_error(vldt, "The limit key \"%V\" contains "
+                                       "an invalid variable name.", &key);
+        }
+
+        if (vldt->variable == NULL) {
+            continue;
+        }
+
+        name.start = start;
+
+        ret = vldt->variable(vldt->ctx, vldt->pool, &name);
+
+        if (ret == NXT_DECLINED) {
+            return nxt_conf_vldt_error(vldt, "The limit key \"%V\" contains "
+                                       "an unknown \"%V\" variable.",
+                                       &key, &name);
+        }
+
+        if (nxt_slow_path(ret != NXT_OK)) {
+            return NXT_ERROR;
+        }
+    }
+
+    return NXT_OK;
+}
+
+
+static nxt_int_t
+nxt_conf_vldt_limit_algorithm(nxt_conf_validation_t *vldt,
+    nxt_conf_value_t *value, void *data)
+{
+    nxt_str_t  algorithm;
+
+    static const nxt_str_t  leaky_bucket = nxt_string("leaky_bucket");
+    static const nxt_str_t  gcra = nxt_string("gcra");
+    static const nxt_str_t  local = nxt_string("local");
+
+    nxt_conf_get_string(value, &algorithm);
+
+    if (nxt_strstr_eq(&algorithm, &leaky_bucket)
+        || nxt_strstr_eq(&algorithm, &gcra)
+        || nxt_strstr_eq(&algorithm, &local))
+    {
+        return NXT_OK;
+    }
+
+    return nxt_conf_vldt_error(vldt, "The \"algorithm\" must be one of "
+                                     "\"leaky_bucket\", \"gcra\", "
+                                     "or \"local\".");
+}
+
+
 static nxt_int_t
 nxt_conf_vldt_variable(nxt_conf_validation_t *vldt, nxt_str_t *name,
     nxt_conf_value_t *value)
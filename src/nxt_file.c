@@ -30,6 +30,17 @@ nxt_file_open(nxt_file_t *file, nxt_uint_t mode, nxt_uint_t create,
 }
 
 
+void
+nxt_file_close(nxt_file_t *file)
+{
+    if (close(file->fd) != 0) {
+        file->error = nxt_errno;
+    }
+
+    file->fd = NXT_FILE_INVALID;
+}
+
+
 nxt_int_t
 nxt_file_info(nxt_file_t *file, nxt_file_info_t *fi)
 {
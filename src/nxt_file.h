@@ -53,6 +53,7 @@ nxt_file_size(fi)                                                             \
 
 NXT_EXPORT nxt_int_t nxt_file_open(nxt_file_t *file, nxt_uint_t mode,
     nxt_uint_t create, nxt_file_access_t access);
+NXT_EXPORT void nxt_file_close(nxt_file_t *file);
 NXT_EXPORT nxt_int_t nxt_file_info(nxt_file_t *file, nxt_file_info_t *fi);
 NXT_EXPORT ssize_t nxt_file_read(nxt_file_t *file, u_char *buf, size_t size,
     nxt_off_t offset);
@@ -24,11 +24,13 @@
 #include <nxt_list.h>
 #include <nxt_array.h>
 #include <nxt_djb_hash.h>
+#include <nxt_wy_hash.h>
 #include <nxt_utf8.h>
 #include <nxt_parse.h>
 #include <nxt_sprintf.h>
 #include <nxt_conf.h>
 #include <nxt_addr.h>
+#include <nxt_regex.h>
 #include <nxt_upstream.h>
 
 
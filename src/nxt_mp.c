@@ -99,10 +99,22 @@ typedef struct {
 } nxt_mp_block_t;
 
 
+typedef struct nxt_mp_cln_s  nxt_mp_cln_t;
+
+struct nxt_mp_cln_s {
+    nxt_mp_cleanup_t     handler;
+    void                 *data;
+    nxt_mp_cln_t         *next;
+};
+
+
 struct nxt_mp_s {
     /* rbtree of nxt_mp_block_t. */
     nxt_rbtree_t         blocks;
 
+    /* List of nxt_mp_cln_t. */
+    nxt_mp_cln_t         *cleanup;
+
     uint8_t              chunk_size_shift;
     uint8_t              page_size_shift;
     uint32_t             page_size;
@@ -142,6 +154,7 @@ static void *nxt_mp_alloc_small(nxt_mp_t *mp, size_t size);
 static void *nxt_mp_get_small(nxt_mp_t *mp, nxt_queue_t *pages, size_t size);
 static nxt_mp_page_t *nxt_mp_alloc_page(nxt_mp_t *mp);
 static nxt_mp_block_t *nxt_mp_alloc_cluster(nxt_mp_t *mp);
+static void nxt_mp_init_cluster(nxt_mp_t *mp, nxt_mp_block_t *cluster);
 static void *nxt_mp_alloc_large(nxt_mp_t *mp, size_t alignment, size_t size,
     nxt_bool_t freeable);
 static intptr_t nxt_mp_rbtree_compare(nxt_rbtree_node_t *node1,
@@ -232,9 +245,14 @@ void
 nxt_mp_destroy(nxt_mp_t *mp)
 {
     void               *p;
+    nxt_mp_cln_t       *cln;
     nxt_mp_block_t     *block;
     nxt_rbtree_node_t  *node, *next;
 
+    for (cln = mp->cleanup; cln != NULL; cln = cln->next) {
+        cln->handler(cln->data);
+    }
+
     next = nxt_rbtree_root(&mp->blocks);
 
     while (next != nxt_rbtree_sentinel(&mp->blocks)) {
@@ -255,6 +273,75 @@ nxt_mp_destroy(nxt_mp_t *mp)
 }
 
 
+void
+nxt_mp_reset(nxt_mp_t *mp)
+{
+    void               *p;
+    uint32_t           pages;
+    nxt_queue_t        *chunk_pages;
+    nxt_mp_cln_t       *cln;
+    nxt_mp_block_t     *block, *cluster;
+    nxt_rbtree_node_t  *node, *next;
+
+    for (cln = mp->cleanup; cln != NULL; cln = cln->next) {
+        cln->handler(cln->data);
+    }
+
+    mp->cleanup = NULL;
+    mp->retain = 1;
+
+    /*
+     * Only one cluster is kept, so a reused pool does not hold the memory
+     * of its largest use.
+     */
+
+    cluster = NULL;
+
+    next = nxt_rbtree_root(&mp->blocks);
+
+    while (next != nxt_rbtree_sentinel(&mp->blocks)) {
+
+        node = nxt_rbtree_destroy_next(&mp->blocks, &next);
+        block = (nxt_mp_block_t *) node;
+
+        if (block->type == NXT_MP_CLUSTER_BLOCK && cluster == NULL) {
+            cluster = block;
+            continue;
+        }
+
+        p = block->start;
+
+        if (block->type != NXT_MP_EMBEDDED_BLOCK) {
+            nxt_free(block);
+        }
+
+        nxt_free(p);
+    }
+
+    pages = mp->page_size_shift - mp->chunk_size_shift;
+    chunk_pages = mp->chunk_pages;
+
+    while (pages != 0) {
+        nxt_queue_init(chunk_pages);
+        chunk_pages++;
+        pages--;
+    }
+
+    nxt_queue_init(&mp->free_pages);
+    nxt_queue_init(&mp->nget_pages);
+    nxt_queue_init(&mp->get_pages);
+
+    nxt_rbtree_init(&mp->blocks, nxt_mp_rbtree_compare);
+
+    if (cluster != NULL) {
+        nxt_memzero(cluster->pages, (mp->cluster_size >> mp->page_size_shift)
+                                    * sizeof(nxt_mp_page_t));
+
+        nxt_mp_init_cluster(mp, cluster);
+    }
+}
+
+
 nxt_bool_t
 nxt_mp_test_sizes(size_t cluster_size, size_t page_alignment, size_t page_size,
     size_t min_chunk_size)
@@ -568,6 +655,19 @@ nxt_mp_alloc_cluster(nxt_mp_t *mp)
         return NULL;
     }
 
+    nxt_mp_init_cluster(mp, cluster);
+
+    return cluster;
+}
+
+
+static void
+nxt_mp_init_cluster(nxt_mp_t *mp, nxt_mp_block_t *cluster)
+{
+    nxt_uint_t  n;
+
+    n = mp->cluster_size >> mp->page_size_shift;
+
     n--;
     cluster->pages[n].number = n;
     nxt_queue_insert_head(&mp->free_pages, &cluster->pages[n].link);
@@ -580,8 +680,6 @@ nxt_mp_alloc_cluster(nxt_mp_t *mp)
     }
 
     nxt_rbtree_insert(&mp->blocks, &cluster->node);
-
-    return cluster;
 }
 
 
@@ -885,3 +983,23 @@ nxt_mp_zget(nxt_mp_t *mp, size_t size)
 
     return p;
 }
+
+
+nxt_int_t
+nxt_mp_cleanup(nxt_mp_t *mp, nxt_mp_cleanup_t handler, void *data)
+{
+    nxt_mp_cln_t  *cln;
+
+    cln = nxt_mp_get(mp, sizeof(nxt_mp_cln_t));
+    if (nxt_slow_path(cln == NULL)) {
+        return NXT_ERROR;
+    }
+
+    cln->handler = handler;
+    cln->data = data;
+    cln->next = mp->cleanup;
+
+    mp->cleanup = cln;
+
+    return NXT_OK;
+}
@@ -26,6 +26,8 @@
 
 typedef struct nxt_mp_s  nxt_mp_t;
 
+typedef void (*nxt_mp_cleanup_t)(void *data);
+
 
 /*
  * nxt_mp_create() creates a memory pool and sets the pool's retention
@@ -41,6 +43,13 @@ NXT_EXPORT nxt_mp_t *nxt_mp_create(size_t cluster_size, size_t page_alignment,
  */
 NXT_EXPORT void nxt_mp_destroy(nxt_mp_t *mp);
 
+/*
+ * nxt_mp_reset() runs the cleanup handlers and frees all allocations, so
+ * the pool can be reused.  The first cluster is kept, thus small
+ * allocations from the reused pool do not call malloc().
+ */
+NXT_EXPORT void nxt_mp_reset(nxt_mp_t *mp);
+
 /* nxt_mp_test_sizes() tests validity of memory pool parameters. */
 NXT_EXPORT nxt_bool_t nxt_mp_test_sizes(size_t cluster_size,
     size_t page_alignment, size_t page_size, size_t min_chunk_size);
@@ -91,5 +100,13 @@ NXT_EXPORT void *nxt_mp_get(nxt_mp_t *mp, size_t size)
 NXT_EXPORT void *nxt_mp_zget(nxt_mp_t *mp, size_t size)
     NXT_MALLOC_LIKE;
 
+/*
+ * nxt_mp_cleanup() registers a handler to release resources allocated
+ * outside of the pool.  The handlers are called in reverse order of
+ * registration on pool destruction.
+ */
+NXT_EXPORT nxt_int_t nxt_mp_cleanup(nxt_mp_t *mp, nxt_mp_cleanup_t handler,
+    void *data);
+
 
 #endif /* _NXT_MP_H_INCLUDED_ */
@@ -0,0 +1,187 @@
+
+/*
+ * Copyright (C) Axel Duch
+ * Copyright (C) NGINX, Inc.
+ */
+
+#include <nxt_main.h>
+
+#if (NXT_HAVE_REGEX)
+
+#ifndef PCRE2_CODE_UNIT_WIDTH
+#define PCRE2_CODE_UNIT_WIDTH  8
+#endif
+
+#include <pcre2.h>
+
+
+static void *nxt_pcre2_malloc(PCRE2_SIZE size, void *memory_data);
+static void nxt_pcre2_free(void *p, void *memory_data);
+static void nxt_pcre2_code_free(void *data);
+
+
+struct nxt_regex_s {
+    pcre2_code  *code;
+    nxt_str_t   pattern;
+};
+
+
+nxt_regex_t *
+nxt_regex_compile(nxt_mp_t *mp, nxt_str_t *source, nxt_uint_t flags,
+    nxt_regex_err_t *err)
+{
+    int                    errcode;
+    uint32_t               options;
+    nxt_int_t              ret;
+    PCRE2_SIZE             erroffset;
+    nxt_regex_t            *re;
+    pcre2_general_context  *general_ctx;
+    pcre2_compile_context  *compile_ctx;
+
+    static const u_char    alloc_error[] = "memory allocation failed";
+
+    general_ctx = pcre2_general_context_create(nxt_pcre2_malloc,
+                                               nxt_pcre2_free, mp);
+    if (nxt_slow_path(general_ctx == NULL)) {
+        goto alloc_fail;
+    }
+
+    compile_ctx = pcre2_compile_context_create(general_ctx);
+    if (nxt_slow_path(compile_ctx == NULL)) {
+        goto alloc_fail;
+    }
+
+    re = nxt_mp_get(mp, sizeof(nxt_regex_t));
+    if (nxt_slow_path(re == NULL)) {
+        goto alloc_fail;
+    }
+
+    if (nxt_slow_path(nxt_str_dup(mp, &re->pattern, source) == NULL)) {
+        goto alloc_fail;
+    }
+
+    options = (flags & NXT_REGEX_CASELESS) ? PCRE2_CASELESS : 0;
+
+    re->code = pcre2_compile((PCRE2_SPTR) source->start, source->length,
+                             options, &errcode, &erroffset, compile_ctx);
+    if (nxt_slow_path(re->code == NULL)) {
+        err->offset = erroffset;
+
+        ret = pcre2_get_error_message(errcode, err->msg,
+                                      NXT_REGEX_ERR_BUF_SIZE);
+        if (ret < 0) {
+            (void) nxt_sprintf(err->msg, err->msg + NXT_REGEX_ERR_BUF_SIZE,
+                               "compilation failed with unknown "
+                               "error code: %d%Z", errcode);
+        }
+
+        return NULL;
+    }
+
+    ret = nxt_mp_cleanup(mp, nxt_pcre2_code_free, re->code);
+    if (nxt_slow_path(ret != NXT_OK)) {
+        pcre2_code_free(re->code);
+        goto alloc_fail;
+    }
+
+    /* The interpreter is used if JIT is not available. */
+    (void) pcre2_jit_compile(re->code, PCRE2_JIT_COMPLETE);
+
+    return re;
+
+alloc_fail:
+
+    err->offset = source->length;
+    nxt_memcpy(err->msg, alloc_error, sizeof(alloc_error));
+
+    return NULL;
+}
+
+
+static void *
+nxt_pcre2_malloc(PCRE2_SIZE size, void *mp)
+{
+    if (mp == NULL) {
+        return nxt_malloc(size);
+    }
+
+    return nxt_mp_get(mp, size);
+}
+
+
+static void
+nxt_pcre2_free(void *p, void *mp)
+{
+    if (mp == NULL) {
+        nxt_free(p);
+    }
+}
+
+
+static void
+nxt_pcre2_code_free(void *data)
+{
+    pcre2_code_free(data);
+}
+
+
+nxt_regex_match_t *
+nxt_regex_match_create(nxt_mp_t *mp, size_t size)
+{
+    nxt_regex_match_t      *match;
+    pcre2_general_context  *ctx;
+
+    ctx = pcre2_general_context_create(nxt_pcre2_malloc, nxt_pcre2_free, mp);
+    if (nxt_slow_path(ctx == NULL)) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "pcre2_general_context_create() failed");
+        return NULL;
+    }
+
+    match = pcre2_match_data_create(size, ctx);
+    if (nxt_slow_path(match == NULL)) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "pcre2_match_data_create(%uz) failed", size);
+    }
+
+    pcre2_general_context_free(ctx);
+
+    return match;
+}
+
+
+void
+nxt_regex_match_destroy(nxt_regex_match_t *match)
+{
+    pcre2_match_data_free(match);
+}
+
+
+nxt_int_t
+nxt_regex_match(nxt_regex_t *re, u_char *subject, size_t length,
+    nxt_regex_match_t *match)
+{
+    nxt_int_t    ret;
+    PCRE2_UCHAR  errptr[NXT_REGEX_ERR_BUF_SIZE];
+
+    ret = pcre2_match(re->code, (PCRE2_SPTR) subject, length, 0, 0,
+                      match, NULL);
+
+    if (nxt_slow_path(ret < PCRE2_ERROR_NOMATCH)) {
+
+        if (pcre2_get_error_message(ret, errptr, NXT_REGEX_ERR_BUF_SIZE) < 0) {
+            (void) nxt_sprintf(errptr, errptr + NXT_REGEX_ERR_BUF_SIZE,
+                               "using unknown error code: %d%Z", ret);
+        }
+
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0,
+                      "pcre2_match() failed: %s on \"%*s\" using \"%V\"",
+                      errptr, length, subject, &re->pattern);
+
+        return NXT_ERROR;
+    }
+
+    return (ret != PCRE2_ERROR_NOMATCH);
+}
+
+#endif /* NXT_HAVE_REGEX */
@@ -0,0 +1,46 @@
+
+/*
+ * Copyright (C) Axel Duch
+ * Copyright (C) NGINX, Inc.
+ */
+
+#ifndef _NXT_REGEX_H_INCLUDED_
+#define _NXT_REGEX_H_INCLUDED_
+
+#if (NXT_HAVE_REGEX)
+
+typedef struct nxt_regex_s          nxt_regex_t;
+typedef void                        nxt_regex_match_t;
+
+
+#define NXT_REGEX_CASELESS          1
+
+#define NXT_REGEX_ERR_BUF_SIZE      256
+
+
+typedef struct {
+    size_t                          offset;
+    u_char                          msg[NXT_REGEX_ERR_BUF_SIZE];
+} nxt_regex_err_t;
+
+
+/*
+ * nxt_regex_compile() compiles the regular expression in the pool, and
+ * JIT compiles it if possible.  The code is freed on pool destruction.
+ */
+NXT_EXPORT nxt_regex_t *nxt_regex_compile(nxt_mp_t *mp, nxt_str_t *source,
+    nxt_uint_t flags, nxt_regex_err_t *err);
+
+/*
+ * nxt_regex_match_create() creates match data in the pool,
+ * or in the process heap if the pool is NULL.
+ */
+NXT_EXPORT nxt_regex_match_t *nxt_regex_match_create(nxt_mp_t *mp,
+    size_t size);
+NXT_EXPORT void nxt_regex_match_destroy(nxt_regex_match_t *match);
+NXT_EXPORT nxt_int_t nxt_regex_match(nxt_regex_t *re, u_char *subject,
+    size_t length, nxt_regex_match_t *match);
+
+#endif /* NXT_HAVE_REGEX */
+
+#endif /* _NXT_REGEX_H_INCLUDED_ */
@@ -6,9 +6,113 @@
 
 #include <nxt_main.h>
 
+#if (NXT_HAVE_X86_SIMD)
+#include <immintrin.h>
+#endif
+
+
+static void nxt_memcpy_lowcase_generic(u_char *dst, const u_char *src,
+    size_t length);
+static nxt_int_t nxt_memcasecmp_generic(const void *p1, const void *p2,
+    size_t length);
+static u_char *nxt_memstrn_generic(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+static u_char *nxt_memcasestrn_generic(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+
+#if (NXT_HAVE_X86_SIMD)
+static void nxt_memcpy_lowcase_sse2(u_char *dst, const u_char *src,
+    size_t length);
+static nxt_int_t nxt_memcasecmp_sse2(const void *p1, const void *p2,
+    size_t length);
+static u_char *nxt_memstrn_sse2(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+static u_char *nxt_memcasestrn_sse2(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+static void nxt_memcpy_lowcase_avx2(u_char *dst, const u_char *src,
+    size_t length);
+static nxt_int_t nxt_memcasecmp_avx2(const void *p1, const void *p2,
+    size_t length);
+static u_char *nxt_memstrn_avx2(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+static u_char *nxt_memcasestrn_avx2(const u_char *s, const u_char *end,
+    const char *ss, size_t length);
+#endif
+
+
+typedef struct {
+    void       (*memcpy_lowcase)(u_char *dst, const u_char *src,
+                                 size_t length);
+    nxt_int_t  (*memcasecmp)(const void *p1, const void *p2, size_t length);
+    u_char     *(*memstrn)(const u_char *s, const u_char *end,
+                           const char *ss, size_t length);
+    u_char     *(*memcasestrn)(const u_char *s, const u_char *end,
+                               const char *ss, size_t length);
+} nxt_string_handlers_t;
+
+
+static const nxt_string_handlers_t  nxt_string_generic = {
+    nxt_memcpy_lowcase_generic,
+    nxt_memcasecmp_generic,
+    nxt_memstrn_generic,
+    nxt_memcasestrn_generic,
+};
+
+#if (NXT_HAVE_X86_SIMD)
+
+static const nxt_string_handlers_t  nxt_string_sse2 = {
+    nxt_memcpy_lowcase_sse2,
+    nxt_memcasecmp_sse2,
+    nxt_memstrn_sse2,
+    nxt_memcasestrn_sse2,
+};
+
+
+static const nxt_string_handlers_t  nxt_string_avx2 = {
+    nxt_memcpy_lowcase_avx2,
+    nxt_memcasecmp_avx2,
+    nxt_memstrn_avx2,
+    nxt_memcasestrn_avx2,
+};
+
+#endif
+
+
+static const nxt_string_handlers_t  *nxt_string_handlers = &nxt_string_generic;
+
+
+/*
+ * nxt_string_init() selects the string kernels supported by the CPU.
+ * Until it is called the generic byte by byte functions are used.
+ */
+
+void
+nxt_string_init(void)
+{
+#if (NXT_HAVE_X86_SIMD)
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        nxt_string_handlers = &nxt_string_avx2;
+
+    } else if (__builtin_cpu_supports("sse2")) {
+        nxt_string_handlers = &nxt_string_sse2;
+    }
+
+#endif
+}
+
 
 void
 nxt_memcpy_lowcase(u_char *dst, const u_char *src, size_t length)
+{
+    nxt_string_handlers->memcpy_lowcase(dst, src, length);
+}
+
+
+static void
+nxt_memcpy_lowcase_generic(u_char *dst, const u_char *src, size_t length)
 {
     u_char  c;
 
@@ -81,6 +185,13 @@ nxt_strncasecmp(const u_char *s1, const u_char *s2, size_t length)
 
 nxt_int_t
 nxt_memcasecmp(const void *p1, const void *p2, size_t length)
+{
+    return nxt_string_handlers->memcasecmp(p1, p2, length);
+}
+
+
+static nxt_int_t
+nxt_memcasecmp_generic(const void *p1, const void *p2, size_t length)
 {
     u_char        c1, c2;
     nxt_int_t     n;
@@ -115,6 +226,14 @@ nxt_memcasecmp(const void *p1, const void *p2, size_t length)
 
 u_char *
 nxt_memstrn(const u_char *s, const u_char *end, const char *ss, size_t length)
+{
+    return nxt_string_handlers->memstrn(s, end, ss, length);
+}
+
+
+static u_char *
+nxt_memstrn_generic(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
 {
     u_char  c1, c2, *s2;
 
@@ -150,6 +269,14 @@ nxt_memstrn(const u_char *s, const u_char *end, const char *ss, size_t length)
 u_char *
 nxt_memcasestrn(const u_char *s, const u_char *end, const char *ss,
     size_t length)
+{
+    return nxt_string_handlers->memcasestrn(s, end, ss, length);
+}
+
+
+static u_char *
+nxt_memcasestrn_generic(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
 {
     u_char  c1, c2, *s2;
 
@@ -357,3 +484,315 @@ nxt_encode_uri(u_char *dst, u_char *src, size_t length)
 
     return (uintptr_t) dst;
 }
+
+
+#if (NXT_HAVE_X86_SIMD)
+
+/*
+ * The SIMD kernels process 16 or 32 bytes at once and leave the tail
+ * to the generic functions.  The substring search compares the first
+ * and the last characters of the substring at every position of a block
+ * and checks the rest only for the candidate positions.
+ */
+
+#define NXT_SIMD_TARGET(isa)  __attribute__((target(isa)))
+
+
+nxt_inline NXT_SIMD_TARGET("sse2") __m128i
+nxt_sse2_lowcase(__m128i v)
+{
+    __m128i  upper;
+
+    /* The bytes above 0x7F are negative and never uppercase letters. */
+
+    upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+
+static NXT_SIMD_TARGET("sse2") void
+nxt_memcpy_lowcase_sse2(u_char *dst, const u_char *src, size_t length)
+{
+    __m128i  v;
+
+    while (length >= 16) {
+        v = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_si128((__m128i *) dst, nxt_sse2_lowcase(v));
+
+        src += 16;
+        dst += 16;
+        length -= 16;
+    }
+
+    nxt_memcpy_lowcase_generic(dst, src, length);
+}
+
+
+static NXT_SIMD_TARGET("sse2") nxt_int_t
+nxt_memcasecmp_sse2(const void *p1, const void *p2, size_t length)
+{
+    u_int         mask, i;
+    __m128i       v1, v2;
+    const u_char  *s1, *s2;
+
+    s1 = p1;
+    s2 = p2;
+
+    while (length >= 16) {
+        v1 = nxt_sse2_lowcase(_mm_loadu_si128((const __m128i *) s1));
+        v2 = nxt_sse2_lowcase(_mm_loadu_si128((const __m128i *) s2));
+
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) ^ 0xFFFF;
+
+        if (mask != 0) {
+            i = __builtin_ctz(mask);
+            return nxt_lowcase(s1[i]) - nxt_lowcase(s2[i]);
+        }
+
+        s1 += 16;
+        s2 += 16;
+        length -= 16;
+    }
+
+    return nxt_memcasecmp_generic(s1, s2, length);
+}
+
+
+static NXT_SIMD_TARGET("sse2") u_char *
+nxt_memstrn_sse2(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
+{
+    u_int         mask, i;
+    size_t        last;
+    __m128i       first_v, last_v, v1, v2;
+    const u_char  *s2;
+
+    if (length < 2 || (size_t) (end - s) < length - 1 + 16) {
+        return nxt_memstrn_generic(s, end, ss, length);
+    }
+
+    s2 = (const u_char *) ss;
+    last = length - 1;
+
+    first_v = _mm_set1_epi8(s2[0]);
+    last_v = _mm_set1_epi8(s2[last]);
+
+    while ((size_t) (end - s) >= last + 16) {
+        v1 = _mm_loadu_si128((const __m128i *) s);
+        v2 = _mm_loadu_si128((const __m128i *) (s + last));
+
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v1, first_v),
+                                               _mm_cmpeq_epi8(v2, last_v)));
+
+        while (mask != 0) {
+            i = __builtin_ctz(mask);
+
+            if (nxt_memcmp(s + i + 1, s2 + 1, length - 2) == 0) {
+                return (u_char *) s + i;
+            }
+
+            mask &= mask - 1;
+        }
+
+        s += 16;
+    }
+
+    return nxt_memstrn_generic(s, end, ss, length);
+}
+
+
+static NXT_SIMD_TARGET("sse2") u_char *
+nxt_memcasestrn_sse2(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
+{
+    u_int         mask, i;
+    size_t        last;
+    __m128i       first_v, last_v, v1, v2;
+    const u_char  *s2;
+
+    if (length < 2 || (size_t) (end - s) < length - 1 + 16) {
+        return nxt_memcasestrn_generic(s, end, ss, length);
+    }
+
+    s2 = (const u_char *) ss;
+    last = length - 1;
+
+    first_v = _mm_set1_epi8(nxt_lowcase(s2[0]));
+    last_v = _mm_set1_epi8(nxt_lowcase(s2[last]));
+
+    while ((size_t) (end - s) >= last + 16) {
+        v1 = nxt_sse2_lowcase(_mm_loadu_si128((const __m128i *) s));
+        v2 = nxt_sse2_lowcase(_mm_loadu_si128((const __m128i *) (s + last)));
+
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v1, first_v),
+                                               _mm_cmpeq_epi8(v2, last_v)));
+
+        while (mask != 0) {
+            i = __builtin_ctz(mask);
+
+            if (nxt_memcasecmp_sse2(s + i + 1, s2 + 1, length - 2) == 0) {
+                return (u_char *) s + i;
+            }
+
+            mask &= mask - 1;
+        }
+
+        s += 16;
+    }
+
+    return nxt_memcasestrn_generic(s, end, ss, length);
+}
+
+
+nxt_inline NXT_SIMD_TARGET("avx2") __m256i
+nxt_avx2_lowcase(__m256i v)
+{
+    __m256i  upper;
+
+    upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+
+    return _mm256_or_si256(v, _mm256_and_si256(upper,
+                                               _mm256_set1_epi8(0x20)));
+}
+
+
+static NXT_SIMD_TARGET("avx2") void
+nxt_memcpy_lowcase_avx2(u_char *dst, const u_char *src, size_t length)
+{
+    __m256i  v;
+
+    while (length >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) src);
+        _mm256_storeu_si256((__m256i *) dst, nxt_avx2_lowcase(v));
+
+        src += 32;
+        dst += 32;
+        length -= 32;
+    }
+
+    nxt_memcpy_lowcase_sse2(dst, src, length);
+}
+
+
+static NXT_SIMD_TARGET("avx2") nxt_int_t
+nxt_memcasecmp_avx2(const void *p1, const void *p2, size_t length)
+{
+    u_int         mask, i;
+    __m256i       v1, v2;
+    const u_char  *s1, *s2;
+
+    s1 = p1;
+    s2 = p2;
+
+    while (length >= 32) {
+        v1 = nxt_avx2_lowcase(_mm256_loadu_si256((const __m256i *) s1));
+        v2 = nxt_avx2_lowcase(_mm256_loadu_si256((const __m256i *) s2));
+
+        mask = ~ (u_int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2));
+
+        if (mask != 0) {
+            i = __builtin_ctz(mask);
+            return nxt_lowcase(s1[i]) - nxt_lowcase(s2[i]);
+        }
+
+        s1 += 32;
+        s2 += 32;
+        length -= 32;
+    }
+
+    return nxt_memcasecmp_sse2(s1, s2, length);
+}
+
+
+static NXT_SIMD_TARGET("avx2") u_char *
+nxt_memstrn_avx2(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
+{
+    u_int         mask, i;
+    size_t        last;
+    __m256i       first_v, last_v, v1, v2;
+    const u_char  *s2;
+
+    if (length < 2 || (size_t) (end - s) < length - 1 + 32) {
+        return nxt_memstrn_sse2(s, end, ss, length);
+    }
+
+    s2 = (const u_char *) ss;
+    last = length - 1;
+
+    first_v = _mm256_set1_epi8(s2[0]);
+    last_v = _mm256_set1_epi8(s2[last]);
+
+    while ((size_t) (end - s) >= last + 32) {
+        v1 = _mm256_loadu_si256((const __m256i *) s);
+        v2 = _mm256_loadu_si256((const __m256i *) (s + last));
+
+        mask = _mm256_movemask_epi8(
+                   _mm256_and_si256(_mm256_cmpeq_epi8(v1, first_v),
+                                    _mm256_cmpeq_epi8(v2, last_v)));
+
+        while (mask != 0) {
+            i = __builtin_ctz(mask);
+
+            if (nxt_memcmp(s + i + 1, s2 + 1, length - 2) == 0) {
+                return (u_char *) s + i;
+            }
+
+            mask &= mask - 1;
+        }
+
+        s += 32;
+    }
+
+    return nxt_memstrn_sse2(s, end, ss, length);
+}
+
+
+static NXT_SIMD_TARGET("avx2") u_char *
+nxt_memcasestrn_avx2(const u_char *s, const u_char *end, const char *ss,
+    size_t length)
+{
+    u_int         mask, i;
+    size_t        last;
+    __m256i       first_v, last_v, v1, v2;
+    const u_char  *s2;
+
+    if (length < 2 || (size_t) (end - s) < length - 1 + 32) {
+        return nxt_memcasestrn_sse2(s, end, ss, length);
+    }
+
+    s2 = (const u_char *) ss;
+    last = length - 1;
+
+    first_v = _mm256_set1_epi8(nxt_lowcase(s2[0]));
+    last_v = _mm256_set1_epi8(nxt_lowcase(s2[last]));
+
+    while ((size_t) (end - s) >= last + 32) {
+        v1 = nxt_avx2_lowcase(_mm256_loadu_si256((const __m256i *) s));
+        v2 = nxt_avx2_lowcase(
+                 _mm256_loadu_si256((const __m256i *) (s + last)));
+
+        mask = _mm256_movemask_epi8(
+                   _mm256_and_si256(_mm256_cmpeq_epi8(v1, first_v),
+                                    _mm256_cmpeq_epi8(v2, last_v)));
+
+        while (mask != 0) {
+            i = __builtin_ctz(mask);
+
+            if (nxt_memcasecmp_avx2(s + i + 1, s2 + 1, length - 2) == 0) {
+                return (u_char *) s + i;
+            }
+
+            mask &= mask - 1;
+        }
+
+        s += 32;
+    }
+
+    return nxt_memcasestrn_sse2(s, end, ss, length);
+}
+
+#endif
@@ -13,6 +13,9 @@
 #define NXT_PTR_SIZE                NGX_PTR_SIZE
 #define NXT_HAVE_MEMALIGN           NGX_HAVE_MEMALIGN
 #define NXT_HAVE_POSIX_MEMALIGN     NGX_HAVE_POSIX_MEMALIGN
+#define NXT_HAVE_X86_SIMD           NGX_HAVE_X86_SIMD
+#define NXT_HAVE_STAT_MTIM          NGX_HAVE_STAT_MTIM
+#define NXT_HAVE_REGEX              NGX_PCRE2
 
 
 /*
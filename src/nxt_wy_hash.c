@@ -0,0 +1,241 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+#include <nxt_main.h>
+
+
+uint64_t  nxt_wy_hash_seed;
+
+
+static const uint64_t  nxt_wy_hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL,
+};
+
+
+nxt_inline void
+nxt_wy_mum(uint64_t *a, uint64_t *b)
+{
+#if (__SIZEOF_INT128__)
+    unsigned __int128  r;
+
+    r = *a;
+    r *= *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+
+#else
+    uint64_t  ha, hb, la, lb, hi, lo, rh, rm0, rm1, rl, t, c;
+
+    ha = *a >> 32;
+    hb = *b >> 32;
+    la = (uint32_t) *a;
+    lb = (uint32_t) *b;
+
+    rh = ha * hb;
+    rm0 = ha * lb;
+    rm1 = hb * la;
+    rl = la * lb;
+
+    t = rl + (rm0 << 32);
+    c = t < rl;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+
+nxt_inline uint64_t
+nxt_wy_mix(uint64_t a, uint64_t b)
+{
+    nxt_wy_mum(&a, &b);
+
+    return a ^ b;
+}
+
+
+/*
+ * Sets bit 5 of the bytes in the "A" - "Z" range: the high bit of a byte
+ * of the sums is set if the byte is at least "A" or more than "Z".
+ */
+
+nxt_inline uint64_t
+nxt_wy_lowcase8(uint64_t v)
+{
+    uint64_t  heptets, ge_a, gt_z;
+
+    heptets = v & 0x7f7f7f7f7f7f7f7fULL;
+    ge_a = heptets + 0x3f3f3f3f3f3f3f3fULL;
+    gt_z = heptets + 0x2525252525252525ULL;
+
+    return v | (((ge_a & ~gt_z & ~v) & 0x8080808080808080ULL) >> 2);
+}
+
+
+nxt_inline uint64_t
+nxt_wy_read8(const u_char *p, nxt_bool_t lowcase)
+{
+    uint64_t  v;
+
+    nxt_memcpy(&v, p, 8);
+
+    return lowcase ? nxt_wy_lowcase8(v) : v;
+}
+
+
+nxt_inline uint64_t
+nxt_wy_read4(const u_char *p, nxt_bool_t lowcase)
+{
+    uint32_t  v;
+
+    nxt_memcpy(&v, p, 4);
+
+    return lowcase ? nxt_wy_lowcase8(v) : v;
+}
+
+
+nxt_inline uint64_t
+nxt_wy_read3(const u_char *p, size_t len, nxt_bool_t lowcase)
+{
+    u_char  c0, c1, c2;
+
+    c0 = p[0];
+    c1 = p[len >> 1];
+    c2 = p[len - 1];
+
+    if (lowcase) {
+        c0 = nxt_lowcase(c0);
+        c1 = nxt_lowcase(c1);
+        c2 = nxt_lowcase(c2);
+    }
+
+    return ((uint64_t) c0 << 16) | ((uint64_t) c1 << 8) | c2;
+}
+
+
+nxt_inline uint64_t
+nxt_wy_hash_data(const u_char *p, size_t len, nxt_bool_t lowcase)
+{
+    size_t          i;
+    uint64_t        a, b, seed, see1, see2;
+    const uint64_t  *s;
+
+    s = nxt_wy_hash_secret;
+
+    seed = nxt_wy_hash_seed;
+
+    if (nxt_fast_path(len <= 16)) {
+
+        if (nxt_fast_path(len >= 4)) {
+            a = (nxt_wy_read4(p, lowcase) << 32)
+                | nxt_wy_read4(p + ((len >> 3) << 2), lowcase);
+            b = (nxt_wy_read4(p + len - 4, lowcase) << 32)
+                | nxt_wy_read4(p + len - 4 - ((len >> 3) << 2), lowcase);
+
+        } else if (nxt_fast_path(len > 0)) {
+            a = nxt_wy_read3(p, len, lowcase);
+            b = 0;
+
+        } else {
+            a = 0;
+            b = 0;
+        }
+
+    } else {
+        i = len;
+
+        if (nxt_slow_path(i > 48)) {
+            see1 = seed;
+            see2 = seed;
+
+            do {
+                seed = nxt_wy_mix(nxt_wy_read8(p, lowcase) ^ s[1],
+                                  nxt_wy_read8(p + 8, lowcase) ^ seed);
+                see1 = nxt_wy_mix(nxt_wy_read8(p + 16, lowcase) ^ s[2],
+                                  nxt_wy_read8(p + 24, lowcase) ^ see1);
+                see2 = nxt_wy_mix(nxt_wy_read8(p + 32, lowcase) ^ s[3],
+                                  nxt_wy_read8(p + 40, lowcase) ^ see2);
+                p += 48;
+                i -= 48;
+
+            } while (nxt_fast_path(i > 48));
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = nxt_wy_mix(nxt_wy_read8(p, lowcase) ^ s[1],
+                              nxt_wy_read8(p + 8, lowcase) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = nxt_wy_read8(p + i - 16, lowcase);
+        b = nxt_wy_read8(p + i - 8, lowcase);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+
+    nxt_wy_mum(&a, &b);
+
+    return nxt_wy_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+
+uint64_t
+nxt_wy_hash(const void *data, size_t len)
+{
+    return nxt_wy_hash_data(data, len, 0);
+}
+
+
+uint64_t
+nxt_wy_hash_lowcase(const void *data, size_t len)
+{
+    return nxt_wy_hash_data(data, len, 1);
+}
+
+
+/*
+ * The seed is kept by the following cycles, which inherit the indexes.
+ * It is stored premixed with the secret, as wyhash does on every call.
+ */
+
+void
+nxt_wy_hash_init(void)
+{
+    int       fd;
+    ssize_t   n;
+    uint64_t  seed;
+
+    if (nxt_wy_hash_seed != 0) {
+        return;
+    }
+
+    n = -1;
+
+    fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd != -1) {
+        n = read(fd, &seed, sizeof(uint64_t));
+        (void) close(fd);
+    }
+
+    if (n != sizeof(uint64_t)) {
+        seed = ((uint64_t) ngx_time() << 32) ^ ngx_pid ^ (uintptr_t) &n;
+        seed = nxt_wy_mix(seed ^ nxt_wy_hash_secret[0],
+                          nxt_wy_hash_secret[1]);
+    }
+
+    seed ^= nxt_wy_mix(seed ^ nxt_wy_hash_secret[0], nxt_wy_hash_secret[1]);
+
+    nxt_wy_hash_seed = (seed != 0) ? seed : 1;
+}
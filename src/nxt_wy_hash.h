@@ -0,0 +1,26 @@
+
+/*
+ * Copyright (C) hongzhidao
+ */
+
+#ifndef _NXT_WY_HASH_H_INCLUDED_
+#define _NXT_WY_HASH_H_INCLUDED_
+
+
+/*
+ * A keyed hash after wyhash by Wang Yi.  The seed is chosen once per boot
+ * of the master process, so the hashes of request data cannot be predicted
+ * to flood a table with collisions.  nxt_wy_hash_lowcase() hashes the data
+ * as if the ASCII letters were lowercase.
+ */
+
+
+NXT_EXPORT void nxt_wy_hash_init(void);
+NXT_EXPORT uint64_t nxt_wy_hash(const void *data, size_t len);
+NXT_EXPORT uint64_t nxt_wy_hash_lowcase(const void *data, size_t len);
+
+
+extern uint64_t  nxt_wy_hash_seed;
+
+
+#endif /* _NXT_WY_HASH_H_INCLUDED_ */
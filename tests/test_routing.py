@@ -1,5 +1,7 @@
 
+import gzip
 import os
+import time
 from lib.control import TestControl 
 
 
@@ -13,6 +15,9 @@ class TestCtrl(TestControl):
         events {}
         http {
             ctrl_zone  zone=controller:10M;
+            ctrl_route_cache  1024;
+            ctrl_shared_addr  on;
+            ctrl_set  $ctrl_var  none;
             ctrl  on;
 
             server {
@@ -20,6 +25,7 @@ class TestCtrl(TestControl):
 
                 location / {
                     root  html;
+                    add_header  X-Var  $ctrl_var  always;
                 }
             }
 
@@ -30,6 +36,11 @@ class TestCtrl(TestControl):
                     ctrl  off;
                     ctrl_config;
                 }
+
+                location /stats {
+                    ctrl  off;
+                    ctrl_stats_display;
+                }
             }
         }
         ''')
@@ -277,6 +288,506 @@ class TestCtrl(TestControl):
             'rules two match second',
         )
 
+    def test_routes_rules_order(self):
+        self.assertIn(
+            'success',
+            self.conf(
+                [
+                    {
+                        "match": {"uri": "/one/*"},
+                        "action": {"return": 200, "text": "1"},
+                    },
+                    {
+                        "match": {"host": "localhost", "uri": "/two"},
+                        "action": {"return": 200, "text": "2"},
+                    },
+                    {
+                        "match": {"uri": "*o"},
+                        "action": {"return": 200, "text": "3"},
+                    },
+                    {
+                        "match": {"host": "localhost", "uri": "/one/a"},
+                        "action": {"return": 200, "text": "4"},
+                    },
+                    {
+                        "match": {"host": "localhost"},
+                        "action": {"return": 200, "text": "5"},
+                    },
+                    {"action": {"return": 200, "text": "6"}},
+                ],
+                'routes',
+            ),
+            'rules order configure',
+        )
+
+        def body(url, host='localhost'):
+            return self.get(url=url, headers={'Host': host, 'Connection': 'close'})[
+                'body'
+            ]
+
+        self.assertEqual(body('/one/a'), '1', 'order prefix')
+        self.assertEqual(body('/two'), '2', 'order host uri')
+        self.assertEqual(body('/two', 'example.com'), '3', 'order host miss')
+        self.assertEqual(body('/three'), '5', 'order host')
+        self.assertEqual(body('/three', 'example.com'), '6', 'order default')
+        self.assertEqual(body('/onea'), '5', 'order prefix segment')
+
+    def test_routes_route_cache(self):
+        def route_cache():
+            return self.conf_get('/stats/route_cache')
+
+        self.route_match({"uri": "/blah"})
+
+        stats = route_cache()
+
+        self.assertEqual(self.get(url='/blah')['status'], 200, 'miss')
+        self.assertEqual(self.get(url='/blah')['status'], 200, 'hit')
+        self.assertEqual(self.get(url='/blah?a=b')['status'], 200, 'args')
+
+        self.assertEqual(
+            route_cache()['misses'] - stats['misses'], 1, 'misses'
+        )
+        self.assertEqual(route_cache()['hits'] - stats['hits'], 2, 'hits')
+
+        self.route_match({"uri": "/blah", "method": "POST"})
+
+        self.assertEqual(self.get(url='/blah')['status'], 404, 'invalidated')
+
+        self.route_match({"uri": "/blah", "headers": {"X-Blah": "1"}})
+
+        self.assertEqual(self.get(url='/blah')['status'], 404, 'headers')
+        self.assertEqual(
+            self.get(
+                url='/blah',
+                headers={"Host": "localhost", "X-Blah": "1",
+                         "Connection": "close"},
+            )['status'],
+            200,
+            'headers not cached',
+        )
+
+    def test_routes_action_variables(self):
+        def variable(variables):
+            self.assertIn(
+                'success',
+                self.route({"action": {"variables": variables}}),
+                'variables configure',
+            )
+
+            return self.get()['headers'].get('X-Var')
+
+        self.assertEqual(variable({"ctrl_var": "one"}), 'one', 'variable')
+        self.assertEqual(
+            variable({"CTRL_VAR": "two"}), 'two', 'variable case insensitive'
+        )
+        self.assertEqual(
+            self.conf_get('routes/0/action/variables'),
+            {"CTRL_VAR": "two"},
+            'variable name unchanged',
+        )
+        self.assertEqual(
+            variable({"ctrl_unknown": "three"}), 'none', 'variable unknown'
+        )
+
+    def test_routes_action_add_headers(self):
+        def headers(action):
+            self.assertIn(
+                'success', self.route({"action": action}), 'headers configure'
+            )
+
+            return self.get()['headers']
+
+        resp = headers({"add_headers": {"X-One": "1", "X-Two": "two"}})
+        self.assertEqual(resp.get('X-One'), '1', 'add header')
+        self.assertEqual(resp.get('X-Two'), 'two', 'add header second')
+
+        resp = headers({"add_headers": {"X-One": "1"}, "return": 403})
+        self.assertNotIn('X-One', resp, 'add header error')
+
+        resp = headers(
+            {
+                "add_headers": {"X-One": "1"},
+                "add_headers_always": True,
+                "return": 403,
+            }
+        )
+        self.assertEqual(resp.get('X-One'), '1', 'add header always')
+
+        resp = headers({"add_headers": {"X-Empty": ""}})
+        self.assertNotIn('X-Empty', resp, 'add header empty')
+
+    def test_routes_action_return_gzip(self):
+        text = '{"status": "ok"}' * 64
+
+        self.assertIn(
+            'success',
+            self.route(
+                {
+                    "action": {
+                        "return": 200,
+                        "text": text,
+                        "type": "application/json",
+                        "gzip": True,
+                    }
+                }
+            ),
+            'return gzip configure',
+        )
+
+        resp = self.get()
+        self.assertEqual(resp['body'], text, 'return plain')
+        self.assertEqual(
+            resp['headers']['Content-Type'], 'application/json', 'return type'
+        )
+        self.assertNotIn('Content-Encoding', resp['headers'], 'return plain')
+
+        resp = self.get(
+            headers={
+                'Host': 'localhost',
+                'Accept-Encoding': 'gzip',
+                'Connection': 'close',
+            },
+            encoding='latin-1',
+        )
+        self.assertEqual(
+            resp['headers']['Content-Encoding'], 'gzip', 'return gzip'
+        )
+        self.assertEqual(
+            gzip.decompress(resp['body'].encode('latin-1')).decode(),
+            text,
+            'return gzip body',
+        )
+
+    def test_routes_action_limit_req_key(self):
+        def client(name=None):
+            headers = {'Host': 'localhost', 'Connection': 'close'}
+
+            if name is not None:
+                headers['X-Client'] = name
+
+            return self.get(headers=headers)['status']
+
+        self.assertIn(
+            'success',
+            self.route(
+                {
+                    "action": {
+                        "limit_req": {
+                            "key": "client:${http_x_client}",
+                            "rate": 1,
+                            "burst": 0,
+                        },
+                        "return": 200,
+                        "text": "body",
+                    }
+                }
+            ),
+            'limit_req key configure',
+        )
+
+        self.assertEqual(client('one'), 200, 'limit_req first')
+        self.assertEqual(client('one'), 503, 'limit_req same key')
+        self.assertEqual(client('two'), 200, 'limit_req other key')
+
+        self.assertIn(
+            'error',
+            self.route(
+                {"action": {"limit_req": {"key": "$", "rate": 1}}}
+            ),
+            'limit_req key invalid',
+        )
+
+        detail = self.route(
+            {"action": {"limit_req": {"key": "$ctrl_unknown", "rate": 1}}}
+        )['detail']
+        self.assertIn('"ctrl_unknown"', detail, 'limit_req key unknown')
+
+    def test_routes_action_limit_req_gcra(self):
+        def client(name):
+            return self.get(
+                headers={
+                    'Host': 'localhost',
+                    'X-Client': name,
+                    'Connection': 'close',
+                }
+            )['status']
+
+        self.assertIn(
+            'success',
+            self.route(
+                {
+                    "action": {
+                        "limit_req": {
+                            "key": "$http_x_client",
+                            "rate": 1,
+                            "burst": 0,
+                            "algorithm": "gcra",
+                        },
+                        "return": 200,
+                        "text": "body",
+                    }
+                }
+            ),
+            'limit_req gcra configure',
+        )
+
+        self.assertEqual(client('one'), 200, 'limit_req gcra first')
+        self.assertEqual(client('one'), 503, 'limit_req gcra same key')
+        self.assertEqual(client('two'), 200, 'limit_req gcra other key')
+
+        self.assertIn(
+            'error',
+            self.route(
+                {
+                    "action": {
+                        "limit_req": {"rate": 1, "algorithm": "token"}
+                    }
+                }
+            ),
+            'limit_req algorithm invalid',
+        )
+
+        self.assertIn(
+            'success',
+            self.route(
+                {
+                    "action": {
+                        "limit_req": {
+                            "key": "$http_x_client",
+                            "rate": 1,
+                            "burst": 0,
+                            "algorithm": "local",
+                        },
+                        "return": 200,
+                        "text": "body",
+                    }
+                }
+            ),
+            'limit_req local configure',
+        )
+
+        self.assertEqual(client('three'), 200, 'limit_req local first')
+        self.assertEqual(client('three'), 503, 'limit_req local same key')
+
+    def test_routes_action_limit_req_delay(self):
+        def client(name):
+            start = time.monotonic()
+
+            status = self.get(
+                headers={
+                    'Host': 'localhost',
+                    'X-Client': name,
+                    'Connection': 'close',
+                }
+            )['status']
+
+            return status, time.monotonic() - start
+
+        def limit_req(limit):
+            limit.update({"key": "$http_x_client", "rate": 1, "burst": 2})
+
+            self.assertIn(
+                'success',
+                self.route(
+                    {
+                        "action": {
+                            "limit_req": limit,
+                            "return": 200,
+                            "text": "body",
+                        }
+                    }
+                ),
+                'limit_req delay configure',
+            )
+
+        limit_req({"nodelay": True})
+
+        for _ in range(3):
+            status, elapsed = client('one')
+            self.assertEqual(status, 200, 'limit_req nodelay burst')
+            self.assertLess(elapsed, 0.5, 'limit_req nodelay time')
+
+        self.assertEqual(client('one')[0], 503, 'limit_req nodelay excess')
+
+        limit_req({"delay": 1})
+
+        self.assertLess(client('two')[1], 0.5, 'limit_req delay first')
+        self.assertLess(client('two')[1], 0.5, 'limit_req delay within')
+
+        status, elapsed = client('two')
+        self.assertEqual(status, 200, 'limit_req delay delayed')
+        self.assertGreater(elapsed, 0.5, 'limit_req delay delayed time')
+
+    def test_routes_action_limit_top(self):
+        self.assertIn(
+            'success',
+            self.route(
+                {
+                    "action": {
+                        "limit_req": {
+                            "key": "top:$http_x_client",
+                            "rate": 1,
+                        },
+                        "return": 200,
+                        "text": "body",
+                    }
+                }
+            ),
+            'limit top configure',
+        )
+
+        for _ in range(3):
+            self.get(
+                headers={
+                    'Host': 'localhost',
+                    'X-Client': 'heavy',
+                    'Connection': 'close',
+                }
+            )
+
+        # the worker counts are merged on the sweep timer
+
+        time.sleep(1.5)
+
+        top = self.conf_get('/stats/limits/top')
+
+        self.assertEqual(top[0]['key'], 'top:heavy', 'limit top key')
+        self.assertEqual(top[0]['events'], 3, 'limit top events')
+        self.assertEqual(top[0]['rejected'], 2, 'limit top rejected')
+
+    def test_routes_action_blacklist_whitelist(self):
+        def access(action):
+            action.update({"return": 200, "text": "body"})
+
+            self.assertIn(
+                'success',
+                self.route({"match": {"method": "GET"}, "action": action}),
+                'access configure',
+            )
+
+            return self.get()['status']
+
+        self.assertEqual(
+            access({"blacklist": "127.0.0.1"}), 403, 'blacklist exact'
+        )
+        self.assertEqual(
+            access({"blacklist": "127.0.0.1/32"}), 403, 'blacklist /32'
+        )
+        self.assertEqual(
+            access({"blacklist": ["10.0.0.0/8", "127.0.0.0-127.0.0.5"]}),
+            403,
+            'blacklist range',
+        )
+        self.assertEqual(
+            access({"blacklist": ["10.0.0.0/8", "127.0.0.2-127.255.0.0"]}),
+            200,
+            'blacklist range outside',
+        )
+        self.assertEqual(
+            access({"blacklist": ["::1", "127.0.0.0/30"]}),
+            403,
+            'blacklist cidr',
+        )
+        self.assertEqual(
+            access({"whitelist": ["192.168.0.0/16", "127.0.0.0/31"]}),
+            200,
+            'whitelist cidr',
+        )
+        self.assertEqual(
+            access({"whitelist": "127.0.0.2-127.0.0.255"}),
+            403,
+            'whitelist range outside',
+        )
+        self.assertEqual(
+            access({"whitelist": "0.0.0.0/0"}), 200, 'whitelist any'
+        )
+
+    def test_routes_action_blacklist_shared(self):
+        def routes(blacklist):
+            return self.conf(
+                [
+                    {
+                        "match": {"uri": "/blah"},
+                        "action": {"blacklist": blacklist,
+                                   "return": 200, "text": "body"},
+                    },
+                    {
+                        "action": {"blacklist": blacklist,
+                                   "return": 200, "text": "body"},
+                    },
+                ],
+                'routes',
+            )
+
+        for blacklist in ["127.0.0.1", ["10.0.0.0/8", "127.0.0.1"]]:
+            self.assertIn('success', routes(blacklist), 'shared configure')
+            self.assertEqual(self.get()['status'], 403, 'shared')
+            self.assertEqual(
+                self.get(url='/blah')['status'], 403, 'shared same set'
+            )
+
+        self.assertIn('success', routes("10.0.0.0/8"), 'shared replace')
+        self.assertEqual(self.get()['status'], 200, 'shared replaced')
+
+    def test_routes_action_blacklist_file(self):
+        path = self.testdir + '/blacklist.txt'
+
+        def blacklist():
+            return {"blacklist": {"file": path}, "return": 200, "text": "body"}
+
+        def access():
+            self.assertIn(
+                'success',
+                self.route({"match": {"method": "GET"}, "action": blacklist()}),
+                'blacklist file configure',
+            )
+
+            return self.get()['status']
+
+        self.write_file('blacklist.txt', '# list\n10.0.0.0/8\n127.0.0.1\n')
+
+        self.assertEqual(access(), 403, 'blacklist file')
+        self.assertFalse(os.path.exists(path + '.trie'), 'blacklist no image')
+        self.assertEqual(
+            len(os.listdir(self.testdir + '/conf/ctrl_addr')),
+            1,
+            'blacklist image',
+        )
+
+        self.write_file('blacklist.new', '10.0.0.0/8\n::1\n')
+        os.rename(self.testdir + '/blacklist.new', path)
+
+        self.assertEqual(access(), 200, 'blacklist file reload')
+
+        self.write_file('blacklist.txt', '127.0.0.1\n127.0.0.1/33\n')
+
+        self.assertIn(
+            'error',
+            self.route({"match": {"method": "GET"}, "action": blacklist()}),
+            'blacklist file invalid',
+        )
+        self.assertEqual(self.get()['status'], 200, 'blacklist file kept')
+
+        detail = self.route(
+            {
+                "action": {
+                    "blacklist": {"file": self.testdir + '/none/blacklist'},
+                    "return": 200,
+                    "text": "body",
+                }
+            }
+        )['detail']
+        self.assertIn('cannot read the list file', detail, 'blacklist no file')
+        self.assertNotIn('No such file', detail, 'blacklist no errno')
+
+        self.assertIn(
+            'error',
+            self.route(
+                {"action": {"blacklist": {}, "return": 200, "text": "body"}}
+            ),
+            'blacklist file absent',
+        )
+
     def test_routes_match_host_positive(self):
         self.route_match({"host": "localhost"})
 
@@ -319,6 +830,43 @@ class TestCtrl(TestControl):
         self.host('example.com', 200)
         self.host('www.example.com', 404)
 
+    def test_routes_match_host_suffix(self):
+        self.assertIn(
+            'success',
+            self.conf(
+                [
+                    {
+                        "match": {"host": "*.api.example.com"},
+                        "action": {"return": 200, "text": "api"},
+                    },
+                    {
+                        "match": {"host": ["example.com", "*.example.com"]},
+                        "action": {"return": 200, "text": "example"},
+                    },
+                    {
+                        "match": {"host": "*.com"},
+                        "action": {"return": 200, "text": "com"},
+                    },
+                ],
+                'routes',
+            ),
+            'suffix configure',
+        )
+
+        def body(host):
+            return self.get(headers={'Host': host, 'Connection': 'close'})[
+                'body'
+            ]
+
+        self.assertEqual(body('v1.api.example.com'), 'api', 'longest')
+        self.assertEqual(body('a.b.api.example.com'), 'api', 'deep')
+        self.assertEqual(body('api.example.com'), 'example', 'shorter')
+        self.assertEqual(body('EXAMPLE.com'), 'example', 'exact')
+        self.assertEqual(body('www.example.com:7080'), 'example', 'port')
+        self.assertEqual(body('xexample.com'), 'com', 'label')
+        self.assertEqual(self.get()['status'], 404, 'none')
+        self.host('com', 404)
+
     def test_routes_match_host_case_insensitive(self):
         self.route_match({"host": "Example.com"})
 
@@ -380,6 +928,94 @@ class TestCtrl(TestControl):
         self.assertEqual(self.get(url='/BlaH')['status'], 404, '/BlaH')
         self.assertEqual(self.get(url='/BLAH')['status'], 200, '/BLAH')
 
+    def test_routes_match_uri_substring_many(self):
+        self.route_match(
+            {
+                "uri": ["!*admin*", "!*.php"]
+                + ["*%s*" % w for w in ["bot", "crawl", "spider", "scan",
+                                        "wp-", "cgi", "shell", "xmlrpc",
+                                        "passwd", "etc"]]
+            }
+        )
+
+        self.assertEqual(self.get(url='/bot')['status'], 200, 'first')
+        self.assertEqual(self.get(url='/a/xmlrpc/b')['status'], 200, 'middle')
+        self.assertEqual(self.get(url='/etc')['status'], 200, 'last')
+        self.assertEqual(self.get(url='/BOT')['status'], 404, 'case')
+        self.assertEqual(self.get(url='/blah')['status'], 404, 'none')
+        self.assertEqual(self.get(url='/admin/bot')['status'], 404, 'negative')
+        self.assertEqual(self.get(url='/bot.php')['status'], 404, 'negative 2')
+
+    def test_routes_match_headers_substring_many(self):
+        self.route_match(
+            {
+                "headers": {
+                    "User-Agent": ["*%s*" % w for w in ["bot", "crawl",
+                                                        "spider", "scan",
+                                                        "curl", "wget",
+                                                        "python", "java"]]
+                }
+            }
+        )
+
+        def agent(value):
+            return self.get(
+                headers={
+                    "Host": "localhost",
+                    "User-Agent": value,
+                    "Connection": "close",
+                }
+            )['status']
+
+        self.assertEqual(agent('Googlebot/2.1'), 200, 'agent')
+        self.assertEqual(agent('Mozilla/5.0 CRAWLER'), 200, 'agent case')
+        self.assertEqual(agent('Mozilla/5.0'), 404, 'agent none')
+
+    def test_routes_match_regex(self):
+        self.route_match({"uri": ["!~\\.php$", "~^/api/v[0-9]+/"]})
+
+        self.assertEqual(self.get(url='/api/v1/users')['status'], 200, 'regex')
+        self.assertEqual(self.get(url='/api/v/users')['status'], 404, 'none')
+        self.assertEqual(self.get(url='/API/v1/users')['status'], 404, 'case')
+        self.assertEqual(
+            self.get(url='/api/v2/index.php')['status'], 404, 'negative'
+        )
+
+        self.route_match({"host": "~^(www\\.)?example\\.(com|org)$"})
+
+        self.host('example.com', 200)
+        self.host('WWW.Example.org', 200)
+        self.host('www.example.net', 404)
+
+        self.route_match({"headers": {"User-Agent": "~BOT|crawl"}})
+
+        self.assertEqual(
+            self.get(
+                headers={
+                    "Host": "localhost",
+                    "User-Agent": "Mozilla/5.0 Googlebot",
+                    "Connection": "close",
+                }
+            )['status'],
+            200,
+            'regex headers case insensitive',
+        )
+
+    def test_routes_match_regex_invalid(self):
+        self.route_match_invalid({"uri": "~/api/(v1"})
+        self.route_match_invalid({"uri": ["/blah", "!~[z-a]"]})
+
+        self.assertIn(
+            'offset',
+            self.route(
+                {
+                    "match": {"uri": "~a(b"},
+                    "action": {"return": 200, "text": "body"},
+                }
+            )['detail'],
+            'regex error offset',
+        )
+
     def test_routes_match_uri_normalize(self):
         self.route_match({"uri": "/blah"})
 
@@ -903,6 +1539,49 @@ class TestCtrl(TestControl):
         self.assertEqual(self.get(url='/?Foo=bar')['status'], 404, 'case')
         self.assertEqual(self.get(url='/?foo=Bar')['status'], 404, 'case 2')
 
+    def test_routes_match_arguments_headers_routes(self):
+        self.assertIn(
+            'success',
+            self.conf(
+                [
+                    {
+                        "match": {
+                            "arguments": {"foo": "bar"},
+                            "headers": {"x-header": "one"},
+                        },
+                        "action": {"return": 200, "text": "1"},
+                    },
+                    {
+                        "match": {
+                            "arguments": {"foo": "bar"},
+                            "headers": {"X-Header": "two"},
+                        },
+                        "action": {"return": 200, "text": "2"},
+                    },
+                    {
+                        "match": {"arguments": {"foo": "baz"}},
+                        "action": {"return": 200, "text": "3"},
+                    },
+                ],
+                'routes',
+            ),
+            'arguments headers routes configure',
+        )
+
+        def body(url, header):
+            return self.get(
+                url=url,
+                headers={
+                    "Host": "localhost",
+                    "X-Header": header,
+                    "Connection": "close",
+                },
+            )['body']
+
+        self.assertEqual(body('/?foo=bar', 'one'), '1', 'routes first')
+        self.assertEqual(body('/?foo=bar', 'two'), '2', 'routes second')
+        self.assertEqual(body('/?foo=baz', 'two'), '3', 'routes third')
+
     def test_routes_match_arguments_empty(self):
         self.route_match({"arguments": {}})
         self.assertEqual(self.get()['status'], 200, 'arguments empty')
@@ -999,6 +1678,49 @@ class TestCtrl(TestControl):
         self.assertEqual(self.get(url='/?var2=val2')['status'], 404, 'arr 7')
         self.assertEqual(self.get(url='/?var3=foo')['status'], 200, 'arr 8')
 
+    def test_routes_match_cookies(self):
+        self.route_match({"cookies": {"sid": "a*", "theme": "!light"}})
+
+        def cookie(value):
+            return self.get(
+                headers={
+                    "Host": "localhost",
+                    "Cookie": value,
+                    "Connection": "close",
+                }
+            )['status']
+
+        self.assertEqual(self.get()['status'], 404, 'no cookies')
+        self.assertEqual(cookie('sid=abc; theme=dark'), 200, 'cookies')
+        self.assertEqual(cookie('theme=dark;sid=abc'), 200, 'order')
+        self.assertEqual(cookie('SID=abc; theme=dark'), 404, 'case')
+        self.assertEqual(cookie('sid=abc; theme=light'), 404, 'negative')
+        self.assertEqual(
+            cookie(['sid=abc', 'theme=light']), 404, 'multiple headers'
+        )
+
+    def test_routes_match_cookies_multiple_rules(self):
+        self.route_match(
+            {"cookies": [{"x": "1"}, {"y": "2"}], "headers": {"X-Blah": "*"}}
+        )
+
+        self.assertEqual(
+            self.get(
+                headers={
+                    "Host": "localhost",
+                    "Cookie": ["a=b", "c=d;  y=2"],
+                    "X-Blah": "1",
+                    "Connection": "close",
+                }
+            )['status'],
+            200,
+            'multiple cookie headers',
+        )
+
+    def test_routes_match_cookies_invalid(self):
+        self.route_match_invalid({"cookies": ["var"]})
+        self.route_match_invalid({"cookies": [{"foo": {}}]})
+
     def test_routes_match_scheme(self):
         self.route_match({"scheme": "http"})
         self.route_match({"scheme": "https"})